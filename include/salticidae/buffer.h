@@ -1,10 +1,60 @@
 #ifndef _SALTICIDAE_BUFFER_H
 #define _SALTICIDAE_BUFFER_H
 
-#include <list>
+#include <vector>
+#include <atomic>
+#include <cstring>
+#include <sys/uio.h>
 
 namespace salticidae {
 
+/** A free list of receive chunks. A chunk fully consumed from a SegBuffer
+ * goes back to the pool so the next read can reuse its storage instead of
+ * hitting the allocator. Not thread-safe: each worker owns one. */
+class ChunkPool {
+    std::vector<bytearray_t> chunks;
+    /* the pool is bounded by the storage it holds rather than by the number
+     * of chunks, which grow up to recv_chunk_size_max */
+    size_t nbyte;
+    size_t max_nbyte;
+
+    public:
+    ChunkPool(size_t max_nbyte = 4 << 20): nbyte(0), max_nbyte(max_nbyte) {}
+
+    ChunkPool(const ChunkPool &) = delete;
+    ChunkPool(ChunkPool &&) = delete;
+
+    /** Get a chunk of `size` bytes, the content is arbitrary. */
+    bytearray_t get(size_t size) {
+        bytearray_t res;
+        if (!chunks.empty())
+        {
+            res = std::move(chunks.back());
+            chunks.pop_back();
+            nbyte -= res.capacity();
+            /* growing it would copy its content into a new allocation */
+            if (res.capacity() < size) res = bytearray_t();
+        }
+        /* resize() zero-fills the chunk beyond its last use: bytearray_t has
+         * the standard (value-initializing) allocator, and changing it would
+         * change the type throughout the API; the fill touches memory recv()
+         * is about to write anyway, and the allocation is what gets saved */
+        res.resize(size);
+        return res;
+    }
+
+    void put(bytearray_t &&chunk) {
+        size_t cap = chunk.capacity();
+        if (cap && nbyte + cap <= max_nbyte)
+        {
+            nbyte += cap;
+            chunks.push_back(std::move(chunk));
+        }
+    }
+
+    size_t size() const { return chunks.size(); }
+};
+
 class SegBuffer {
     public:
     struct buffer_entry_t {
@@ -13,6 +63,8 @@ class SegBuffer {
         buffer_entry_t(): offset(data.begin()) {}
         buffer_entry_t(bytearray_t &&_data):
             data(std::move(_data)), offset(data.begin()) {}
+        buffer_entry_t(bytearray_t &&_data, size_t _offset):
+            data(std::move(_data)), offset(data.begin() + _offset) {}
 
         buffer_entry_t(buffer_entry_t &&other) {
             size_t _offset = other.offset - other.data.begin();
@@ -32,26 +84,57 @@ class SegBuffer {
         }
 
         size_t length() const { return data.end() - offset; }
+        uint8_t *get_data() { return data.data() + (offset - data.begin()); }
     };
 
     private:
-    std::list<buffer_entry_t> buffer;
+    /* segments are kept in a ring whose capacity is always a power of 2 */
+    std::vector<buffer_entry_t> ring;
+    size_t head;
+    size_t nseg;
     size_t _size;
+    ChunkPool *pool;
+
+    buffer_entry_t &at(size_t i) { return ring[(head + i) & (ring.size() - 1)]; }
+
+    void grow() {
+        std::vector<buffer_entry_t> new_ring(ring.empty() ? 4 : ring.size() << 1);
+        for (size_t i = 0; i < nseg; i++)
+            new_ring[i] = std::move(at(i));
+        ring.swap(new_ring);
+        head = 0;
+    }
+
+    void pop_front() {
+        auto &e = at(0);
+        if (pool) pool->put(std::move(e.data));
+        e = buffer_entry_t();
+        head = (head + 1) & (ring.size() - 1);
+        nseg--;
+    }
 
     public:
-    SegBuffer(): _size(0) {}
+    SegBuffer(): head(0), nseg(0), _size(0), pool(nullptr) {}
     ~SegBuffer() { clear(); }
 
     void swap(SegBuffer &other) {
-        std::swap(buffer, other.buffer);
+        std::swap(ring, other.ring);
+        std::swap(head, other.head);
+        std::swap(nseg, other.nseg);
         std::swap(_size, other._size);
+        std::swap(pool, other.pool);
     }
 
+    /* the copy does not recycle its chunks */
     SegBuffer(const SegBuffer &other):
-        buffer(other.buffer), _size(other._size) {}
+        ring(other.ring), head(other.head), nseg(other.nseg),
+        _size(other._size), pool(nullptr) {}
 
     SegBuffer(SegBuffer &&other):
-        buffer(std::move(other.buffer)), _size(other._size) {
+        ring(std::move(other.ring)), head(other.head), nseg(other.nseg),
+        _size(other._size), pool(other.pool) {
+        other.head = 0;
+        other.nseg = 0;
         other._size = 0;
     }
 
@@ -73,74 +156,267 @@ class SegBuffer {
         return *this;
     }
 
+    /** Recycle consumed chunks to the given pool (only to be set and used by
+     * the thread owning the pool). */
+    void set_pool(ChunkPool *_pool) { pool = _pool; }
+
     void rewind(bytearray_t &&data) {
+        if (nseg == ring.size()) grow();
         _size += data.size();
-        buffer.push_front(buffer_entry_t(std::move(data)));
+        head = (head - 1) & (ring.size() - 1);
+        at(0) = buffer_entry_t(std::move(data));
+        nseg++;
     }
   
     void push(bytearray_t &&data) {
+        if (nseg == ring.size()) grow();
         _size += data.size();
-        buffer.push_back(buffer_entry_t(std::move(data)));
+        at(nseg++) = buffer_entry_t(std::move(data));
     }
 
     bytearray_t move_pop() {
-        auto res = std::move(buffer.front().data);
-        buffer.pop_front();
+        auto &e = at(0);
+        auto res = std::move(e.data);
+        e = buffer_entry_t();
+        head = (head + 1) & (ring.size() - 1);
+        nseg--;
         _size -= res.size();
         return res;
     }
     
+    /** Get the first `len` bytes without consuming them. They are returned
+     * in place, unless they span multiple segments, in which case they are
+     * copied to `scratch` (which should hold at least `len` bytes). Returns
+     * nullptr if the buffer has less than `len` bytes. */
+    const uint8_t *peek(size_t len, uint8_t *scratch) {
+        if (_size < len) return nullptr;
+        if (!len) return scratch;
+        auto &e = at(0);
+        if (e.length() >= len) return e.get_data();
+        for (size_t i = 0, copied = 0; copied < len; i++)
+        {
+            auto &e = at(i);
+            size_t copy_len = std::min(e.length(), len - copied);
+            memmove(scratch + copied, e.get_data(), copy_len);
+            copied += copy_len;
+        }
+        return scratch;
+    }
+
+    /** Discard the first `len` bytes. */
+    void skip(size_t len) {
+        while (len && nseg)
+        {
+            auto &e = at(0);
+            size_t skip_len = std::min(e.length(), len);
+            e.offset += skip_len;
+            len -= skip_len;
+            _size -= skip_len;
+            if (e.offset == e.data.end())
+                pop_front();
+        }
+    }
+
     bytearray_t pop(size_t len) {
+        if (len && nseg && at(0).length() >= len)
+        {
+            /* the requested bytes start the first segment: take over its
+             * storage, only copying out the bytes after them (if fewer) */
+            auto &e = at(0);
+            size_t suffix = e.length() - len;
+            if (e.offset == e.data.begin() && suffix < len)
+            {
+                bytearray_t res = std::move(e.data);
+                if (suffix)
+                    e = buffer_entry_t(bytearray_t(res.end() - suffix, res.end()));
+                else
+                {
+                    e = buffer_entry_t();
+                    head = (head + 1) & (ring.size() - 1);
+                    nseg--;
+                }
+                res.resize(len);
+                _size -= len;
+                return res;
+            }
+        }
         bytearray_t res;
-        auto i = buffer.begin();
-        while (len && i != buffer.end())
+        res.reserve(std::min(len, _size));
+        while (len && nseg)
         {
-            size_t copy_len = std::min(i->length(), len);
-            res.insert(res.end(), i->offset, i->offset + copy_len);
-            i->offset += copy_len;
+            auto &e = at(0);
+            size_t copy_len = std::min(e.length(), len);
+            res.insert(res.end(), e.offset, e.offset + copy_len);
+            e.offset += copy_len;
             len -= copy_len;
-            if (i->offset == i->data.end())
-                i++;
+            if (e.offset == e.data.end())
+                pop_front();
         }
-        buffer.erase(buffer.begin(), i);
         _size -= res.size();
         return res;
     }
     
     size_t size() const { return _size; }
-    size_t len() const { return buffer.size(); }
-    bool empty() const { return buffer.empty(); }
+    size_t len() const { return nseg; }
+    bool empty() const { return !nseg; }
     
     void clear() {
-        buffer.clear();
+        for (size_t i = 0; i < nseg; i++)
+            at(i) = buffer_entry_t();
+        head = 0;
+        nseg = 0;
         _size = 0;
     }
 };
 
+/** The priority classes of outgoing messages, from the most urgent. */
+enum SendPriority {
+    SEND_PRIO_HIGH,
+    SEND_PRIO_NORMAL,
+    SEND_PRIO_LOW,
+};
+
 struct MPSCWriteBuffer {
-    using buffer_entry_t = SegBuffer::buffer_entry_t;
-    using queue_t = MPSCQueueEventDriven<buffer_entry_t>;
+    /** An outgoing segment: an optional (small) header sent right before the
+     * data, so a message never has to be concatenated with its header. */
+    struct buffer_entry_t {
+        bytearray_t header;
+        bytearray_t data;
+        /** read-only data shared by many entries (used in place of `data`),
+         * e.g., the payload of a multicast message */
+        ArcObj<const bytearray_t> shared;
+        /** the slice of `shared` to send */
+        size_t shared_off;
+        size_t shared_len;
+        /** the number of bytes (header first) that have been sent */
+        size_t offset;
+
+        buffer_entry_t(): shared_off(0), shared_len(0), offset(0) {}
+        buffer_entry_t(bytearray_t &&_data):
+            data(std::move(_data)), shared_off(0), shared_len(0), offset(0) {}
+        buffer_entry_t(bytearray_t &&_header, bytearray_t &&_data):
+            header(std::move(_header)), data(std::move(_data)),
+            shared_off(0), shared_len(0), offset(0) {}
+        buffer_entry_t(bytearray_t &&_header, const ArcObj<const bytearray_t> &_shared):
+            header(std::move(_header)), shared(_shared),
+            shared_off(0), shared_len(_shared->size()), offset(0) {}
+        buffer_entry_t(bytearray_t &&_header, const ArcObj<const bytearray_t> &_shared,
+                        size_t off, size_t len):
+            header(std::move(_header)), shared(_shared),
+            shared_off(off), shared_len(len), offset(0) {}
+
+        buffer_entry_t(buffer_entry_t &&other) = default;
+        buffer_entry_t &operator=(buffer_entry_t &&other) = default;
+
+        const uint8_t *body_data() const {
+            return shared ? shared->data() + shared_off : data.data();
+        }
+        size_t body_size() const { return shared ? shared_len : data.size(); }
+        size_t size() const { return header.size() + body_size(); }
+        size_t length() const { return size() - offset; }
+
+        /** Fill at most 2 iovecs with the unsent bytes, return the number of
+         * iovecs used. */
+        size_t get_iovec(struct iovec *iov) const {
+            /* writev() does not modify the data */
+            auto body_ptr = const_cast<uint8_t *>(body_data());
+            size_t n = 0;
+            if (offset < header.size())
+            {
+                iov[n].iov_base = const_cast<uint8_t *>(header.data()) + offset;
+                iov[n++].iov_len = header.size() - offset;
+                if (body_size())
+                {
+                    iov[n].iov_base = body_ptr;
+                    iov[n++].iov_len = body_size();
+                }
+            }
+            else if (offset < size())
+            {
+                iov[n].iov_base = body_ptr + (offset - header.size());
+                iov[n++].iov_len = size() - offset;
+            }
+            return n;
+        }
+    };
+
+    /* every connection owns a write buffer, so use small blocks that are
+     * only allocated when the queue grows */
+    static const size_t block_size = 64;
+    using queue_t = MPSCQueueEventDriven<buffer_entry_t, block_size>;
+    using lane_t = MPSCQueue<buffer_entry_t, block_size>;
+    /** the normal lane, whose events also wake up the consumer for the
+     * other lanes */
     queue_t buffer;
+    /** the high and low priority lanes, created upon their first use */
+    std::atomic<lane_t *> high;
+    std::atomic<lane_t *> low;
+    size_t capacity;
+    /** the entries put back by the consumer, to be sent before any other
+     * (in reverse order), so a partially sent message is never interleaved
+     * with another one */
+    std::vector<buffer_entry_t> rewound;
+
+    lane_t *get_lane(std::atomic<lane_t *> &lane) {
+        auto l = lane.load(std::memory_order_acquire);
+        if (l) return l;
+        auto nl = new lane_t();
+        nl->set_capacity(capacity, true);
+        if (lane.compare_exchange_strong(l, nl, std::memory_order_acq_rel))
+            return nl;
+        /* created by another writer meanwhile */
+        delete nl;
+        return l;
+    }
 
-    MPSCWriteBuffer() {}
+    static bool try_pop(std::atomic<lane_t *> &lane, buffer_entry_t &e) {
+        auto l = lane.load(std::memory_order_acquire);
+        return l && l->try_dequeue(e);
+    }
+
+    MPSCWriteBuffer(): high(nullptr), low(nullptr), capacity(0) {}
+    ~MPSCWriteBuffer() {
+        delete high.load(std::memory_order_relaxed);
+        delete low.load(std::memory_order_relaxed);
+    }
 
     MPSCWriteBuffer(const SegBuffer &other) = delete;
     MPSCWriteBuffer(SegBuffer &&other) = delete;
 
-    void set_capacity(size_t capacity) { buffer.set_capacity(capacity); }
+    void set_capacity(size_t _capacity) {
+        capacity = _capacity;
+        buffer.set_capacity(capacity, true);
+    }
 
-    void rewind(bytearray_t &&data) {
-        buffer.rewind(buffer_entry_t(std::move(data)));
+    /* the bytes before the offset of a partially sent entry will not be sent
+     * again (only to be called by the consumer) */
+    void rewind(buffer_entry_t &&e) {
+        rewound.push_back(std::move(e));
     }
-  
-    bool push(bytearray_t &&data, bool unbounded) {
-        return buffer.enqueue(buffer_entry_t(std::move(data)), unbounded);
+
+    bool push(buffer_entry_t &&e, bool unbounded,
+            SendPriority prio = SEND_PRIO_NORMAL) {
+        if (prio == SEND_PRIO_NORMAL)
+            return buffer.enqueue(std::move(e), unbounded);
+        if (!get_lane(prio == SEND_PRIO_HIGH ? high : low)->enqueue(
+                std::move(e), unbounded))
+            return false;
+        buffer.notify();
+        return true;
     }
 
-    bytearray_t move_pop() {
+    /* the returned entry is empty if there is nothing to send, the lanes
+     * are drained in the order of their priorities */
+    buffer_entry_t move_pop() {
         buffer_entry_t res;
-        buffer.try_dequeue(res);
-        return res.data;
+        if (!rewound.empty())
+        {
+            res = std::move(rewound.back());
+            rewound.pop_back();
+        }
+        else if (!try_pop(high, res) && !buffer.try_dequeue(res))
+            try_pop(low, res);
+        return res;
     }
     
     queue_t &get_queue() { return buffer; }
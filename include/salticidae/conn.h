@@ -28,6 +28,7 @@
 #ifdef __cplusplus
 #include <cassert>
 #include <cstdint>
+#include <climits>
 #include <arpa/inet.h>
 #include <unistd.h>
 
@@ -47,6 +48,8 @@
 #include "salticidae/netaddr.h"
 #include "salticidae/msg.h"
 #include "salticidae/buffer.h"
+#include "salticidae/stat.h"
+#include "salticidae/uring.h"
 
 namespace salticidae {
 
@@ -61,8 +64,22 @@ class ConnPool {
     using conn_t = ArcObj<Conn>;
     /** The type of callback invoked when connection status is changed. */
     using conn_callback_t = std::function<bool(const conn_t &, bool)>;
+    /** The type of callback invoked when the send buffer of a connection
+     * reaches the high watermark (true) or drains to the low one (false). */
+    using send_buff_callback_t = std::function<void(const conn_t &, bool)>;
     /** The type of callback invoked when an error occured (during async execution). */
     using error_callback_t = std::function<void(const std::exception_ptr, bool, int32_t)>;
+    /** The built-in policies of assigning a new connection to a worker. */
+    enum WorkerPolicy {
+        WORKER_LEAST_CONN, /**< the worker with the fewest connections */
+        WORKER_LEAST_BYTES, /**< the worker that moved the fewest bytes lately
+                              (the same as WORKER_LEAST_CONN without
+                              SALTICIDAE_MSG_STAT) */
+        WORKER_HASH_ADDR, /**< consistent hashing of the remote address */
+    };
+    /** The type of callback that returns the index of the worker for a new
+     * connection (invoked by the dispatcher). */
+    using worker_selector_t = std::function<size_t(const conn_t &, size_t)>;
     /** Abstraction for a bi-directional connection. */
     class Conn {
         friend ConnPool;
@@ -75,15 +92,34 @@ class ConnPool {
         protected:
         std::atomic<bool> terminated;
         size_t recv_chunk_size;
+        /** the range recv_chunk_size adapts within (fixed if min == max) */
+        size_t recv_chunk_min;
+        size_t recv_chunk_max;
+        /** consecutive reads that filled less than a quarter of the chunk */
+        uint8_t recv_nsmall;
+        /** size each read by FIONREAD */
+        bool recv_exact;
         size_t max_recv_buff_size;
+        size_t send_burst_size;
+        /** bytes encrypted or decrypted per socket event (0 for no limit) */
+        size_t tls_io_budget;
         int fd;
-        Worker *worker;
+        /* written by the source worker when the connection migrates, so it
+         * is read with get_worker() */
+        std::atomic<Worker *> worker;
         ConnPool *cpool;
         ConnMode mode;
         NetAddr addr;
 
+        Worker *get_worker() const { return worker.load(std::memory_order_acquire); }
+
         MPSCWriteBuffer send_buffer;
         SegBuffer recv_buffer;
+        /** bytes written to the connection but not yet sent */
+        std::atomic<size_t> send_buff_bytes;
+        /** the send buffer has reached the high watermark and not yet
+         * drained to the low one (updated by the worker) */
+        std::atomic<bool> send_congested;
 
         /* initialized and destroyed by the dispatcher */
         TimedFdEvent ev_connect;
@@ -92,6 +128,10 @@ class ConnPool {
         /** does not need to wait if true */
         bool ready_send;
         bool ready_recv;
+        /** the socket is polled after the setup (owned by the worker) */
+        bool polling;
+        /** a migration is in progress (owned by the dispatcher) */
+        bool migrating;
 
         typedef void (socket_io_func)(const conn_t &, int, int);
         socket_io_func *send_data_func;
@@ -108,17 +148,88 @@ class ConnPool {
         static socket_io_func _send_data_tls_handshake;
         static socket_io_func _recv_data_dummy;
 
+        /** Adapt recv_chunk_size to a read of n bytes into it: double the
+         * chunk once a read fills it up, and halve it after a few reads in a
+         * row that use less than a quarter of it. */
+        void adapt_recv_chunk_size(size_t n) {
+            if (recv_chunk_min == recv_chunk_max) return;
+            if (n == recv_chunk_size)
+            {
+                recv_nsmall = 0;
+                recv_chunk_size = std::min(recv_chunk_size << 1, recv_chunk_max);
+            }
+            else if (n < recv_chunk_size >> 2)
+            {
+                if (++recv_nsmall < 4) return;
+                recv_nsmall = 0;
+                recv_chunk_size = std::max(recv_chunk_size >> 1, recv_chunk_min);
+            }
+            else
+                recv_nsmall = 0;
+        }
+
+#ifdef SALTICIDAE_IO_URING
+        /** an outstanding io_uring request, which holds the connection
+         * until it completes */
+        struct uring_op_t {
+            conn_t conn;
+            const bool is_send;
+            uring_op_t(bool is_send): is_send(is_send) {}
+        };
+        /** the socket I/O goes through the io_uring of the worker */
+        bool uring;
+        uring_op_t uring_recv_op;
+        uring_op_t uring_send_op;
+        bytearray_t uring_recv_buff;
+        /* the segments (and their iovecs) of the write in flight */
+        std::vector<MPSCWriteBuffer::buffer_entry_t> uring_segs;
+        std::vector<struct iovec> uring_iov;
+
+        static socket_io_func _recv_data_uring;
+        static socket_io_func _send_data_uring;
+        static void _recv_done_uring(const conn_t &conn, int res);
+        static void _send_done_uring(const conn_t &conn, int res);
+#endif
+
+#ifdef SALTICIDAE_MSG_STAT
+        /** segments written to the connection but not yet sent */
+        mutable std::atomic<size_t> nsendq;
+        /** received bytes not yet parsed (updated by the worker) */
+        StatCounter recv_buff_size;
+        /** when the TLS handshake started */
+        uint64_t tls_start_ts;
+#endif
+#ifdef SALTICIDAE_MSG_TRACE
+        /** when the worker last read from the socket */
+        uint64_t recv_ts;
+#endif
+
         public:
         Conn(): terminated(false),
             // recv_chunk_size initialized later
+            // recv_chunk_min initialized later
+            // recv_chunk_max initialized later
+            recv_nsmall(0),
+            // recv_exact initialized later
             // max_recv_buff_size initialized later
+            // send_burst_size initialized later
+            // tls_io_budget initialized later
             fd(-1),
             worker(nullptr),
             cpool(nullptr),
             mode(ConnMode::PASSIVE),
+            send_buff_bytes(0), send_congested(false),
             ready_send(false), ready_recv(false),
+            polling(false), migrating(false),
             send_data_func(nullptr), recv_data_func(nullptr),
-            tls(nullptr), peer_cert(nullptr) {}
+            tls(nullptr), peer_cert(nullptr)
+#ifdef SALTICIDAE_IO_URING
+            , uring(false), uring_recv_op(false), uring_send_op(true)
+#endif
+#ifdef SALTICIDAE_MSG_STAT
+            , nsendq(0)
+#endif
+        {}
         Conn(const Conn &) = delete;
         Conn(Conn &&other) = delete;
 
@@ -140,20 +251,114 @@ class ConnPool {
         ConnMode get_mode() const { return mode; }
         ConnPool *get_pool() const { return cpool; }
 
+#ifdef SALTICIDAE_MSG_STAT
+        size_t get_send_queue_len() const { return nsendq.load(std::memory_order_relaxed); }
+        size_t get_recv_buff_size() const { return recv_buff_size; }
+        /** Bytes in the kernel send buffer that have not been sent yet. */
+        size_t get_kernel_send_queue() const;
+        /** Bytes in the kernel receive buffer that have not been read yet. */
+        size_t get_kernel_recv_queue() const;
+#endif
+
+        /** The number of bytes written but not yet sent. */
+        size_t get_send_buff_bytes() const {
+            return send_buff_bytes.load(std::memory_order_relaxed);
+        }
+
+        /** Whether the send buffer is above the low watermark after having
+         * reached the high one (see ConnPool::reg_send_buff_handler()). */
+        bool is_send_congested() const {
+            return send_congested.load(std::memory_order_relaxed);
+        }
+
         /** Write data to the connection (non-blocking). The data will be sent
-         * whenever I/O is available. */
-        bool write(bytearray_t &&data) {
-            return send_buffer.push(std::move(data), !cpool->max_send_buff_size);
+         * whenever I/O is available, after the data written with a higher
+         * priority. */
+        bool write(bytearray_t &&data, SendPriority prio = SEND_PRIO_NORMAL) {
+            return write(MPSCWriteBuffer::buffer_entry_t(std::move(data)), prio);
+        }
+
+        /** Write a header and its data as one unit, without concatenating
+         * them. */
+        bool write(bytearray_t &&header, bytearray_t &&data,
+                    SendPriority prio = SEND_PRIO_NORMAL) {
+            return write(MPSCWriteBuffer::buffer_entry_t(
+                            std::move(header), std::move(data)), prio);
+        }
+
+        /** Write a header followed by data that is shared (not copied) with
+         * other writes. */
+        bool write(bytearray_t &&header, const ArcObj<const bytearray_t> &data,
+                    SendPriority prio = SEND_PRIO_NORMAL) {
+            return write(MPSCWriteBuffer::buffer_entry_t(std::move(header), data), prio);
+        }
+
+        /** Write a header followed by the slice [off, off + len) of shared
+         * data. */
+        bool write(bytearray_t &&header, const ArcObj<const bytearray_t> &data,
+                    size_t off, size_t len, SendPriority prio = SEND_PRIO_NORMAL) {
+            return write(MPSCWriteBuffer::buffer_entry_t(
+                            std::move(header), data, off, len), prio);
+        }
+
+        /** Write the segments in order as one unit: either all or none of
+         * them are queued. Only the first segment is checked against the
+         * limit on the number of segments. */
+        bool write(std::vector<MPSCWriteBuffer::buffer_entry_t> &&segs,
+                    SendPriority prio = SEND_PRIO_NORMAL) {
+            if (segs.empty()) return true;
+            size_t len = 0;
+            for (const auto &seg: segs) len += seg.length();
+            const size_t max_bytes = cpool->max_send_buff_bytes;
+            size_t nbytes = send_buff_bytes.fetch_add(len, std::memory_order_relaxed);
+            if ((max_bytes && nbytes && nbytes + len > max_bytes) ||
+                !send_buffer.push(std::move(segs[0]), !cpool->max_send_buff_size, prio))
+            {
+                send_buff_bytes.fetch_sub(len, std::memory_order_relaxed);
+                return false;
+            }
+            for (size_t i = 1; i < segs.size(); i++)
+                send_buffer.push(std::move(segs[i]), true, prio);
+#ifdef SALTICIDAE_MSG_STAT
+            nsendq.fetch_add(segs.size(), std::memory_order_relaxed);
+#endif
+            return true;
+        }
+
+        /** Return false without queuing the segment if the send buffer is
+         * full, by the number of segments or bytes. */
+        bool write(MPSCWriteBuffer::buffer_entry_t &&seg,
+                    SendPriority prio = SEND_PRIO_NORMAL) {
+            const size_t len = seg.length();
+            const size_t max_bytes = cpool->max_send_buff_bytes;
+            size_t nbytes = send_buff_bytes.fetch_add(len, std::memory_order_relaxed);
+            /* a segment larger than the limit still goes into an empty buffer */
+            if ((max_bytes && nbytes && nbytes + len > max_bytes) ||
+                !send_buffer.push(std::move(seg), !cpool->max_send_buff_size, prio))
+            {
+                send_buff_bytes.fetch_sub(len, std::memory_order_relaxed);
+                return false;
+            }
+#ifdef SALTICIDAE_MSG_STAT
+            nsendq.fetch_add(1, std::memory_order_relaxed);
+#endif
+            return true;
         }
     };
 
     protected:
-    int system_state;
+    /* 0 before start(), 1 while running and 2 once stopped; set by the user
+     * thread and read by the handler threads */
+    std::atomic<int> system_state;
     EventContext ec;
     EventContext disp_ec;
     ThreadCall* disp_tcall;
+    /** coarse timers of the dispatcher (shared with worker 0) */
+    TimerWheel *disp_timer_wheel;
     BoxObj<ThreadCall> user_tcall;
     const bool enable_tls;
+    /* how long the consumers poll their queues before sleeping */
+    const double queue_spin_time;
     RcObj<const X509> tls_cert;
 
     using worker_error_callback_t = std::function<void(const std::exception_ptr err)>;
@@ -179,36 +384,101 @@ class ConnPool {
     virtual Conn *create_conn() = 0;
     /** Called when new data is available. */
     virtual void on_read(const conn_t &) {}
+    /** Called by the worker when it is woken up to send the data written to
+     * the connection, before sending it. */
+    virtual void on_send_wakeup(const conn_t &) {}
     /** Called when the underlying connection is established. */
     virtual void on_worker_setup(const conn_t &) {}
     /** Called when the underlying connection is established. */
     virtual void on_dispatcher_setup(const conn_t &) {}
     /** Called when the underlying connection breaks. */
     virtual void on_worker_teardown(const conn_t &conn) {
-        if (conn->worker) conn->worker->unfeed();
+#ifdef SALTICIDAE_IO_URING
+        if (conn->uring) conn->get_worker()->cancel_uring(conn);
+#endif
+        if (conn->get_worker()) conn->get_worker()->unfeed();
         if (conn->tls) conn->tls->shutdown();
         conn->ev_socket.clear();
         conn->send_buffer.get_queue().unreg_handler();
     }
     /** Called when the underlying connection breaks. */
     virtual void on_dispatcher_teardown(const conn_t &) {}
+    /** Called by the old worker before the connection migrates. */
+    virtual void on_worker_detach(const conn_t &conn) {
+        conn->ev_socket.clear();
+        conn->send_buffer.get_queue().unreg_handler();
+    }
+    /** Called by the new worker after the connection migrates. */
+    virtual void on_worker_attach(const conn_t &conn) {
+        auto worker = conn->get_worker();
+        conn->recv_buffer.set_pool(&worker->get_chunk_pool());
+        worker->setup_socket(conn, conn->fd);
+        worker->enable_send_buffer(conn, conn->fd);
+        /* a spurious WRITE event flushes whatever was queued meanwhile */
+        conn->ev_socket.add((conn->ready_recv ? 0 : FdEvent::READ) | FdEvent::WRITE);
+    }
+
+    /** Run func on the worker of the connection, following the connection
+     * if it migrates before func gets to run. */
+    template<typename Func>
+    static void conn_async_call(const conn_t &conn, Func &&func) {
+        auto worker = conn->get_worker();
+        worker->get_tcall()->async_call(
+                [conn, worker, func=std::forward<Func>(func)](ThreadCall::Handle &h) mutable {
+            if (conn->get_worker() != worker)
+                conn_async_call(conn, std::move(func));
+            else
+                func(h);
+        });
+    }
+
+    /** Visit all connections (only to be called by the dispatcher). */
+    template<typename Func>
+    void for_each_conn(Func &&f) const {
+        for (const auto &p: pool) f(p.second);
+    }
 
     private:
     const int max_listen_backlog;
     const double conn_server_timeout;
     const size_t recv_chunk_size;
+    const size_t recv_chunk_min;
+    const size_t recv_chunk_max;
+    const bool recv_exact;
     const size_t max_recv_buff_size;
     const size_t max_send_buff_size;
+    const size_t max_send_buff_bytes;
+    const size_t send_buff_high;
+    const size_t send_buff_low;
+    const size_t send_burst_size;
+    const size_t tls_io_budget;
+    const bool listen_per_worker;
     tls_context_t tls_ctx;
 
     conn_callback_t conn_cb;
     error_callback_t error_cb;
+    send_buff_callback_t send_buff_cb;
 
     /* owned by the dispatcher */
     FdEvent ev_listen;
     std::unordered_map<int, conn_t> pool;
     int listen_fd;  /**< for accepting new network connections */
 
+    /** Report the connection to send_buff_cb if its send buffer crosses a
+     * watermark (only to be called by the worker of the connection). */
+    void update_send_buff(const conn_t &conn) {
+        if (!send_buff_high) return;
+        size_t nbytes = conn->send_buff_bytes.load(std::memory_order_relaxed);
+        bool congested = conn->send_congested.load(std::memory_order_relaxed);
+        if (congested ? nbytes > send_buff_low : nbytes < send_buff_high)
+            return;
+        congested = !congested;
+        conn->send_congested.store(congested, std::memory_order_relaxed);
+        user_tcall->async_call([this, conn, congested](ThreadCall::Handle &) {
+            if (send_buff_cb) send_buff_cb(conn, congested);
+        });
+    }
+
     void update_conn(const conn_t &conn, bool connected) {
         user_tcall->async_call([this, conn, connected](ThreadCall::Handle &) {
             bool ret = !conn_cb || conn_cb(conn, connected);
@@ -216,10 +486,11 @@ class ConnPool {
             {
                 if (enable_tls)
                 {
-                    conn->worker->get_tcall()->async_call([this, conn, ret](ThreadCall::Handle &) {
+                    conn_async_call(conn, [this, conn, ret](ThreadCall::Handle &) {
                         if (conn->is_terminated()) return;
                         if (ret)
                         {
+                            conn->polling = true;
                             conn->recv_data_func = Conn::_recv_data_tls;
                             conn->ev_socket.del();
                             conn->ev_socket.add(FdEvent::READ | FdEvent::WRITE);
@@ -228,8 +499,19 @@ class ConnPool {
                     });
                 }
                 else
-                    conn->worker->get_tcall()->async_call([conn](ThreadCall::Handle &) {
+                    conn_async_call(conn, [conn](ThreadCall::Handle &) {
                         if (conn->is_terminated()) return;
+                        conn->polling = true;
+#ifdef SALTICIDAE_IO_URING
+                        if (conn->uring)
+                        {
+                            /* post the first read and flush what is queued */
+                            conn->ready_send = true;
+                            conn->recv_data_func(conn, conn->fd, FdEvent::READ);
+                            conn->send_data_func(conn, conn->fd, FdEvent::WRITE);
+                            return;
+                        }
+#endif
                         conn->ev_socket.add(FdEvent::READ | FdEvent::WRITE);
                     });
             }
@@ -240,15 +522,50 @@ class ConnPool {
     class Worker {
         EventContext ec;
         ThreadCall tcall;
+        /** coarse timers of the connections owned by the worker */
+        TimerWheel timer_wheel;
         BoxObj<ThreadCall> exit_tcall; /** only used by the dispatcher thread */
         std::thread handle;
         bool disp_flag;
+        size_t id;
         std::atomic<size_t> nconn;
         ConnPool::worker_error_callback_t on_fatal_error;
+        /** recycles the receive chunks of the connections owned by the worker */
+        ChunkPool chunk_pool;
+        cpu_list_t cpus;
+        /** the listening socket owned by the worker (see
+         * Config::listen_per_worker()) */
+        int listen_fd;
+        FdEvent ev_listen;
+#ifdef SALTICIDAE_IO_URING
+        BoxObj<IOUring> uring;
+        FdEvent ev_uring;
+        TimerEvent ev_uring_submit;
+        bool uring_submit_pending;
+
+        void on_uring_ready();
+        void drain_uring();
+#endif
+#ifdef SALTICIDAE_MSG_STAT
+        PaddedStat<IOStat> io_stat;
+#endif
 
         public:
 
-        Worker(): tcall(ec), disp_flag(false), nconn(0) {}
+        Worker(): tcall(ec), timer_wheel(ec), disp_flag(false), id(0), nconn(0),
+            listen_fd(-1)
+#ifdef SALTICIDAE_IO_URING
+            , uring_submit_pending(false)
+#endif
+        {}
+
+        /* only to be used by the worker thread */
+        ChunkPool &get_chunk_pool() { return chunk_pool; }
+        TimerWheel &get_timer_wheel() { return timer_wheel; }
+#ifdef SALTICIDAE_MSG_STAT
+        /* only to be updated by the worker thread */
+        IOStat &get_io_stat() { return io_stat; }
+#endif
 
         void set_error_callback(ConnPool::worker_error_callback_t _on_error) {
             on_fatal_error = std::move(_on_error);
@@ -259,11 +576,33 @@ class ConnPool {
         }
 
         /* the following functions are called by the dispatcher */
+        void set_cpus(cpu_list_t _cpus) { cpus = std::move(_cpus); }
+
+#ifdef SALTICIDAE_IO_URING
+        /* the following functions are called by the worker */
+        /** Return false if io_uring is not available (called before start). */
+        bool enable_uring(unsigned entries);
+        IOUring *get_uring() { return uring.get(); }
+        /** Submit the requests queued during this iteration of the event loop
+         * with a single system call. */
+        void schedule_uring_submit() {
+            if (uring_submit_pending) return;
+            uring_submit_pending = true;
+            ev_uring_submit.add(0);
+        }
+        void cancel_uring(const conn_t &conn);
+#endif
+
         void start() {
             handle = std::thread([this]() {
                 sigset_t mask;
                 sigfillset(&mask);
                 pthread_sigmask(SIG_BLOCK, &mask, NULL);
+                /* pinned before anything is allocated, so that the receive
+                 * chunks and the queue blocks produced by the worker are
+                 * first touched on its NUMA node */
+                if (!set_thread_affinity(cpus))
+                    SALTICIDAE_LOG_WARN("failed to set the cpu affinity of worker %zu", id);
                 ec.dispatch();
             });
         }
@@ -272,6 +611,17 @@ class ConnPool {
             conn->send_buffer.get_queue()
                     .reg_handler(this->ec, [conn, client_fd]
                                 (MPSCWriteBuffer::queue_t &) {
+                conn->cpool->on_send_wakeup(conn);
+                /* the writers may have filled up the buffer */
+                conn->cpool->update_send_buff(conn);
+#ifdef SALTICIDAE_IO_URING
+                if (conn->uring)
+                {
+                    if (conn->ready_send)
+                        conn->send_data_func(conn, client_fd, FdEvent::WRITE);
+                    return false;
+                }
+#endif
                 if (conn->ready_send)
                 {
                     conn->ev_socket.del();
@@ -283,66 +633,153 @@ class ConnPool {
             });
         }
 
+        void setup_socket(const conn_t &conn, int client_fd) {
+            conn->ev_socket = FdEvent(ec, client_fd, [conn](int fd, int what) {
+                try {
+                    if (what & FdEvent::READ)
+                        conn->recv_data_func(conn, fd, what);
+                    else
+                        conn->send_data_func(conn, fd, what);
+                } catch (...) {
+                    conn->cpool->recoverable_error(std::current_exception(), -1);
+                    conn->cpool->worker_terminate(conn);
+                }
+            });
+        }
+
         void feed(const conn_t &conn, int client_fd) {
             /* the caller should finalize all the preparation */
+            /* counted right away so a burst of new connections is spread */
+            nconn++;
             tcall.async_call([this, conn, client_fd](ThreadCall::Handle &) {
-                try {
-                    conn->ev_socket = FdEvent(ec, client_fd, [this, conn](int fd, int what) {
-                        try {
-                            if (what & FdEvent::READ)
-                                conn->recv_data_func(conn, fd, what);
-                            else
-                                conn->send_data_func(conn, fd, what);
-                        } catch (...) {
-                            conn->cpool->recoverable_error(std::current_exception(), -1);
-                            conn->cpool->worker_terminate(conn);
-                        }
-                    });
-                    auto cpool = conn->cpool;
-                    if (cpool->enable_tls)
+                setup(conn, client_fd);
+            });
+        }
+
+        /* the following functions are called by the worker */
+        /** Set up a connection fed to (or accepted by) the worker. */
+        void setup(const conn_t &conn, int client_fd) {
+            try {
+                conn->recv_buffer.set_pool(&chunk_pool);
+                auto cpool = conn->cpool;
+#ifdef SALTICIDAE_IO_URING
+                /* completion-based I/O does not poll the socket */
+                conn->uring = uring && !cpool->enable_tls;
+                if (!conn->uring)
+#endif
+                setup_socket(conn, client_fd);
+                if (cpool->enable_tls)
+                {
+                    bool accept = conn->mode == Conn::ConnMode::PASSIVE;
+                    /* a client resumes the session with the same
+                     * address */
+                    conn->tls = new TLS(
+                            cpool->tls_ctx, client_fd, accept,
+                            accept ? std::string() : std::string(conn->addr));
+#ifdef SALTICIDAE_MSG_STAT
+                    conn->tls_start_ts = get_monotonic_ns();
+#endif
+                    conn->send_data_func = Conn::_send_data_tls_handshake;
+                    conn->recv_data_func = Conn::_recv_data_tls_handshake;
+                    conn->ev_socket.add(FdEvent::READ | FdEvent::WRITE);
+                }
+                else
+                {
+#ifdef SALTICIDAE_IO_URING
+                    if (conn->uring)
                     {
-                        conn->tls = new TLS(
-                                cpool->tls_ctx, client_fd,
-                                conn->mode == Conn::ConnMode::PASSIVE);
-                        conn->send_data_func = Conn::_send_data_tls_handshake;
-                        conn->recv_data_func = Conn::_recv_data_tls_handshake;
-                        conn->ev_socket.add(FdEvent::READ | FdEvent::WRITE);
+                        conn->send_data_func = Conn::_send_data_uring;
+                        conn->recv_data_func = Conn::_recv_data_uring;
                     }
                     else
+#endif
                     {
                         conn->send_data_func = Conn::_send_data;
                         conn->recv_data_func = Conn::_recv_data;
-                        enable_send_buffer(conn, client_fd);
-                        cpool->on_worker_setup(conn);
-                        cpool->disp_tcall->async_call([cpool, conn](ThreadCall::Handle &) {
-                            try {
-                                cpool->on_dispatcher_setup(conn);
-                                cpool->update_conn(conn, true);
-                            } catch (...) {
-                                cpool->recoverable_error(std::current_exception(), -1);
-                                cpool->disp_terminate(conn);
-                            }
-                        });
                     }
-                    assert(conn->fd != -1);
-                    assert(conn->worker == this);
-                    SALTICIDAE_LOG_DEBUG("worker %x got %s",
-                            std::this_thread::get_id(),
-                            std::string(*conn).c_str());
-                    nconn++;
-                } catch (...) { on_fatal_error(std::current_exception()); }
-            });
+                    enable_send_buffer(conn, client_fd);
+                    cpool->on_worker_setup(conn);
+                    cpool->disp_tcall->async_call([cpool, conn](ThreadCall::Handle &) {
+                        try {
+                            cpool->on_dispatcher_setup(conn);
+                            cpool->update_conn(conn, true);
+                        } catch (...) {
+                            cpool->recoverable_error(std::current_exception(), -1);
+                            cpool->disp_terminate(conn);
+                        }
+                    });
+                }
+                assert(conn->fd != -1);
+                assert(conn->get_worker() == this);
+                SALTICIDAE_LOG_DEBUG("worker %x got %s",
+                        std::this_thread::get_id(),
+                        std::string(*conn).c_str());
+            } catch (...) { on_fatal_error(std::current_exception()); }
+        }
+
+        /** Accept the connections on fd with cb (taking over fd). */
+        void listen(int fd, FdEvent::callback_t cb) {
+            unlisten();
+            listen_fd = fd;
+            ev_listen = FdEvent(ec, fd, std::move(cb));
+            ev_listen.add(FdEvent::READ);
+        }
+
+        /** Stop accepting and close the listening socket (also called
+         * after the worker stops). */
+        void unlisten() {
+            ev_listen.clear();
+            if (listen_fd == -1) return;
+            close(listen_fd);
+            listen_fd = -1;
         }
 
+        FdEvent &get_ev_listen() { return ev_listen; }
+
         void unfeed() { nconn--; }
 
+        /* set up a connection accepted by the worker itself */
+        void accept(const conn_t &conn, int client_fd) {
+            nconn++;
+            setup(conn, client_fd);
+        }
+
+        /* take over a connection detached from another worker */
+        void adopt(const conn_t &conn) {
+            nconn++;
+            tcall.async_call([this, conn](ThreadCall::Handle &) {
+                auto cpool = conn->cpool;
+                try {
+                    if (!conn->is_terminated())
+                    {
+                        cpool->on_worker_attach(conn);
+                        SALTICIDAE_LOG_INFO("migrated %s to worker %zu",
+                                std::string(*conn).c_str(), id);
+                    }
+                } catch (...) { on_fatal_error(std::current_exception()); }
+                cpool->disp_tcall->async_call([conn](ThreadCall::Handle &) {
+                    conn->migrating = false;
+                });
+            });
+        }
+
         void stop() {
-            tcall.async_call([this](ThreadCall::Handle &) { ec.stop(); });
+            tcall.async_call([this](ThreadCall::Handle &) {
+#ifdef SALTICIDAE_IO_URING
+                drain_uring();
+#endif
+                ec.stop();
+            });
         }
 
         void disp_stop() {
             assert(disp_flag && exit_tcall);
-            exit_tcall->async_call([this](ThreadCall::Handle &) { ec.stop(); });
+            exit_tcall->async_call([this](ThreadCall::Handle &) {
+#ifdef SALTICIDAE_IO_URING
+                drain_uring();
+#endif
+                ec.stop();
+            });
         }
 
         std::thread &get_handle() { return handle; }
@@ -353,35 +790,56 @@ class ConnPool {
             exit_tcall = new ThreadCall(ec);
         }
         bool is_dispatcher() const { return disp_flag; }
-        size_t get_nconn() { return nconn; }
+        size_t get_nconn() const { return nconn; }
         void stop_tcall() { tcall.stop(); }
+        /** the index of the worker in the pool */
+        void set_id(size_t _id) { id = _id; }
+        size_t get_id() const { return id; }
     };
 
+    public:
+    size_t get_nworker() const { return nworker; }
+    /** The number of connections handled by the i-th worker. */
+    size_t get_worker_nconn(size_t i) const { return workers[i].get_nconn(); }
+#ifdef SALTICIDAE_MSG_STAT
+    /** A snapshot of the I/O counters of the i-th worker. */
+    IOStat get_worker_io_stat(size_t i) const { return workers[i].get_io_stat(); }
+#endif
+
     private:
     /* related to workers */
     size_t nworker;
     salticidae::BoxObj<Worker[]> workers;
 
     void accept_client(int, int);
+    /* accept on the listening socket of the worker (run by the worker) */
+    void worker_accept_client(Worker &worker, int fd);
+    /* fill in a new connection */
+    void init_conn(const conn_t &conn, int fd, Conn::ConnMode mode, const NetAddr &addr);
+    int open_listen_socket(const NetAddr &listen_addr, bool reuse_port);
     void conn_server(const conn_t &conn, int, int);
     conn_t add_conn(const conn_t &conn);
+    void _migrate(const conn_t &conn, size_t idx);
+    void _rebalance();
     void del_conn(const conn_t &conn);
     void release_conn(const conn_t &conn);
 
-    Worker &select_worker() {
-        size_t idx = 0;
-        size_t best = workers[idx].get_nconn();
-        for (size_t i = 0; i < nworker; i++)
-        {
-            size_t t = workers[i].get_nconn();
-            if (t < best)
-            {
-                best = t;
-                idx = i;
-            }
-        }
-        return workers[idx];
-    }
+    /* related to worker selection (owned by the dispatcher) */
+    const WorkerPolicy worker_policy;
+    const worker_selector_t worker_selector;
+    std::unordered_map<NetAddr, size_t> pinned_addrs;
+    std::vector<size_t> npinned; /**< the number of addresses pinned to each worker */
+#ifdef SALTICIDAE_MSG_STAT
+    std::vector<uint64_t> traffic_base;
+    std::vector<uint64_t> traffic_recent;
+    uint64_t traffic_ts;
+#endif
+
+    bool find_pinned_worker(const NetAddr &addr, size_t &idx) const;
+    Worker &select_worker(const conn_t &conn);
+    const cpu_list_t user_cpus;
+    size_t select_least_conn(const std::vector<size_t> &cands) const;
+    size_t select_least_bytes(const std::vector<size_t> &cands);
 
     public:
 
@@ -390,8 +848,19 @@ class ConnPool {
         int _max_listen_backlog;
         double _conn_server_timeout;
         size_t _recv_chunk_size;
+        size_t _recv_chunk_min;
+        size_t _recv_chunk_max;
+        bool _recv_exact;
         size_t _max_recv_buff_size;
         size_t _max_send_buff_size;
+        size_t _max_send_buff_bytes;
+        size_t _send_buff_high;
+        size_t _send_buff_low;
+        size_t _send_burst_size;
+        size_t _tls_io_budget;
+        bool _listen_per_worker;
+        double _queue_spin_time;
+        size_t _io_uring_entries;
         size_t _nworker;
         bool _enable_tls;
         std::string _tls_cert_file;
@@ -400,14 +869,32 @@ class ConnPool {
         RcObj<PKey> _tls_key;
         bool _tls_skip_ca_check;
         SSL_verify_cb _tls_verify_callback;
+        size_t _tls_session_cache_size;
+        bool _enable_ktls;
+        WorkerPolicy _worker_policy;
+        worker_selector_t _worker_selector;
+        cpu_list_t _dispatcher_cpus;
+        std::vector<cpu_list_t> _worker_cpus;
+        cpu_list_t _user_cpus;
 
         public:
         Config():
             _max_listen_backlog(10),
             _conn_server_timeout(2),
             _recv_chunk_size(4096),
+            _recv_chunk_min(0),
+            _recv_chunk_max(0),
+            _recv_exact(false),
             _max_recv_buff_size(4096),
             _max_send_buff_size(0),
+            _max_send_buff_bytes(0),
+            _send_buff_high(0),
+            _send_buff_low(-1),
+            _send_burst_size(32),
+            _tls_io_budget(0),
+            _listen_per_worker(false),
+            _queue_spin_time(0),
+            _io_uring_entries(0),
             _nworker(1),
             _enable_tls(false),
             _tls_cert_file(""),
@@ -415,7 +902,11 @@ class ConnPool {
             _tls_cert(nullptr),
             _tls_key(nullptr),
             _tls_skip_ca_check(true),
-            _tls_verify_callback(nullptr) {}
+            _tls_verify_callback(nullptr),
+            _tls_session_cache_size(1024),
+            _enable_ktls(false),
+            _worker_policy(WORKER_LEAST_CONN),
+            _worker_selector(nullptr) {}
 
         Config &max_listen_backlog(int x) {
             _max_listen_backlog = x;
@@ -427,11 +918,44 @@ class ConnPool {
             return *this;
         }
 
+        /** Give every worker its own listening socket (with SO_REUSEPORT),
+         * so that it accepts the connections itself and the kernel spreads
+         * them across the workers, without going through the dispatcher.
+         * The worker policy and the pinned addresses then only apply to
+         * active connections (and to rebalance()). */
+        Config &listen_per_worker(bool x) {
+            _listen_per_worker = x;
+            return *this;
+        }
+
         Config &recv_chunk_size(size_t x) {
             _recv_chunk_size = x;
             return *this;
         }
 
+        /** Let the receive chunk size of each connection adapt to the sizes
+         * of its reads, between x and recv_chunk_size_max(). It starts from
+         * recv_chunk_size(). */
+        Config &recv_chunk_size_min(size_t x) {
+            _recv_chunk_min = x;
+            return *this;
+        }
+
+        /** The upper bound for the adaptive chunk size (0, the default,
+         * keeps the chunk size fixed). */
+        Config &recv_chunk_size_max(size_t x) {
+            _recv_chunk_max = x;
+            return *this;
+        }
+
+        /** Ask the kernel how much is readable (FIONREAD) and read it in one
+         * call of up to the maximum chunk size, instead of reading until a
+         * chunk is not filled up. */
+        Config &recv_exact(bool x) {
+            _recv_exact = x;
+            return *this;
+        }
+
         Config &nworker(size_t x) {
             _nworker = std::max((size_t)1, x);
             return *this;
@@ -447,6 +971,57 @@ class ConnPool {
             return *this;
         }
 
+        /** Limit the bytes queued for sending on each connection (0, the
+         * default, means no limit), beyond which Conn::write() fails. */
+        Config &max_send_buff_bytes(size_t x) {
+            _max_send_buff_bytes = x;
+            return *this;
+        }
+
+        /** Report a connection to the send buffer handler once x bytes are
+         * queued for sending (0, the default, disables the reports). */
+        Config &send_buff_high_watermark(size_t x) {
+            _send_buff_high = x;
+            return *this;
+        }
+
+        /** Report a congested connection to the send buffer handler again
+         * once its queued bytes drop to x (half the high watermark by
+         * default). */
+        Config &send_buff_low_watermark(size_t x) {
+            _send_buff_low = x;
+            return *this;
+        }
+
+        /** The maximum number of queued segments flushed to the socket by a
+         * single writev() call (1 means one message per call). */
+        Config &send_burst_size(size_t x) {
+            /* a segment may take two iovecs (a header and its payload) */
+            _send_burst_size = std::min(std::max((size_t)1, x), (size_t)IOV_MAX / 2);
+            return *this;
+        }
+
+        /** Let the dispatcher, the workers and the user loop poll their call
+         * queues for x seconds (e.g. 20e-6) after draining them, so the
+         * calls posted to a busy thread skip the eventfd wakeup; the polling
+         * thread stays busy meanwhile (0, the default, disables it). */
+        Config &queue_spin_time(double x) {
+            _queue_spin_time = x;
+            return *this;
+        }
+
+        /** Do the socket I/O through an io_uring of x entries per worker
+         * instead of polling the sockets (0, the default, disables it). It
+         * needs SALTICIDAE_IO_URING and Linux 5.19 or later, does not apply
+         * to TLS connections and falls back to polling when the kernel does
+         * not allow io_uring. A connection doing its I/O through io_uring
+         * stays on its worker: migrate() and rebalance() skip it, as its
+         * requests are in flight on the ring of that worker. */
+        Config &io_uring_entries(size_t x) {
+            _io_uring_entries = x;
+            return *this;
+        }
+
         Config &enable_tls(bool x) {
             _enable_tls = x;
             return *this;
@@ -481,20 +1056,101 @@ class ConnPool {
             _tls_verify_callback = x;
             return *this;
         }
+
+        /** Remember the TLS sessions with up to x servers, so reconnecting
+         * to them takes an abbreviated handshake (0 disables it, see
+         * TLSContext::enable_session_cache()). */
+        Config &tls_session_cache_size(size_t x) {
+            _tls_session_cache_size = x;
+            return *this;
+        }
+
+        /** Let the kernel encrypt and decrypt the TLS records once the
+         * handshake is done (kTLS, Linux with OpenSSL 3). A connection on
+         * which the kernel takes over the sending writes the messages to
+         * the socket in batches like a plain one. It silently stays in
+         * user space if the cipher or the kernel does not support it (load
+         * the tls module). */
+        Config &enable_ktls(bool x) {
+            _enable_ktls = x;
+            return *this;
+        }
+
+        /** Let a TLS connection encrypt (or decrypt) about x bytes per
+         * socket event, then yield to the other connections of its worker
+         * until the next loop iteration, so a few bulk peers do not hold
+         * up the rest (0, the default, means no limit). A peer that needs
+         * a thread of its own can be given a worker with pin_worker(). */
+        Config &tls_io_budget(size_t x) {
+            _tls_io_budget = x;
+            return *this;
+        }
+
+        /** Pin the dispatcher thread to the CPUs (see also
+         * get_numa_node_cpus()). */
+        Config &dispatcher_cpus(const cpu_list_t &x) {
+            _dispatcher_cpus = x;
+            return *this;
+        }
+
+        /** Pin the i-th worker thread (not counting the dispatcher) to
+         * x[i % x.size()]. */
+        Config &worker_cpus(const std::vector<cpu_list_t> &x) {
+            _worker_cpus = x;
+            return *this;
+        }
+
+        /** Pin the thread running the EventContext of the pool, once it
+         * starts dispatching after start(). */
+        Config &user_cpus(const cpu_list_t &x) {
+            _user_cpus = x;
+            return *this;
+        }
+
+        Config &worker_policy(WorkerPolicy x) {
+            _worker_policy = x;
+            return *this;
+        }
+
+        /** Override the built-in policy. The callback gets the new
+         * connection and the number of workers. The pinned addresses (see
+         * pin_worker()) still take precedence. */
+        Config &worker_selector(worker_selector_t x) {
+            _worker_selector = std::move(x);
+            return *this;
+        }
     };
 
     ConnPool(const EventContext &ec, const Config &config):
             system_state(0), ec(ec),
             enable_tls(config._enable_tls),
+            queue_spin_time(config._queue_spin_time),
             async_id(0),
             max_listen_backlog(config._max_listen_backlog),
             conn_server_timeout(config._conn_server_timeout),
             recv_chunk_size(config._recv_chunk_size),
+            recv_chunk_min(config._recv_chunk_max ?
+                std::max((size_t)1, std::min(config._recv_chunk_min, config._recv_chunk_max)) :
+                recv_chunk_size),
+            recv_chunk_max(std::max(config._recv_chunk_max, recv_chunk_min)),
+            recv_exact(config._recv_exact),
             max_recv_buff_size(config._max_recv_buff_size),
             max_send_buff_size(config._max_send_buff_size),
+            max_send_buff_bytes(config._max_send_buff_bytes),
+            send_buff_high(config._send_buff_high),
+            send_buff_low(config._send_buff_low == (size_t)-1 ?
+                            send_buff_high >> 1 :
+                            std::min(config._send_buff_low, send_buff_high)),
+            send_burst_size(config._send_burst_size),
+            tls_io_budget(config._tls_io_budget),
+            listen_per_worker(config._listen_per_worker),
             tls_ctx(nullptr),
             listen_fd(-1),
-            nworker(config._nworker) {
+            nworker(config._nworker),
+            worker_policy(config._worker_policy),
+            worker_selector(config._worker_selector),
+            npinned(nworker, 0),
+            user_cpus(config._user_cpus) {
         if (enable_tls)
         {
             tls_ctx = new TLSContext();
@@ -508,14 +1164,26 @@ class ConnPool {
             else
                 tls_ctx->use_privkey_file(config._tls_key_file);
             tls_ctx->set_verify(config._tls_skip_ca_check, config._tls_verify_callback);
+            tls_ctx->enable_session_cache(config._tls_session_cache_size);
+            if (config._enable_ktls && !tls_ctx->enable_ktls())
+                SALTICIDAE_LOG_WARN("kTLS is not supported by OpenSSL");
             if (!tls_ctx->check_privkey())
                 throw SalticidaeError(SALTI_ERROR_TLS_KEY_NOT_MATCH);
         }
         signal(SIGPIPE, SIG_IGN);
         workers = new Worker[nworker];
+#ifdef SALTICIDAE_MSG_STAT
+        traffic_base.resize(nworker, 0);
+        traffic_recent.resize(nworker, 0);
+        traffic_ts = 0;
+#endif
         user_tcall = new ThreadCall(ec);
+        user_tcall->set_spin_time(queue_spin_time);
+        for (size_t i = 0; i < nworker; i++)
+            workers[i].get_tcall()->set_spin_time(queue_spin_time);
         disp_ec = workers[0].get_ec();
         disp_tcall = workers[0].get_tcall();
+        disp_timer_wheel = &workers[0].get_timer_wheel();
         workers[0].set_dispatcher();
         disp_error_cb = [this](const std::exception_ptr err) {
             workers[0].stop_tcall();
@@ -535,11 +1203,32 @@ class ConnPool {
         for (size_t i = 0; i < nworker; i++)
         {
             auto &worker = workers[i];
+            worker.set_id(i);
+            if (i == 0)
+                worker.set_cpus(config._dispatcher_cpus);
+            else if (!config._worker_cpus.empty())
+                worker.set_cpus(config._worker_cpus[(i - 1) % config._worker_cpus.size()]);
             if (worker.is_dispatcher())
                 worker.set_error_callback(disp_error_cb);
             else
                 worker.set_error_callback(worker_error_cb);
         }
+        if (config._io_uring_entries)
+        {
+#ifdef SALTICIDAE_IO_URING
+            if (enable_tls)
+                SALTICIDAE_LOG_WARN("io_uring is not used for TLS connections");
+            else
+                for (size_t i = 0; i < nworker; i++)
+                    if (!workers[i].enable_uring(config._io_uring_entries))
+                    {
+                        SALTICIDAE_LOG_WARN("io_uring is not available, falling back to polling");
+                        break;
+                    }
+#else
+            SALTICIDAE_LOG_WARN("io_uring is not supported by this build");
+#endif
+        }
     }
 
     ~ConnPool() { stop(); }
@@ -551,9 +1240,15 @@ class ConnPool {
         std::atomic_thread_fence(std::memory_order_acq_rel);
         if (system_state) return;
         SALTICIDAE_LOG_INFO("starting all threads...");
+        /* running before any worker can deliver a message */
+        system_state = 1;
         for (size_t i = 0; i < nworker; i++)
             workers[i].start();
-        system_state = 1;
+        if (!user_cpus.empty())
+            user_tcall->async_call([this](ThreadCall::Handle &) {
+                if (!set_thread_affinity(user_cpus))
+                    SALTICIDAE_LOG_WARN("failed to set the cpu affinity of the user thread");
+            });
     }
 
     void stop_workers() {
@@ -586,6 +1281,8 @@ class ConnPool {
             close(listen_fd);
             listen_fd = -1;
         }
+        for (size_t i = 0; i < nworker; i++)
+            workers[i].unlisten();
     }
 
     /** Actively connect to remote addr. */
@@ -628,6 +1325,12 @@ class ConnPool {
     template<typename Func>
     void reg_error_handler(Func &&cb) { error_cb = std::forward<Func>(cb); }
 
+    /** Register the callback run by the user loop when a connection's send
+     * buffer reaches the high watermark (congested = true) or drains to the
+     * low one (congested = false), so the producers can pause and resume. */
+    template<typename Func>
+    void reg_send_buff_handler(Func &&cb) { send_buff_cb = std::forward<Func>(cb); }
+
     void terminate(const conn_t &conn) {
         disp_tcall->async_call([this, conn](ThreadCall::Handle &) {
             try {
@@ -638,6 +1341,51 @@ class ConnPool {
         });
     }
 
+    /** Dedicate the worker to the connections with the remote addr (a zero
+     * port matches all connections from the IP). Pinned workers are no longer
+     * picked by the policy for other connections, unless all workers are
+     * pinned. It only affects the connections established afterwards. */
+    void pin_worker(const NetAddr &addr, size_t idx) {
+        if (idx >= nworker)
+            throw SalticidaeError(SALTI_ERROR_WORKER_INVALID);
+        disp_tcall->async_call([this, addr, idx](ThreadCall::Handle &) {
+            auto it = pinned_addrs.find(addr);
+            if (it != pinned_addrs.end()) npinned[it->second]--;
+            pinned_addrs[addr] = idx;
+            npinned[idx]++;
+        });
+    }
+
+    /** Move an established connection to the idx-th worker, without
+     * interrupting the TCP (or TLS) session or losing buffered data. The
+     * request is ignored if the connection is not established yet, is gone
+     * or is already being moved. */
+    void migrate(const conn_t &conn, size_t idx) {
+        if (idx >= nworker)
+            throw SalticidaeError(SALTI_ERROR_WORKER_INVALID);
+        disp_tcall->async_call([this, conn, idx](ThreadCall::Handle &) {
+            _migrate(conn, idx);
+        });
+    }
+
+    /** Migrate connections so that every worker not dedicated by
+     * pin_worker() has about the same number of connections. */
+    void rebalance() {
+        disp_tcall->async_call([this](ThreadCall::Handle &) {
+            _rebalance();
+        });
+    }
+
+    /** Undo pin_worker(). */
+    void unpin_worker(const NetAddr &addr) {
+        disp_tcall->async_call([this, addr](ThreadCall::Handle &) {
+            auto it = pinned_addrs.find(addr);
+            if (it == pinned_addrs.end()) return;
+            npinned[it->second]--;
+            pinned_addrs.erase(it);
+        });
+    }
+
     const X509 *get_cert() const { return tls_cert.get(); }
 };
 
@@ -29,6 +29,8 @@
 #include "salticidae/util.h"
 
 #ifdef __cplusplus
+#include <mutex>
+#include <unordered_map>
 #include <openssl/sha.h>
 #include <openssl/ssl.h>
 #include <openssl/bn.h>
@@ -119,6 +121,32 @@ class SHA1 {
     }
 };
 
+/** Update a CRC32C (Castagnoli) checksum with `len` more bytes, starting from
+ * `crc` = 0. Uses SSE4.2/ARMv8 CRC instructions when available. */
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t len);
+/** The same as crc32c(), always computed with the lookup table. */
+uint32_t crc32c_sw(uint32_t crc, const uint8_t *data, size_t len);
+
+class CRC32C {
+    uint32_t crc;
+
+    public:
+    CRC32C() { reset(); }
+
+    void reset() { crc = 0; }
+
+    template<typename T>
+    void update(const T &data) {
+        update(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+    }
+
+    void update(const uint8_t *ptr, size_t length) {
+        crc = crc32c(crc, ptr, length);
+    }
+
+    uint32_t digest() const { return crc; }
+};
+
 static thread_local const char *_passwd;
 static inline int _tls_pem_no_passswd(char *, int, int, void *) {
     return -1;
@@ -311,15 +339,89 @@ class X509 {
 
 class TLSContext {
     SSL_CTX *ctx;
+    /* the sessions to resume, by the server that issued them (only the
+     * latest one of each server is kept) */
+    std::mutex sessions_lock;
+    std::unordered_map<std::string, SSL_SESSION *> sessions;
+    size_t max_sessions;
     friend class TLS;
+
+    static int _new_session_cb(SSL *ssl, SSL_SESSION *sess);
+
+    /* take the session to resume with the server, or nullptr */
+    SSL_SESSION *take_session(const std::string &key) {
+        std::lock_guard<std::mutex> _(sessions_lock);
+        auto it = sessions.find(key);
+        if (it == sessions.end()) return nullptr;
+        auto sess = it->second;
+        /* a TLS 1.3 ticket is used only once, the server sends new ones */
+        sessions.erase(it);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+        if (SSL_SESSION_is_resumable(sess)) return sess;
+        SSL_SESSION_free(sess);
+        return nullptr;
+#else
+        /* no TLS 1.3 before OpenSSL 1.1.1, so a session can be reused */
+        return sess;
+#endif
+    }
+
+    void put_session(const std::string &key, SSL_SESSION *sess) {
+        std::lock_guard<std::mutex> _(sessions_lock);
+        auto it = sessions.find(key);
+        if (it != sessions.end())
+        {
+            SSL_SESSION_free(it->second);
+            it->second = sess;
+            return;
+        }
+        if (sessions.size() >= max_sessions)
+        {
+            /* evict an arbitrary one, it only costs a full handshake */
+            SSL_SESSION_free(sessions.begin()->second);
+            sessions.erase(sessions.begin());
+        }
+        sessions.insert(std::make_pair(key, sess));
+    }
+
     public:
-    TLSContext(): ctx(SSL_CTX_new(TLS_method())) {
+    TLSContext(): ctx(SSL_CTX_new(TLS_method())), max_sessions(0) {
         if (ctx == nullptr)
             throw std::runtime_error("TLSContext init error");
+        /* a short write leaves the rest of the segment in the send buffer
+         * (with an advanced offset), so the retry may use a different
+         * pointer and length */
+        SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                            SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
     }
 
     TLSContext(const TLSContext &) = delete;
-    TLSContext(TLSContext &&other): ctx(other.ctx) { other.ctx = nullptr; }
+    TLSContext(TLSContext &&other):
+            ctx(other.ctx),
+            sessions(std::move(other.sessions)),
+            max_sessions(other.max_sessions) {
+        other.ctx = nullptr;
+        other.sessions.clear();
+    }
+
+    /** Let the clients resume the sessions with up to n servers, which
+     * skips the certificate exchange and the public key operations when a
+     * peer reconnects. The servers issue session tickets, so they keep no
+     * state for them. Resuming does not run the verify callback again, as
+     * the certificate of the server was verified in the full handshake
+     * (get_peer_cert() still returns it). No early data (0-RTT) is sent,
+     * since the messages could be replayed. */
+    void enable_session_cache(size_t n) {
+        max_sessions = n;
+        if (!n) return;
+        /* the sessions are stored by _new_session_cb() */
+        SSL_CTX_set_session_cache_mode(ctx,
+            SSL_SESS_CACHE_BOTH | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(ctx, _new_session_cb);
+        /* required to resume a session with a verified client certificate */
+        static const unsigned char sid_ctx[] = "salticidae";
+        SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+    }
 
     void use_cert_file(const std::string &fname) {
         auto ret = SSL_CTX_use_certificate_file(ctx, fname.c_str(), SSL_FILETYPE_PEM);
@@ -345,6 +447,20 @@ class TLSContext {
             throw SalticidaeError(SALTI_ERROR_TLS_LOAD_KEY);
     }
 
+    /** Ask OpenSSL to hand the record encryption of the established
+     * connections over to the kernel (kTLS). Whether it is in effect
+     * depends on the cipher, the kernel and the OpenSSL build, so check
+     * TLS::is_ktls_send() after the handshake. Return false if OpenSSL
+     * does not support it at all. */
+    bool enable_ktls() {
+#ifdef SSL_OP_ENABLE_KTLS
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+        return true;
+#else
+        return false;
+#endif
+    }
+
     void set_verify(bool skip_ca_check = true, SSL_verify_cb verify_callback = nullptr) {
         SSL_CTX_set_verify(ctx,
                 SSL_VERIFY_PEER, skip_ca_check ? _skip_CA_check : verify_callback);
@@ -354,27 +470,79 @@ class TLSContext {
         return SSL_CTX_check_private_key(ctx) > 0;
     }
 
-    ~TLSContext() { if (ctx) SSL_CTX_free(ctx); }
+    ~TLSContext() {
+        for (auto &p: sessions) SSL_SESSION_free(p.second);
+        if (ctx) SSL_CTX_free(ctx);
+    }
 };
 
 using tls_context_t = ArcObj<TLSContext>;
 
 class TLS {
     SSL *ssl;
+    tls_context_t ctx;
+    /* identifies the server for the session cache (client only) */
+    std::string session_key;
+    friend TLSContext;
+
     public:
-    TLS(const tls_context_t &ctx, int fd, bool accept): ssl(SSL_new(ctx->ctx)) {
+    /** Set up TLS on the socket, a client gives session_key (e.g., the
+     * server address) to resume the session cached under the key, if the
+     * context has a session cache. */
+    TLS(const tls_context_t &ctx, int fd, bool accept,
+        const std::string &session_key = std::string()):
+            ssl(SSL_new(ctx->ctx)), ctx(ctx), session_key(session_key) {
         if (ssl == nullptr)
             throw std::runtime_error("TLS init error");
         if (!SSL_set_fd(ssl, fd))
             throw SalticidaeError(SALTI_ERROR_TLS_GENERIC);
+        SSL_set_app_data(ssl, this);
         if (accept)
             SSL_set_accept_state(ssl);
         else
+        {
+            if (ctx->max_sessions && !session_key.empty())
+            {
+                auto sess = ctx->take_session(session_key);
+                if (sess)
+                {
+                    SSL_set_session(ssl, sess);
+                    SSL_SESSION_free(sess);
+                }
+            }
             SSL_set_connect_state(ssl);
+        }
     }
 
     TLS(const TLS &) = delete;
-    TLS(TLS &&other): ssl(other.ssl) { other.ssl = nullptr; }
+    TLS(TLS &&other):
+            ssl(other.ssl),
+            ctx(std::move(other.ctx)),
+            session_key(std::move(other.session_key)) {
+        other.ssl = nullptr;
+        if (ssl) SSL_set_app_data(ssl, this);
+    }
+
+    /** Whether the handshake resumed a previous session. */
+    bool is_resumed() const { return SSL_session_reused(ssl); }
+
+    /** Whether the kernel encrypts what is written to the socket, so the
+     * plaintext can be written to the socket directly. */
+    bool is_ktls_send() const {
+#ifdef BIO_get_ktls_send
+        return BIO_get_ktls_send(SSL_get_wbio(ssl));
+#else
+        return false;
+#endif
+    }
+    /** Whether the kernel decrypts what SSL_read() gets from the socket. */
+    bool is_ktls_recv() const {
+#ifdef BIO_get_ktls_recv
+        return BIO_get_ktls_recv(SSL_get_rbio(ssl));
+#else
+        return false;
+#endif
+    }
 
     bool do_handshake(int &want_io_type) {
         /* want_io_type: 0 for read, 1 for write */
@@ -406,6 +574,10 @@ class TLS {
         return SSL_read(ssl, buff, size);
     }
 
+    /** Whether OpenSSL has read bytes from the socket that recv() has not
+     * returned yet. */
+    bool has_pending() const { return SSL_has_pending(ssl); }
+
     int get_error(int ret) {
         return SSL_get_error(ssl, ret);
     }
@@ -415,6 +587,15 @@ class TLS {
     ~TLS() { if (ssl) SSL_free(ssl); }
 };
 
+inline int TLSContext::_new_session_cb(SSL *ssl, SSL_SESSION *sess) {
+    auto tls = static_cast<TLS *>(SSL_get_app_data(ssl));
+    if (SSL_is_server(ssl) || tls == nullptr || tls->session_key.empty())
+        return 0;
+    /* keep the reference to the session */
+    tls->ctx->put_session(tls->session_key, sess);
+    return 1;
+}
+
 }
 
 #ifdef SALTICIDAE_CBINDINGS
@@ -27,6 +27,11 @@
 
 #ifdef __cplusplus
 #include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+#include <cstddef>
+#include <type_traits>
 #include <unistd.h>
 #include <uv.h>
 
@@ -354,6 +359,252 @@ class TimedFdEvent: public FdEvent, public TimerEvent {
     operator bool() const { return ev_fd != nullptr; }
 };
 
+/** A hierarchical timer wheel driven by a single TimerEvent of an event
+ * context. The timers are kept at the granularity of a tick (coarse, by
+ * default 0.1 second), so adding, deleting or re-adding one is O(1) no
+ * matter how many are pending, which suits the many per-connection timers
+ * that are mostly pushed back before they expire. The wheel and its timers
+ * are only to be used by the thread of the event context. */
+class TimerWheel {
+    public:
+    class Timer;
+    using callback_t = std::function<void(Timer &)>;
+    /** The source of time in nanoseconds. */
+    using clock_func_t = uint64_t (*)();
+
+    private:
+    static const size_t slot_bits = 8;
+    static const size_t nslot = 1 << slot_bits;
+    static const size_t nlevel = 4;
+
+    struct Node {
+        TimerWheel *wheel;
+        Timer *owner;
+        callback_t callback;
+        /* the tick at which the timer expires */
+        uint64_t expire;
+        Node *next;
+        Node **pprev;
+        bool pending;
+        Node(TimerWheel *wheel, Timer *owner, callback_t callback):
+            wheel(wheel), owner(owner), callback(std::move(callback)),
+            expire(0), next(nullptr), pprev(nullptr), pending(false) {}
+    };
+
+    Node *slots[nlevel][nslot];
+    TimerEvent ev_tick;
+    const clock_func_t clock;
+    const uint64_t tick_ns;
+    const uint64_t base_ns;
+    /* the timers that expire at or before this tick have fired */
+    uint64_t cur;
+    size_t npending;
+    bool ticking;
+    /* the node whose callback is running */
+    Node *firing;
+    bool firing_cleared;
+
+    uint64_t now_ns() const { return clock(); }
+
+    uint64_t now_tick() const { return (now_ns() - base_ns) / tick_ns; }
+
+    /* a timer is never placed before the tick `earliest` */
+    void link(Node *n, uint64_t earliest) {
+        uint64_t e = std::max(n->expire, earliest);
+        uint64_t delta = e - cur;
+        size_t level = 0;
+        while (level < nlevel - 1 && delta >= ((uint64_t)1 << (slot_bits * (level + 1))))
+            level++;
+        /* beyond the range of the wheel: park it in the farthest slot, and it
+         * is placed again when that slot is cascaded */
+        if (level == nlevel - 1 && delta >= ((uint64_t)1 << (slot_bits * nlevel)))
+            e = cur + ((uint64_t)1 << (slot_bits * nlevel)) - 1;
+        auto &head = slots[level][(e >> (slot_bits * level)) & (nslot - 1)];
+        n->next = head;
+        if (head) head->pprev = &n->next;
+        n->pprev = &head;
+        head = n;
+    }
+
+    static void unlink(Node *n) {
+        *n->pprev = n->next;
+        if (n->next) n->next->pprev = n->pprev;
+        n->next = nullptr;
+        n->pprev = nullptr;
+    }
+
+    void arm() {
+        if (ticking) return;
+        ticking = true;
+        uint64_t at = base_ns + (cur + 1) * tick_ns;
+        uint64_t now = now_ns();
+        ev_tick.add(at > now ? (at - now) / 1e9 : 0);
+    }
+
+    void advance() {
+        cur++;
+        /* move the timers of the next range down once a level wraps */
+        for (size_t level = 1; level < nlevel; level++)
+        {
+            if (cur & (((uint64_t)1 << (slot_bits * level)) - 1)) break;
+            auto &head = slots[level][(cur >> (slot_bits * level)) & (nslot - 1)];
+            while (head)
+            {
+                auto n = head;
+                unlink(n);
+                /* the timers due now go to the slot about to fire */
+                link(n, cur);
+            }
+        }
+        auto &head = slots[0][cur & (nslot - 1)];
+        while (head)
+        {
+            auto n = head;
+            unlink(n);
+            if (n->expire > cur)
+            {
+                link(n, cur);
+                continue;
+            }
+            n->pending = false;
+            npending--;
+            firing = n;
+            firing_cleared = false;
+            n->callback(*n->owner);
+            firing = nullptr;
+            if (firing_cleared) delete n;
+        }
+    }
+
+    void on_tick() {
+        ticking = false;
+        auto target = now_tick();
+        while (cur < target && npending) advance();
+        if (npending) arm();
+        else cur = std::max(cur, target);
+    }
+
+    void add(Node *n, double t_sec) {
+        if (n->pending) unlink(n);
+        else
+        {
+            /* nothing is pending, so the wheel can catch up at once */
+            if (!npending) cur = std::max(cur, now_tick());
+            n->pending = true;
+            npending++;
+        }
+        /* round up, so a timer never fires early */
+        n->expire = (now_ns() - base_ns + (uint64_t)(t_sec * 1e9) + tick_ns - 1) / tick_ns;
+        /* a timer that is already due fires at the next tick */
+        link(n, cur + 1);
+        arm();
+    }
+
+    void del(Node *n) {
+        if (!n->pending) return;
+        unlink(n);
+        n->pending = false;
+        npending--;
+    }
+
+    public:
+    class Timer {
+        friend TimerWheel;
+        Node *node;
+
+        public:
+        Timer(): node(nullptr) {}
+        Timer(TimerWheel &wheel, callback_t callback):
+            node(new Node(&wheel, this, std::move(callback))) {}
+
+        Timer(const Timer &) = delete;
+        Timer(Timer &&other): node(other.node) {
+            other.node = nullptr;
+            if (node) node->owner = this;
+        }
+
+        Timer &operator=(Timer &&other) {
+            if (this != &other)
+            {
+                clear();
+                node = other.node;
+                other.node = nullptr;
+                if (node) node->owner = this;
+            }
+            return *this;
+        }
+
+        ~Timer() { clear(); }
+
+        void clear() {
+            if (!node) return;
+            auto wheel = node->wheel;
+            if (wheel)
+            {
+                wheel->del(node);
+                /* the node is freed once its running callback returns */
+                if (wheel->firing == node)
+                {
+                    wheel->firing_cleared = true;
+                    node = nullptr;
+                    return;
+                }
+            }
+            delete node;
+            node = nullptr;
+        }
+
+        /** (Re)schedule the timer to expire in t_sec seconds. */
+        void add(double t_sec) {
+            assert(node && node->wheel);
+            node->wheel->add(node, t_sec);
+        }
+
+        void del() { if (node && node->wheel) node->wheel->del(node); }
+
+        bool is_pending() const { return node && node->pending; }
+
+        operator bool() const { return node != nullptr; }
+    };
+
+    static uint64_t steady_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /** The clock only needs replacing to test the wheel without waiting for
+     * the real time to pass: the wheel then ticks (at most one tick of real
+     * time later) whenever the clock moves forward. */
+    TimerWheel(const EventContext &ec, double tick = 0.1,
+                clock_func_t clock = steady_ns):
+            ev_tick(ec, [this](TimerEvent &) { on_tick(); }),
+            clock(clock),
+            tick_ns(std::max((uint64_t)(tick * 1e9), (uint64_t)1000000)),
+            base_ns(now_ns()),
+            cur(0), npending(0), ticking(false),
+            firing(nullptr), firing_cleared(false) {
+        memset(slots, 0, sizeof(slots));
+    }
+
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel(TimerWheel &&) = delete;
+
+    ~TimerWheel() {
+        /* the timers outliving the wheel become inert */
+        for (auto &level: slots)
+            for (auto &head: level)
+                while (head)
+                {
+                    auto n = head;
+                    unlink(n);
+                    n->pending = false;
+                    n->wheel = nullptr;
+                }
+    }
+
+    size_t get_npending() const { return npending; }
+};
+
 class SigEvent {
     public:
     using callback_t = std::function<void(int signum)>;
@@ -596,23 +847,57 @@ class NotifyFd {
 #warning "platform not supported!"
 #endif
 
-template<typename T>
-class MPSCQueueEventDriven: public MPSCQueue<T> {
+template<typename T, size_t BlockSize = MPMCQ_SIZE>
+class MPSCQueueEventDriven: public MPSCQueue<T, BlockSize> {
     private:
+    using spin_clock_t = std::chrono::steady_clock;
     std::atomic<bool> wait_sig;
     NotifyFd nfd;
     FdEvent ev;
+    spin_clock_t::duration spin_time;
+
+    /* keep polling the queue for spin_time, wait_sig stays false meanwhile
+     * so the producers do not notify, return true if the handler should be
+     * rescheduled */
+    template<typename Func>
+    bool spin(Func &func) {
+        auto deadline = spin_clock_t::now() + spin_time;
+        for (size_t i = 1;; i++)
+        {
+            if (func(*this)) return true;
+            if (spin_clock_t::now() >= deadline) break;
+            /* let a producer on the same core run */
+            if (!(i & 0x3f)) std::this_thread::yield();
+        }
+        return false;
+    }
 
     public:
     MPSCQueueEventDriven():
-            wait_sig(true) {}
+            wait_sig(true), spin_time(spin_clock_t::duration::zero()) {}
     ~MPSCQueueEventDriven() { unreg_handler(); }
 
+    /** Let the consumer poll the queue for t seconds after it drains the
+     * queue before it goes back to wait on the event loop. The enqueues
+     * during the window skip the wakeup (a write to the notification fd
+     * and a read back by the consumer), at the cost of a busy consumer
+     * thread whose other events wait until the window ends. Zero (the
+     * default) disables it. Set it before the consumer starts. */
+    void set_spin_time(double t) {
+        spin_time = std::chrono::duration_cast<spin_clock_t::duration>(
+            std::chrono::duration<double>(t));
+    }
+
     template<typename Func>
     void reg_handler(const EventContext &ec, Func &&func) {
         ev = FdEvent(ec, nfd.read_fd(),
-                    [this, func=std::forward<Func>(func)](int, int) {
+                    [this, func=std::forward<Func>(func)](int, int) mutable {
                     nfd.reset();
+                    if (spin_time > spin_clock_t::duration::zero() && spin(func))
+                    {
+                        nfd.notify();
+                        return;
+                    }
                     // the only undesirable case is there are some new items
                     // enqueued before recovering wait_sig to true, so the consumer
                     // won't be notified. In this case, no enqueuing thread will
@@ -628,9 +913,16 @@ class MPSCQueueEventDriven: public MPSCQueue<T> {
 
     void unreg_handler() { ev.clear(); }
 
+    /** Wake up the consumer as an enqueue does, for the items that are put
+     * elsewhere before the call. */
+    void notify() {
+        if (wait_sig.exchange(false, std::memory_order_acq_rel))
+            nfd.notify();
+    }
+
     template<typename U>
     bool enqueue(U &&e, bool unbounded = true) {
-        if (!MPSCQueue<T>::enqueue(std::forward<U>(e), unbounded))
+        if (!MPSCQueue<T, BlockSize>::enqueue(std::forward<U>(e), unbounded))
             return false;
         // memory barrier here, so any load/store in enqueue must be finialized
         if (wait_sig.exchange(false, std::memory_order_acq_rel))
@@ -641,12 +933,25 @@ class MPSCQueueEventDriven: public MPSCQueue<T> {
         return true;
     }
 
+    template<typename It>
+    size_t enqueue_bulk(It first, It last, bool unbounded = true) {
+        auto cnt = MPSCQueue<T, BlockSize>::enqueue_bulk(first, last, unbounded);
+        // one notification for the whole batch
+        if (cnt && wait_sig.exchange(false, std::memory_order_acq_rel))
+        {
+            //SALTICIDAE_LOG_DEBUG("mpsc notify");
+            nfd.notify();
+        }
+        return cnt;
+    }
+
     template<typename U> bool try_enqueue(U &&e) = delete;
+    template<typename It> size_t try_enqueue_bulk(It first, It last) = delete;
 };
 
 // NOTE: the MPMC implementation below hasn't been heavily tested.
-template<typename T>
-class MPMCQueueEventDriven: public MPMCQueue<T> {
+template<typename T, size_t BlockSize = MPMCQ_SIZE>
+class MPMCQueueEventDriven: public MPMCQueue<T, BlockSize> {
     private:
     std::atomic<bool> wait_sig;
     NotifyFd nfd;
@@ -660,7 +965,7 @@ class MPMCQueueEventDriven: public MPMCQueue<T> {
     // this function is *NOT* thread-safe
     template<typename Func>
     void reg_handler(const EventContext &ec, Func &&func) {
-        FdEvent ev(ec, nfd.read_fd(), [this, func=std::forward<Func>(func)](int, int) {
+        FdEvent ev(ec, nfd.read_fd(), [this, func=std::forward<Func>(func)](int, int) mutable {
             if (!nfd.reset()) return;
             // only one consumer should be here a a time
             wait_sig.exchange(true, std::memory_order_acq_rel);
@@ -675,7 +980,7 @@ class MPMCQueueEventDriven: public MPMCQueue<T> {
 
     template<typename U>
     bool enqueue(U &&e, bool unbounded = true) {
-        if (!MPMCQueue<T>::enqueue(std::forward<U>(e), unbounded))
+        if (!MPMCQueue<T, BlockSize>::enqueue(std::forward<U>(e), unbounded))
             return false;
         // memory barrier here, so any load/store in enqueue must be finialized
         if (wait_sig.exchange(false, std::memory_order_acq_rel))
@@ -686,7 +991,81 @@ class MPMCQueueEventDriven: public MPMCQueue<T> {
         return true;
     }
 
+    template<typename It>
+    size_t enqueue_bulk(It first, It last, bool unbounded = true) {
+        auto cnt = MPMCQueue<T, BlockSize>::enqueue_bulk(first, last, unbounded);
+        // one notification for the whole batch
+        if (cnt && wait_sig.exchange(false, std::memory_order_acq_rel))
+        {
+            //SALTICIDAE_LOG_DEBUG("mpmc notify");
+            nfd.notify();
+        }
+        return cnt;
+    }
+
     template<typename U> bool try_enqueue(U &&e) = delete;
+    template<typename It> size_t try_enqueue_bulk(It first, It last) = delete;
+};
+
+/** A callable wrapper like std::function, but a callable of up to
+ * InlineSize bytes is kept in place, so assigning one does not allocate. It
+ * is neither copyable nor movable. */
+template<typename Sig, size_t InlineSize = 128> class InplaceFunc;
+
+template<typename R, typename... Args, size_t InlineSize>
+class InplaceFunc<R(Args...), InlineSize> {
+    using storage_t = typename std::aligned_storage<
+        InlineSize, alignof(std::max_align_t)>::type;
+    storage_t buff;
+    void *obj;
+    R (*invoke)(void *, Args &&...);
+    void (*destroy)(void *);
+
+    template<typename F>
+    static R _invoke(void *f, Args &&...args) {
+        return (*static_cast<F *>(f))(std::forward<Args>(args)...);
+    }
+    template<typename F>
+    static void _destroy_inline(void *f) { static_cast<F *>(f)->~F(); }
+    template<typename F>
+    static void _destroy_heap(void *f) { delete static_cast<F *>(f); }
+
+    template<typename F, typename Func>
+    void _emplace(Func &&f, std::true_type) {
+        obj = new (&buff) F(std::forward<Func>(f));
+        destroy = &_destroy_inline<F>;
+    }
+    template<typename F, typename Func>
+    void _emplace(Func &&f, std::false_type) {
+        obj = new F(std::forward<Func>(f));
+        destroy = &_destroy_heap<F>;
+    }
+
+    public:
+    InplaceFunc(): obj(nullptr) {}
+    InplaceFunc(const InplaceFunc &) = delete;
+    InplaceFunc &operator=(const InplaceFunc &) = delete;
+    ~InplaceFunc() { reset(); }
+
+    template<typename Func>
+    InplaceFunc &operator=(Func &&f) {
+        using F = typename std::decay<Func>::type;
+        reset();
+        _emplace<F>(std::forward<Func>(f), std::integral_constant<bool,
+            sizeof(F) <= sizeof(storage_t) &&
+            alignof(F) <= alignof(storage_t)>());
+        invoke = &_invoke<F>;
+        return *this;
+    }
+
+    R operator()(Args... args) { return invoke(obj, std::forward<Args>(args)...); }
+    operator bool() const { return obj != nullptr; }
+
+    void reset() {
+        if (obj == nullptr) return;
+        destroy(obj);
+        obj = nullptr;
+    }
 };
 
 class ThreadCall {
@@ -697,34 +1076,35 @@ class ThreadCall {
     using queue_t = MPSCQueueEventDriven<Handle *>;
     queue_t q;
     bool stopped;
+    /* finished handles to be reused by the callers, at most max_npooled
+     * handles are ever created for the pool, the others are deleted after
+     * use */
+    FreeList free_handles;
+    std::atomic<size_t> npooled;
+    const size_t max_npooled;
 
     public:
     struct Result {
         void *data;
         std::exception_ptr error;
-        std::function<void(void *)> deleter;
-        Result(): data(nullptr) {}
-        Result(void *data, std::function<void(void *)> &&deleter):
-            data(data), deleter(std::move(deleter)) {}
-        ~Result() { if (data != nullptr) deleter(data); }
+        void (*deleter)(void *);
+        /* a small trivially copyable result is kept in place instead */
+        typename std::aligned_storage<16, alignof(std::max_align_t)>::type inline_data;
+
+        Result(): data(nullptr), deleter(nullptr) {}
+        Result(void *data, void (*deleter)(void *)):
+            data(data), deleter(deleter) {}
+        ~Result() { _release(); }
         Result(const Result &) = delete;
-        Result(Result &&other):
-                data(other.data),
-                error(std::move(other.error)),
-                deleter(std::move(other.deleter)) {
-            other.data = nullptr;
-        }
-        void swap(Result &other) {
-            std::swap(data, other.data);
-            std::swap(error, other.error);
-            std::swap(deleter, other.deleter);
+        Result(Result &&other): data(nullptr), deleter(nullptr) {
+            _take(other);
         }
         Result &operator=(const Result &other) = delete;
         Result &operator=(Result &&other) {
             if (this != &other)
             {
-                Result tmp(std::move(other));
-                tmp.swap(*this);
+                _release();
+                _take(other);
             }
             return *this;
         }
@@ -732,14 +1112,55 @@ class ThreadCall {
             if (error) std::rethrow_exception(error);
             return data;
         }
+
+        template<typename T>
+        void emplace(T &&_data) {
+            using _T = std::remove_reference_t<T>;
+            _release();
+            _emplace<_T>(std::forward<T>(_data), std::integral_constant<bool,
+                std::is_trivially_copyable<_T>::value &&
+                sizeof(_T) <= sizeof(inline_data) &&
+                alignof(_T) <= alignof(decltype(inline_data))>());
+        }
+
+        private:
+        template<typename _T, typename T>
+        void _emplace(T &&_data, std::true_type) {
+            data = new (&inline_data) _T(std::forward<T>(_data));
+            deleter = nullptr;
+        }
+        template<typename _T, typename T>
+        void _emplace(T &&_data, std::false_type) {
+            data = new _T(std::forward<T>(_data));
+            deleter = [](void *ptr) {delete static_cast<_T *>(ptr);};
+        }
+        void _release() {
+            if (data != nullptr && deleter != nullptr) deleter(data);
+            data = nullptr;
+            deleter = nullptr;
+            error = nullptr;
+        }
+        void _take(Result &other) {
+            error = std::move(other.error);
+            deleter = other.deleter;
+            if (other.data == &other.inline_data)
+            {
+                memcpy(&inline_data, &other.inline_data, sizeof(inline_data));
+                data = &inline_data;
+            }
+            else data = other.data;
+            other.data = nullptr;
+            other.deleter = nullptr;
+        }
     };
-    class Handle {
-        std::function<void(Handle &)> callback;
+    class Handle: public FreeList::Node {
+        InplaceFunc<void(Handle &)> callback;
         ThreadNotifier<Result> * notifier;
         Result result;
+        bool pooled;
         friend ThreadCall;
         public:
-        Handle(): notifier(nullptr) {}
+        Handle(): notifier(nullptr), pooled(false) {}
         Handle(const Handle &) = delete;
         void return_sync() {
             if (notifier)
@@ -751,51 +1172,90 @@ class ThreadCall {
         }
         template<typename T>
         Result &set_result(T &&data) {
-            using _T = std::remove_reference_t<T>;
-            return result = Result(new _T(std::forward<T>(data)),
-                            [](void *ptr) {delete static_cast<_T *>(ptr);});
+            result.emplace(std::forward<T>(data));
+            return result;
         }
     };
 
-    ThreadCall(size_t burst_size): burst_size(burst_size), stopped(false) {}
+    private:
+    Handle *alloc_handle() {
+        FreeList::Node *n;
+        if (free_handles.pop(n)) return static_cast<Handle *>(n);
+        auto h = new Handle();
+        /* a pooled handle is never deleted before the ThreadCall, as other
+         * threads may still be looking at it in the free list */
+        if (npooled.fetch_add(1, std::memory_order_relaxed) < max_npooled)
+            h->pooled = true;
+        else
+            npooled.fetch_sub(1, std::memory_order_relaxed);
+        return h;
+    }
+
+    void free_handle(Handle *h) {
+        if (!h->pooled) { delete h; return; }
+        /* release the captured objects now rather than on reuse */
+        h->callback.reset();
+        h->notifier = nullptr;
+        h->result = Result();
+        free_handles.push(h);
+    }
+
+    public:
+    ThreadCall(size_t burst_size):
+        burst_size(burst_size), stopped(false),
+        npooled(0), max_npooled(burst_size * 4) {}
     ThreadCall(const ThreadCall &) = delete;
     ThreadCall(ThreadCall &&) = delete;
-    ThreadCall(EventContext ec, size_t burst_size = 128): ec(ec), burst_size(burst_size), stopped(false) {
-        q.reg_handler(ec, [this, burst_size=burst_size](queue_t &q) {
+    ThreadCall(EventContext ec, size_t burst_size = 128):
+            ec(ec), burst_size(burst_size), stopped(false),
+            npooled(0), max_npooled(burst_size * 4) {
+        q.reg_handler(ec, [this, burst_size=burst_size,
+                            batch=std::vector<Handle *>(burst_size)](queue_t &q) mutable {
             size_t cnt = 0;
-            Handle *h;
-            while (q.try_dequeue(h))
+            /* a callback may schedule another call, so keep draining until
+             * the burst is used up */
+            while (cnt < burst_size)
             {
-                try {
-                    if (!stopped) h->exec();
-                    else throw SalticidaeError(SALTI_ERROR_NOT_AVAIL);
-                } catch (...) {
-                    h->set_result(0).error = std::current_exception();
-                    h->return_sync();
+                auto n = q.try_dequeue_bulk(batch.begin(), burst_size - cnt);
+                if (!n) break;
+                cnt += n;
+                for (size_t i = 0; i < n; i++)
+                {
+                    auto h = batch[i];
+                    try {
+                        if (!stopped) h->exec();
+                        else throw SalticidaeError(SALTI_ERROR_NOT_AVAIL);
+                    } catch (...) {
+                        h->set_result(0).error = std::current_exception();
+                        h->return_sync();
+                    }
+                    free_handle(h);
                 }
-                delete h;
-                if (++cnt == burst_size) return true;
             }
-            return false;
+            return cnt == burst_size;
         });
     }
 
     ~ThreadCall() {
         Handle *h;
         while (q.try_dequeue(h)) delete h;
+        for (FreeList::Node *n; free_handles.pop(n); ) delete n;
     }
 
     template<typename Func>
     bool async_call(Func &&callback) {
-        auto h = new Handle();
+        auto h = alloc_handle();
         h->callback = std::forward<Func>(callback);
         q.enqueue(h);
         return true;
     }
 
+    /** Run the callback in the thread of the ThreadCall and wait for it. A
+     * result set by the callback that is trivially copyable and at most 16
+     * bytes is returned without allocating. */
     template<typename Func>
     Result call(Func &&callback) {
-        auto h = new Handle();
+        auto h = alloc_handle();
         h->callback = std::forward<Func>(callback);
         ThreadNotifier<Result> notifier;
         h->notifier = &notifier;
@@ -804,6 +1264,8 @@ class ThreadCall {
     }
 
     const EventContext &get_ec() const { return ec; }
+    /** See MPSCQueueEventDriven::set_spin_time(). */
+    void set_spin_time(double t) { q.set_spin_time(t); }
     void stop() { stopped = true; }
     bool is_stopped() { return stopped; }
 };
@@ -876,6 +1338,7 @@ void mpscqueue_unreg_handler(mpscqueue_t *self);
 bool mpscqueue_enqueue(mpscqueue_t *self, void *elem, bool unbounded);
 bool mpscqueue_try_dequeue(mpscqueue_t *self, void **elem);
 void mpscqueue_set_capacity(mpscqueue_t *self, size_t cap);
+void mpscqueue_set_spin_time(mpscqueue_t *self, double t);
 
 #ifdef __cplusplus
 }
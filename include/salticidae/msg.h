@@ -38,11 +38,25 @@
 
 namespace salticidae {
 
+/** The algorithm that fills the 4-byte checksum field of a message header. */
+enum ChecksumType {
+    CHECKSUM_SHA1, /**< the first 4 bytes of SHA1 (the original format) */
+    CHECKSUM_CRC32C, /**< CRC32C, hardware-accelerated where available */
+    CHECKSUM_NONE /**< the field is zero and not verified (TLS only) */
+};
+
 template<typename OpcodeType>
 class MsgBase {
     public:
     using opcode_t = OpcodeType;
-    static const size_t header_size;
+    static constexpr size_t header_size =
+        sizeof(uint32_t) + /* magic */
+        sizeof(opcode_t) + /* opcode */
+        sizeof(uint32_t) + /* length */
+#ifndef SALTICIDAE_NOCHECKSUM
+        sizeof(uint32_t) + /* checksum */
+#endif
+        0;
 
     private:
     /* header */
@@ -51,7 +65,8 @@ class MsgBase {
     opcode_t opcode;
     uint32_t length;
 #ifndef SALTICIDAE_NOCHECKSUM
-    uint32_t checksum;
+    /* received, or computed by the last serialize_header() */
+    mutable uint32_t checksum;
 #endif
 
     mutable bytearray_t payload;
@@ -60,18 +75,35 @@ class MsgBase {
     public:
     MsgBase(uint32_t magic = 0x0): magic(magic), opcode(0xff), no_payload(true) {}
 
+    /* the checksum is only computed by serialize(), so it is not paid twice
+     * when the network uses a different checksum type */
     template<typename MsgType>
     MsgBase(const MsgType &msg, uint32_t magic): magic(magic) {
         set_opcode(MsgType::opcode);
         set_payload(std::move(msg.serialized));
-        set_checksum();
+#ifndef SALTICIDAE_NOCHECKSUM
+        checksum = 0;
+#endif
+    }
+
+    /* take over the serialized payload of a temporary message */
+    template<typename MsgType, typename = typename std::enable_if<
+        !std::is_lvalue_reference<MsgType>::value>::type>
+    MsgBase(MsgType &&msg, uint32_t magic): magic(magic) {
+        set_opcode(std::remove_cv<MsgType>::type::opcode);
+        set_payload(std::move(msg.serialized));
+#ifndef SALTICIDAE_NOCHECKSUM
+        checksum = 0;
+#endif
     }
 
 #ifdef SALTICIDAE_CBINDINGS
     MsgBase(const OpcodeType &opcode, bytearray_t &&payload): magic(0x0) {
         set_opcode(opcode);
         set_payload(std::move(payload));
-        set_checksum();
+#ifndef SALTICIDAE_NOCHECKSUM
+        checksum = 0;
+#endif
     }
 #endif
 
@@ -117,6 +149,38 @@ class MsgBase {
 #endif
     }
 
+    /** Parse the header from `header_size` raw bytes. */
+    MsgBase(const uint8_t *header): no_payload(true) {
+        uint32_t _magic;
+        uint32_t _length;
+        memmove(&_magic, header, sizeof(_magic));
+        header += sizeof(_magic);
+        parse_opcode(header);
+        header += sizeof(opcode_t);
+        memmove(&_length, header, sizeof(_length));
+        header += sizeof(_length);
+        magic = letoh(_magic);
+        length = letoh(_length);
+#ifndef SALTICIDAE_NOCHECKSUM
+        uint32_t _checksum;
+        memmove(&_checksum, header, sizeof(_checksum));
+        checksum = letoh(_checksum);
+#endif
+    }
+
+    private:
+    template<typename T = opcode_t>
+    typename std::enable_if<std::is_integral<T>::value>::type
+    parse_opcode(const uint8_t *p) { memmove(&opcode, p, sizeof(opcode)); }
+
+    template<typename T = opcode_t>
+    typename std::enable_if<!std::is_integral<T>::value>::type
+    parse_opcode(const uint8_t *p) {
+        DataStream s(p, p + sizeof(opcode_t));
+        s >> opcode;
+    }
+
+    public:
     void swap(MsgBase &other) {
         std::swap(magic, other.magic);
         std::swap(opcode, other.opcode);
@@ -171,6 +235,15 @@ class MsgBase {
         return DataStream(std::move(payload));
     }
 
+    /** Get the payload without consuming it. */
+    const bytearray_t &get_raw_payload() const {
+#ifndef SALTICIDAE_NOCHECK
+        if (no_payload)
+            throw std::runtime_error("payload not available");
+#endif
+        return payload;
+    }
+
     void set_payload(DataStream &&s) {
         set_payload(bytearray_t(std::move(s)));
     }
@@ -183,9 +256,11 @@ class MsgBase {
         length = payload.size();
     }
 
-    void set_checksum() {
+    void set_checksum(ChecksumType type = CHECKSUM_SHA1) {
 #ifndef SALTICIDAE_NOCHECKSUM
-        checksum = get_checksum();
+        checksum = get_checksum(type);
+#else
+        (void)type;
 #endif
     }
 
@@ -203,44 +278,102 @@ class MsgBase {
     }
 
 #ifndef SALTICIDAE_NOCHECKSUM
-    uint32_t get_checksum() const {
-        static thread_local class SHA1 sha1;
+    /** Compute the checksum of a payload made of `prefix` followed by
+     * `data`, without concatenating them. */
+    static uint32_t compute_checksum(ChecksumType type,
+                                    const uint8_t *prefix, size_t prefix_len,
+                                    const uint8_t *data, size_t len) {
         uint32_t res;
-        bytearray_t tmp;
+        switch (type)
+        {
+            case CHECKSUM_SHA1:
+            {
+                static thread_local class SHA1 sha1;
+                static thread_local bytearray_t tmp;
+                sha1.reset();
+                if (prefix_len) sha1.update(prefix, prefix_len);
+                if (len) sha1.update(data, len);
+                sha1.digest(tmp);
+                //sha256.reset();
+                //sha256.update(tmp);
+                //sha256.digest(tmp);
+                memmove(&res, &*tmp.begin(), 4);
+                break;
+            }
+            case CHECKSUM_CRC32C:
+                res = crc32c(crc32c(0, prefix, prefix_len), data, len);
+                break;
+            default:
+                res = 0;
+        }
+        return res;
+    }
+
+    uint32_t get_checksum(ChecksumType type = CHECKSUM_SHA1) const {
 #ifndef SALTICIDAE_NOCHECK
-        if (no_payload)
+        if (no_payload && type != CHECKSUM_NONE)
             throw std::runtime_error("payload not available");
 #endif
-        sha1.reset();
-        sha1.update(payload);
-        sha1.digest(tmp);
-        //sha256.reset();
-        //sha256.update(tmp);
-        //sha256.digest(tmp);
-        memmove(&res, &*tmp.begin(), 4);
-        return res;
+        return compute_checksum(type, nullptr, 0, payload.data(), payload.size());
     }
 
-    bool verify_checksum() const {
-        return checksum == get_checksum();
+    bool verify_checksum(ChecksumType type = CHECKSUM_SHA1) const {
+        return type == CHECKSUM_NONE || checksum == get_checksum(type);
     }
 #endif
 
-    bytearray_t serialize() const {
+    /** Serialize the header only, the payload is expected to follow it on
+     * the wire. */
+    bytearray_t serialize_header(ChecksumType type = CHECKSUM_SHA1) const {
         DataStream s;
+#ifndef SALTICIDAE_NOCHECKSUM
+        checksum = get_checksum(type);
+#endif
         s << htole(magic)
           << opcode
           << htole(length)
 #ifndef SALTICIDAE_NOCHECKSUM
           << htole(checksum)
 #endif
-          << payload;
+          ;
+#ifdef SALTICIDAE_NOCHECKSUM
+        (void)type;
+#endif
+        return bytearray_t(std::move(s));
+    }
+
+    /** Serialize the header of a message with the magic and opcode of this
+     * one, but whose payload is `prefix` followed by `len` bytes at `data`,
+     * then append the prefix, so only the data is left to be sent. */
+    bytearray_t serialize_header(const bytearray_t &prefix,
+                                const uint8_t *data, size_t len,
+                                ChecksumType type = CHECKSUM_SHA1) const {
+        DataStream s;
+        s << htole(magic)
+          << opcode
+          << htole((uint32_t)(prefix.size() + len))
+#ifndef SALTICIDAE_NOCHECKSUM
+          << htole(compute_checksum(type, prefix.data(), prefix.size(), data, len))
+#endif
+          << prefix;
+#ifdef SALTICIDAE_NOCHECKSUM
+        (void)data;
+        (void)type;
+#endif
+        return bytearray_t(std::move(s));
+    }
+
+    bytearray_t serialize(ChecksumType type = CHECKSUM_SHA1) const {
+        DataStream s(serialize_header(type));
+        s.reserve(payload.size());
+        s << payload;
         return bytearray_t(std::move(s));
     }
 
     void gen_hash_list(DataStream &s,
                         const std::vector<uint256_t> &hashes) {
         uint32_t size = htole((uint32_t)hashes.size());
+        s.reserve(sizeof(size) + hashes.size() * ENT_HASH_LENGTH);
         s << size;
         for (const auto &h: hashes) s << h;
     }
@@ -260,14 +393,7 @@ class MsgBase {
 };
 
 template<typename OpcodeType>
-const size_t MsgBase<OpcodeType>::header_size =
-    sizeof(MsgBase<OpcodeType>::magic) +
-    sizeof(MsgBase<OpcodeType>::opcode) +
-    sizeof(MsgBase<OpcodeType>::length) +
-#ifndef SALTICIDAE_NOCHECKSUM
-    sizeof(MsgBase<OpcodeType>::checksum) +
-#endif
-    0;
+constexpr size_t MsgBase<OpcodeType>::header_size;
 }
 
 #ifdef SALTICIDAE_CBINDINGS
@@ -290,6 +416,9 @@ extern "C" {
 msg_t *msg_new_moved_from_bytearray(_opcode_t opcode, bytearray_t *_moved_payload);
 void msg_free(msg_t *msg);
 datastream_t *msg_consume_payload(const msg_t *msg);
+/* borrow the payload without copying or consuming it, it is valid as long as
+ * the message (in a handler, only during the call) */
+const uint8_t *msg_get_payload_inplace(const msg_t *msg, size_t *len);
 _opcode_t msg_get_opcode(const msg_t *msg);
 uint32_t msg_get_magic(const msg_t *msg);
 void msg_set_magic(msg_t *msg, uint32_t magic);
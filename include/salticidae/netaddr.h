@@ -33,37 +33,82 @@
 #include <cstring>
 #include <cstdint>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
 #include <netdb.h>
 
 namespace salticidae {
 
-/* TODO: IPv6 support */
+/** An IPv4 or IPv6 address with a port. An IPv4 address is kept in `ip` (and
+ * serialized) as before, an IPv6 one in `ip6`. */
 struct NetAddr {
-    uint32_t ip;
-    uint16_t port;
+    uint32_t ip;        /**< IPv4 address (network byte order), 0 for IPv6 */
+    uint16_t port;      /**< network byte order */
+    bool v6;
+    uint8_t ip6[16];    /**< IPv6 address, all zero for IPv4 */
+
+    /** Serialized in place of `ip` to mark an IPv6 address, which follows
+     * the port (255.255.255.255 is never the address of a peer). */
+    static const uint32_t ipv6_tag = 0xffffffff;
+
     /* construct from human-readable format */
-    NetAddr(): ip(0), port(0) {}
+    NetAddr(): ip(0), port(0), v6(false) { memset(ip6, 0, sizeof(ip6)); }
 
-    NetAddr(uint32_t ip, uint16_t port): ip(ip), port(port) {}
+    NetAddr(uint32_t ip, uint16_t port): ip(ip), port(port), v6(false) {
+        memset(ip6, 0, sizeof(ip6));
+    }
     
     NetAddr(const std::string &_addr, uint16_t _port) {
         set_by_ip_port(_addr, _port);
     }
     
+    /** Take an IPv4 or IPv6 address literal, or a host name (resolved to
+     * its IPv4 address if it has one). */
     void set_by_ip_port(const std::string &_addr, uint16_t _port) {
-        struct hostent *h;
-        if ((h = gethostbyname(_addr.c_str())) == nullptr)
-            throw SalticidaeError(SALTI_ERROR_NETADDR_INVALID, errno);
-        memmove(&ip, h->h_addr_list[0], sizeof(in_addr_t));
+        ip = 0;
+        v6 = false;
+        memset(ip6, 0, sizeof(ip6));
         port = htons(_port);
+        if (inet_pton(AF_INET, _addr.c_str(), &ip) == 1) return;
+        struct in6_addr in6;
+        if (inet_pton(AF_INET6, _addr.c_str(), &in6) == 1)
+        {
+            set_ip6(in6);
+            return;
+        }
+        struct addrinfo hints, *res;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        int ret = getaddrinfo(_addr.c_str(), nullptr, &hints, &res);
+        if (ret == EAI_SYSTEM)
+            throw SalticidaeError(SALTI_ERROR_NETADDR_INVALID, errno);
+        if (ret != 0)
+            throw SalticidaeError(SALTI_ERROR_NETADDR_INVALID, ret, gai_strerror(ret));
+        const struct addrinfo *found = nullptr;
+        for (auto p = res; p; p = p->ai_next)
+            if (p->ai_family == AF_INET ||
+                (p->ai_family == AF_INET6 && !found))
+                found = p;
+        if (found && found->ai_family == AF_INET)
+            ip = ((const struct sockaddr_in *)found->ai_addr)->sin_addr.s_addr;
+        else if (found)
+            set_ip6(((const struct sockaddr_in6 *)found->ai_addr)->sin6_addr);
+        freeaddrinfo(res);
+        if (!found)
+            throw SalticidaeError(SALTI_ERROR_NETADDR_INVALID);
     }
     
+    /** Parse "ip:port", where an IPv6 address is in brackets
+     * ("[::1]:port"). */
     NetAddr(const std::string &ip_port_addr) {
-        size_t pos = ip_port_addr.find(":");
+        size_t pos = ip_port_addr.rfind(":");
         if (pos == std::string::npos)
             throw SalticidaeError(SALTI_ERROR_NETADDR_INVALID);
         std::string ip_str = ip_port_addr.substr(0, pos);
         std::string port_str = ip_port_addr.substr(pos + 1);
+        if (ip_str.size() >= 2 && ip_str.front() == '[' && ip_str.back() == ']')
+            ip_str = ip_str.substr(1, ip_str.size() - 2);
         long port;
         try {
             port = std::stol(port_str.c_str());
@@ -77,33 +122,140 @@ struct NetAddr {
         set_by_ip_port(ip_str, (uint16_t)port);
     }
     /* construct from unix socket format */
-    NetAddr(const struct sockaddr_in *addr_sock) {
+    NetAddr(const struct sockaddr_in *addr_sock): v6(false) {
         ip = addr_sock->sin_addr.s_addr;
         port = addr_sock->sin_port;
+        memset(ip6, 0, sizeof(ip6));
+    }
+
+    NetAddr(const struct sockaddr_in6 *addr_sock): ip(0) {
+        port = addr_sock->sin6_port;
+        set_ip6(addr_sock->sin6_addr);
+    }
+
+    NetAddr(const struct sockaddr *addr_sock) {
+        if (addr_sock->sa_family == AF_INET6)
+            *this = NetAddr((const struct sockaddr_in6 *)addr_sock);
+        else
+            *this = NetAddr((const struct sockaddr_in *)addr_sock);
+    }
+
+    private:
+    /* an IPv4-mapped address (from a dual-stack socket) is kept as IPv4, so
+     * it equals the address the peer is known by */
+    void set_ip6(const struct in6_addr &in6) {
+        if (IN6_IS_ADDR_V4MAPPED(&in6))
+        {
+            v6 = false;
+            memmove(&ip, in6.s6_addr + 12, sizeof(ip));
+            memset(ip6, 0, sizeof(ip6));
+            return;
+        }
+        ip = 0;
+        v6 = true;
+        memmove(ip6, in6.s6_addr, sizeof(ip6));
+    }
+
+    public:
+    bool is_ipv6() const { return v6; }
+    int get_family() const { return v6 ? AF_INET6 : AF_INET; }
+
+    /** Fill in the socket address, return its length. */
+    socklen_t get_sockaddr(struct sockaddr_storage *ss) const {
+        memset(ss, 0, sizeof(*ss));
+        if (v6)
+        {
+            auto sin6 = (struct sockaddr_in6 *)ss;
+            sin6->sin6_family = AF_INET6;
+            sin6->sin6_port = port;
+            memmove(sin6->sin6_addr.s6_addr, ip6, sizeof(ip6));
+            return sizeof(*sin6);
+        }
+        auto sin = (struct sockaddr_in *)ss;
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = ip;
+        sin->sin_port = port;
+        return sizeof(*sin);
+    }
+
+    /** The same address with port 0. */
+    NetAddr get_host() const {
+        NetAddr res(*this);
+        res.port = 0;
+        return res;
     }
     
     bool operator==(const NetAddr &other) const {
-        return ip == other.ip && port == other.port;
+        return ip == other.ip && port == other.port && v6 == other.v6 &&
+            (!v6 || !memcmp(ip6, other.ip6, sizeof(ip6)));
     }
 
     bool operator!=(const NetAddr &other) const {
-        return ip != other.ip || port != other.port;
+        return !(*this == other);
     }
    
     operator std::string() const {
-        struct in_addr in;
-        in.s_addr = ip;
         DataStream s;
-        s << "<NetAddr " << std::string(inet_ntoa(in))
-          << ":" << std::to_string(ntohs(port)) << ">";
+        s << "<NetAddr ";
+        if (v6)
+        {
+            char buff[INET6_ADDRSTRLEN];
+            inet_ntop(AF_INET6, ip6, buff, sizeof(buff));
+            s << "[" << std::string(buff) << "]";
+        }
+        else
+        {
+            struct in_addr in;
+            in.s_addr = ip;
+            s << std::string(inet_ntoa(in));
+        }
+        s << ":" << std::to_string(ntohs(port)) << ">";
         return std::string(std::move(s));
     }
 
-    bool is_null() const { return ip == 0 && port == 0; }
+    bool is_null() const { return ip == 0 && port == 0 && !v6; }
 
-    void serialize(DataStream &s) const { s << ip << port; }
+    /** Mix the address and the port. */
+    size_t get_hash() const {
+        size_t h = ip ^ port;
+        if (v6)
+            for (size_t i = 0; i < sizeof(ip6); i += sizeof(uint32_t))
+            {
+                uint32_t w;
+                memmove(&w, ip6 + i, sizeof(w));
+                h = h * 31 + w;
+            }
+        return h;
+    }
 
-    void unserialize(DataStream &s) { s >> ip >> port; }
+    size_t get_serialized_size() const {
+        return sizeof(ip) + sizeof(port) + (v6 ? sizeof(ip6) : 0);
+    }
+
+    void serialize(DataStream &s) const {
+        if (!v6)
+        {
+            s << ip << port;
+            return;
+        }
+        s << (uint32_t)ipv6_tag << port;
+        s.put_data(ip6, ip6 + sizeof(ip6));
+    }
+
+    void unserialize(DataStream &s) {
+        s >> ip >> port;
+        if (ip == ipv6_tag)
+        {
+            struct in6_addr in6;
+            memmove(in6.s6_addr, s.get_data_inplace(sizeof(ip6)), sizeof(ip6));
+            set_ip6(in6);
+        }
+        else
+        {
+            v6 = false;
+            memset(ip6, 0, sizeof(ip6));
+        }
+    }
 };
 
 }
@@ -112,14 +264,14 @@ namespace std {
     template <>
     struct hash<salticidae::NetAddr> {
         size_t operator()(const salticidae::NetAddr &k) const {
-            return k.ip ^ k.port;
+            return k.get_hash();
         }
     };
 
     template <>
     struct hash<const salticidae::NetAddr> {
         size_t operator()(const salticidae::NetAddr &k) const {
-            return k.ip ^ k.port;
+            return k.get_hash();
         }
     };
 }
@@ -146,6 +298,7 @@ bool netaddr_is_eq(const netaddr_t *a, const netaddr_t *b);
 bool netaddr_is_null(const netaddr_t *self);
 uint32_t netaddr_get_ip(const netaddr_t *self);
 uint16_t netaddr_get_port(const netaddr_t *self);
+bool netaddr_is_ipv6(const netaddr_t *self);
 netaddr_array_t *netaddr_array_new();
 netaddr_array_t *netaddr_array_new_from_addrs(const netaddr_t * const *paddrs, size_t naddrs);
 void netaddr_array_free(netaddr_array_t *self);
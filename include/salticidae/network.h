@@ -33,7 +33,7 @@
 
 #ifdef __cplusplus
 #include <unordered_set>
-#include <shared_mutex>
+#include <mutex>
 #include <openssl/rand.h>
 namespace salticidae {
 /** Network of nodes who can send async messages.  */
@@ -69,6 +69,28 @@ class MsgNetwork: public ConnPool {
     struct callback_traits<ReturnType(ClassType::*)(Args...)>:
         public callback_traits<ReturnType(Args...)> {};
 
+    /** How messages are assigned to handler threads. */
+    enum HandlerShard {
+        SHARD_BY_CONN, /**< messages from one connection go to the same thread */
+        SHARD_BY_OPCODE, /**< messages of one opcode go to the same thread */
+    };
+
+    /** A frame of a streamed message (see send_msg_stream()). */
+    struct StreamChunk {
+        uint32_t stream_id; /**< unique among the streams of the connection */
+        uint64_t total;     /**< the length of the whole message */
+        uint64_t offset;    /**< where the data is in the whole message */
+        DataStream data;    /**< the bytes of this frame */
+
+        bool is_last() const { return offset + data.size() >= total; }
+    };
+
+    /** The bytes each frame adds to the message payload. */
+    static const size_t stream_frame_header_size =
+        sizeof(uint32_t) + /* stream id */
+        sizeof(uint64_t) + /* total */
+        sizeof(uint64_t);  /* offset */
+
     class Conn: public ConnPool::Conn {
         friend MsgNetwork;
         enum MsgState {
@@ -79,8 +101,38 @@ class MsgNetwork: public ConnPool {
         Msg msg;
         MsgState msg_state;
         bool msg_sleep;
+        /* the handler thread of the connection (with SHARD_BY_CONN) */
+        size_t handler_idx;
+        /* the queue to the handler threads, kept when the connection
+         * migrates so its messages stay in order */
+        size_t queue_idx;
+#ifdef SALTICIDAE_MSG_TRACE
+        /* when the pending msg was read */
+        uint64_t msg_recv_ts;
+#endif
         /* initialized and destroyed by the worker */
         TimerEvent ev_enqueue_poll;
+        /* the streamed messages being reassembled (owned by the worker) */
+        struct stream_t {
+            uint64_t total;
+            bytearray_t data;
+        };
+        std::unordered_map<uint32_t, stream_t> streams;
+        /* the sum of their lengths */
+        size_t stream_bytes;
+        std::atomic<uint32_t> stream_seq;
+        /* the small messages waiting to go out as one batch frame (see
+         * Config::msg_batch()), staged by any thread under batch_mlock */
+        std::mutex batch_mlock;
+        DataStream batch;
+        size_t batch_nmsg;
+        SendPriority batch_prio;
+        /* when a message or a batch was last written */
+        uint64_t batch_flush_ts;
+        /* the messages of a received batch frame that are not yet enqueued
+         * (owned by the worker) */
+        std::vector<Msg> unbatched;
+        size_t unbatched_idx;
 
         protected:
 #ifdef SALTICIDAE_MSG_STAT
@@ -91,7 +143,10 @@ class MsgNetwork: public ConnPool {
 #endif
 
         public:
-        Conn(): msg_state(HEADER), msg_sleep(false)
+        Conn(): msg_state(HEADER), msg_sleep(false), handler_idx(0), queue_idx(0),
+            stream_bytes(0), stream_seq(0),
+            batch_nmsg(0), batch_prio(SEND_PRIO_NORMAL), batch_flush_ts(0),
+            unbatched_idx(0)
 #ifdef SALTICIDAE_MSG_STAT
             , nsent(0), nrecv(0), nsentb(0), nrecvb(0)
 #endif
@@ -116,53 +171,358 @@ class MsgNetwork: public ConnPool {
     };
 
     using conn_t = ArcObj<Conn>;
+    /** The number of opcodes having their own counters, the handlers
+     * registered beyond that share the last ones. */
+    static const size_t stat_nopcode = 256;
 #ifdef SALTICIDAE_MSG_STAT
-    // TODO: a lock-free, thread-safe, fine-grained stat
+
+    /** Message counters of a worker. */
+    struct RecvStat {
+        StatCounter nmsg;           /**< messages passed to the handlers */
+        StatCounter nbytes;         /**< payload bytes of these messages */
+        StatCounter nchecksum_fail; /**< messages dropped by checksum */
+        StatCounter nqueue_full;    /**< reads paused by a full incoming queue */
+        StatCounter nbatch;         /**< batch frames unpacked */
+
+        RecvStat &operator+=(const RecvStat &other) {
+            nmsg += other.nmsg;
+            nbytes += other.nbytes;
+            nchecksum_fail += other.nchecksum_fail;
+            nqueue_full += other.nqueue_full;
+            nbatch += other.nbatch;
+            return *this;
+        }
+    };
+
+    /** Counters of one opcode. */
+    struct OpcodeStat {
+        StatCounter nmsg;           /**< handled messages */
+        StatCounter nbytes;         /**< payload bytes of these messages */
+        StatCounter nsec;           /**< total time spent in the handler */
+
+        OpcodeStat &operator+=(const OpcodeStat &other) {
+            nmsg += other.nmsg;
+            nbytes += other.nbytes;
+            nsec += other.nsec;
+            return *this;
+        }
+    };
+
+    /** Counters of a thread running message handlers. */
+    struct HandlerStat {
+        StatCounter nmsg;           /**< handled messages */
+        StatCounter nunknown;       /**< messages without a handler */
+        Histogram latency;          /**< handler execution time (ns) */
+        OpcodeStat opcodes[stat_nopcode];
+
+        HandlerStat &operator+=(const HandlerStat &other) {
+            nmsg += other.nmsg;
+            nunknown += other.nunknown;
+            latency += other.latency;
+            for (size_t i = 0; i < stat_nopcode; i++)
+                opcodes[i] += other.opcodes[i];
+            return *this;
+        }
+    };
+
+    /** Counters and gauges of a connection. */
+    struct ConnStat {
+        NetAddr addr;
+        ConnPool::Conn::ConnMode mode;
+        size_t nsent;
+        size_t nrecv;
+        size_t nsentb;
+        size_t nrecvb;
+        size_t send_queue_len;      /**< segments waiting to be sent */
+        size_t recv_buff_size;      /**< bytes waiting to be parsed */
+        size_t kernel_send_queue;   /**< unsent bytes in the kernel */
+        size_t kernel_recv_queue;   /**< unread bytes in the kernel */
+    };
+
+    /** A snapshot of the statistics. */
+    struct Stat {
+        /** per worker */
+        std::vector<IOStat> worker_io;
+        std::vector<RecvStat> worker_recv;
+        /** per handler thread, the first one is the EventContext of the
+         * network (the only one unless nhandler > 0) */
+        std::vector<HandlerStat> handler;
+        /** sums of the above */
+        IOStat io;
+        RecvStat recv;
+        HandlerStat handler_total;
+        /** counters of each registered opcode */
+        std::vector<std::pair<OpcodeType, OpcodeStat>> opcodes;
+        /** empty if the network is not running */
+        std::vector<ConnStat> conns;
+
+        /** Messages passed to the handlers but not yet handled. */
+        uint64_t get_incoming_queue_len() const {
+            uint64_t handled = handler_total.nmsg + handler_total.nunknown;
+            return recv.nmsg > handled ? recv.nmsg - handled : 0;
+        }
+    };
+#endif
+#ifdef SALTICIDAE_MSG_TRACE
+    /** Where the time goes for the messages of one opcode (in ns). */
+    struct OpcodeTrace {
+        Histogram parse_delay;      /**< from the socket read to the enqueue */
+        Histogram queue_delay;      /**< from the enqueue to the handler */
+        Histogram handler_time;     /**< spent in the handler */
+        Histogram total;            /**< from the socket read to the end of
+                                      the handler */
+
+        OpcodeTrace &operator+=(const OpcodeTrace &other) {
+            parse_delay += other.parse_delay;
+            queue_delay += other.queue_delay;
+            handler_time += other.handler_time;
+            total += other.total;
+            return *this;
+        }
+    };
 #endif
 
     private:
     const size_t max_msg_size;
     const size_t max_msg_queue_size;
+    const size_t max_stream_size;
+    const size_t stream_frame_size;
+    /* batch frames are only understood with batch_enabled, and only sent
+     * with a non-zero window */
+    const bool batch_enabled;
+    const OpcodeType batch_opcode;
+    const uint64_t batch_window_ns;
+    /* the bytes each message adds to a batch frame besides its payload */
+    static const size_t batch_entry_header_size =
+        sizeof(OpcodeType) + /* opcode */
+        sizeof(uint32_t);    /* length */
+    using msg_handler_t = std::function<void(const Msg &msg, const conn_t &)>;
+    /* a handler with the index of its opcode counters */
     std::unordered_map<
         typename Msg::opcode_t,
-        std::function<void(const Msg &msg, const conn_t &)>> handler_map;
-    using queue_t = MPSCQueueEventDriven<std::pair<Msg, conn_t>>;
+        std::pair<msg_handler_t, size_t>> handler_map;
+    using burst_handler_t = std::function<void(const Msg *const *msgs,
+                                            const conn_t *const *conns, size_t n)>;
+    /* the opcodes whose handlers take a run of messages at once (they are
+     * also in handler_map, for the counters) */
+    std::unordered_map<typename Msg::opcode_t, burst_handler_t> burst_handler_map;
+    /* the send priorities other than SEND_PRIO_NORMAL */
+    std::unordered_map<typename Msg::opcode_t, SendPriority> send_prio_map;
+    /* the opcodes whose streams are reassembled by the workers */
+    std::unordered_set<typename Msg::opcode_t> stream_opcodes;
+    /* a parsed message and its connection */
+    struct incoming_t {
+        Msg msg;
+        conn_t conn;
+#ifdef SALTICIDAE_MSG_TRACE
+        uint64_t recv_ts;
+        uint64_t enqueue_ts;
+#endif
+        incoming_t() = default;
+        incoming_t(Msg &&msg, const conn_t &conn):
+            msg(std::move(msg)), conn(conn) {}
+    };
+    using queue_t = MPSCQueueEventDriven<incoming_t>;
+    using batch_t = std::vector<incoming_t>;
+    /* the arrays passed to a burst handler, kept by each queue */
+    struct burst_t {
+        std::vector<const Msg *> msgs;
+        std::vector<const conn_t *> conns;
+    };
     queue_t incoming_msgs;
 
+    /* a thread running message handlers (when nhandler > 0), each worker
+     * has its own queue to the thread so workers do not contend with each
+     * other when enqueuing */
+    struct HandlerThread {
+        EventContext ec;
+        BoxObj<ThreadCall> tcall;
+        BoxObj<queue_t[]> incoming_msgs;
+        cpu_list_t cpus;
+        std::thread handle;
+    };
+    const size_t nhandler;
+    const HandlerShard handler_shard;
+    BoxObj<HandlerThread[]> handler_threads;
+    std::atomic<size_t> handler_rr;
+
+    queue_t &get_incoming_queue(const conn_t &conn, const Msg &msg) {
+        if (!nhandler) return incoming_msgs;
+        size_t idx = handler_shard == SHARD_BY_OPCODE ?
+            std::hash<typename Msg::opcode_t>()(msg.get_opcode()) % nhandler :
+            conn->handler_idx;
+        return handler_threads[idx].incoming_msgs[conn->queue_idx];
+    }
+
+    /* ctx is 0 for the EventContext of the network, or i + 1 for the i-th
+     * handler thread */
+    bool process_incoming(queue_t &q, batch_t &batch, burst_t &burst,
+                        size_t burst_size, size_t ctx);
+
+    static bool parse_stream_frame(DataStream &&s, StreamChunk &chunk);
+    /* return true if the frame in msg completes a message, which is then
+     * put in its place */
+    bool reassemble_stream(const conn_t &conn, Msg &msg);
+    /* pass conn->msg to the handlers, return false if the connection has to
+     * wait for room in the incoming queue */
+    bool deliver(const conn_t &conn);
+    void unbatch(const conn_t &conn, Msg &msg);
+    inline bool _send_msg_batched(const Msg &msg, const conn_t &conn, SendPriority prio);
+    /* write the staged messages (with batch_mlock held) */
+    inline bool flush_batch(const conn_t &conn);
+    /* write the staged messages (with batch_mlock held), or drop them and
+     * report the failure if the send buffer is full, as nobody is left to
+     * retry */
+    inline void flush_or_drop_batch(const conn_t &conn);
+
+#ifdef SALTICIDAE_MSG_STAT
+    BoxObj<PaddedStat<RecvStat>[]> recv_stats;
+    BoxObj<PaddedStat<HandlerStat>[]> handler_stats;
+
+    RecvStat &get_recv_stat(const conn_t &conn) {
+        return recv_stats[conn->get_worker()->get_id()];
+    }
+#endif
+#ifdef SALTICIDAE_MSG_TRACE
+    /* traces of a handler context, only allocated for the opcodes it sees */
+    struct HandlerTrace {
+        std::atomic<OpcodeTrace *> opcodes[stat_nopcode];
+
+        HandlerTrace() {
+            for (auto &p: opcodes) p.store(nullptr, std::memory_order_relaxed);
+        }
+
+        ~HandlerTrace() {
+            for (auto &p: opcodes) delete p.load(std::memory_order_relaxed);
+        }
+
+        /* only to be called by the owner */
+        OpcodeTrace &get(size_t idx) {
+            auto p = opcodes[idx].load(std::memory_order_relaxed);
+            if (!p)
+            {
+                p = new OpcodeTrace();
+                opcodes[idx].store(p, std::memory_order_release);
+            }
+            return *p;
+        }
+    };
+    BoxObj<PaddedStat<HandlerTrace>[]> handler_traces;
+
+    void trace_enqueue(incoming_t &item, uint64_t recv_ts) {
+        item.recv_ts = recv_ts;
+        item.enqueue_ts = get_monotonic_ns();
+    }
+#endif
+
+    void stop_handler_threads() {
+        if (!handler_threads) return;
+        for (size_t i = 0; i < nhandler; i++)
+        {
+            auto &t = handler_threads[i];
+            if (!t.handle.joinable()) continue;
+            t.tcall->async_call([&t](ThreadCall::Handle &) { t.ec.stop(); });
+            t.handle.join();
+        }
+    }
+
     protected:
+    const ChecksumType checksum_type;
     const uint32_t msg_magic;
     ConnPool::Conn *create_conn() override { return new Conn(); }
     void on_read(const ConnPool::conn_t &) override;
 
     void on_worker_setup(const ConnPool::conn_t &_conn) override {
         auto conn = static_pointer_cast<Conn>(_conn);
-        conn->ev_enqueue_poll = TimerEvent(conn->worker->get_ec(),
+        if (nhandler)
+            conn->handler_idx = handler_rr.fetch_add(1, std::memory_order_relaxed) % nhandler;
+        conn->queue_idx = conn->get_worker()->get_id();
+        setup_enqueue_poll(conn);
+    }
+
+    void setup_enqueue_poll(const conn_t &conn) {
+        conn->ev_enqueue_poll = TimerEvent(conn->get_worker()->get_ec(),
             [this, conn](TimerEvent &) {
-                if (!incoming_msgs.enqueue(std::make_pair(conn->msg, conn), false))
+                auto &q = get_incoming_queue(conn, conn->msg);
+#ifdef SALTICIDAE_MSG_STAT
+                auto len = conn->msg.get_length();
+#endif
+                incoming_t item(std::move(conn->msg), conn);
+#ifdef SALTICIDAE_MSG_TRACE
+                trace_enqueue(item, conn->msg_recv_ts);
+#endif
+                if (!q.enqueue(std::move(item), false))
                 {
+                    /* a failed enqueue leaves the item intact */
+                    conn->msg = std::move(item.msg);
                     conn->msg_sleep = true;
                     conn->ev_enqueue_poll.add(0);
                     return;
                 }
+#ifdef SALTICIDAE_MSG_STAT
+                auto &recv_stat = get_recv_stat(conn);
+                recv_stat.nmsg.add();
+                recv_stat.nbytes.add(len);
+#endif
                 conn->msg_sleep = false;
                 on_read(conn);
             });
     }
 
+    void on_send_wakeup(const ConnPool::conn_t &_conn) override {
+        if (!batch_window_ns) return;
+        auto conn = static_pointer_cast<Conn>(_conn);
+        mutex_lg_t _(conn->batch_mlock);
+        flush_or_drop_batch(conn);
+    }
+
+    /* move the staged messages into the send buffer of a connection that
+     * gets no more wakeups */
+    void flush_staged(const conn_t &conn) {
+        if (!batch_window_ns) return;
+        mutex_lg_t _g(conn->batch_mlock);
+        flush_or_drop_batch(conn);
+    }
+
     void on_worker_teardown(const ConnPool::conn_t &_conn) override {
         auto conn = static_pointer_cast<Conn>(_conn);
         conn->ev_enqueue_poll.clear();
+        /* the send buffer is handed over on reconnection by PeerNetwork */
+        flush_staged(conn);
         ConnPool::on_worker_teardown(_conn);
     }
 
+    void on_worker_detach(const ConnPool::conn_t &_conn) override {
+        auto conn = static_pointer_cast<Conn>(_conn);
+        conn->ev_enqueue_poll.clear();
+        ConnPool::on_worker_detach(_conn);
+    }
+
+    void on_worker_attach(const ConnPool::conn_t &_conn) override {
+        auto conn = static_pointer_cast<Conn>(_conn);
+        setup_enqueue_poll(conn);
+        /* resume retrying the message stuck on a full queue */
+        if (conn->msg_sleep) conn->ev_enqueue_poll.add(0);
+        ConnPool::on_worker_attach(_conn);
+    }
+
     public:
 
     class Config: public ConnPool::Config {
         friend class MsgNetwork;
         size_t _max_msg_size;
         size_t _max_msg_queue_size;
+        size_t _max_stream_size;
+        size_t _stream_frame_size;
+        bool _batch_enabled;
+        OpcodeType _batch_opcode;
+        double _batch_window;
         size_t _burst_size;
         uint32_t _msg_magic;
+        ChecksumType _checksum_type;
+        size_t _nhandler;
+        HandlerShard _handler_shard;
+        std::vector<cpu_list_t> _handler_cpus;
 
         public:
         Config(): Config(ConnPool::Config()) {}
@@ -170,8 +530,16 @@ class MsgNetwork: public ConnPool {
             ConnPool::Config(config),
             _max_msg_size(1024),
             _max_msg_queue_size(65536),
+            _max_stream_size(64 << 20),
+            _stream_frame_size(0),
+            _batch_enabled(false),
+            _batch_opcode(),
+            _batch_window(0),
             _burst_size(1000),
-            _msg_magic(0x0) {}
+            _msg_magic(0x0),
+            _checksum_type(CHECKSUM_SHA1),
+            _nhandler(0),
+            _handler_shard(SHARD_BY_CONN) {}
 
         Config &max_msg_size(size_t x) {
             _max_msg_size = x;
@@ -183,6 +551,41 @@ class MsgNetwork: public ConnPool {
             return *this;
         }
 
+        /** The bytes of streamed messages a connection may be reassembling
+         * at a time (see MsgNetwork::enable_stream_reassembly()). */
+        Config &max_stream_size(size_t x) {
+            _max_stream_size = x;
+            return *this;
+        }
+
+        /** The payload bytes carried by each frame of a streamed message.
+         * With 0 (the default), frames are as large as max_msg_size allows,
+         * so they fit peers having the same max_msg_size. */
+        Config &stream_frame_size(size_t x) {
+            _stream_frame_size = x;
+            return *this;
+        }
+
+        /** Coalesce the small messages to a connection into batch frames
+         * with the reserved opcode, which are unpacked transparently by the
+         * receiver (all peers should enable it with the same opcode). A
+         * message goes out at once unless another one was written less than
+         * `window` seconds ago, in which case it is staged until the worker
+         * of the connection gets to it, or until the batch would exceed
+         * max_msg_size. Only messages with the same priority are batched
+         * together. If the send buffer is full when a batch is due, the
+         * batch stays staged and the send_msg() that needed it written
+         * fails; if the worker cannot write it, it is dropped and reported
+         * to the error callback (SALTI_ERROR_CONN_NOT_READY, async id -1).
+         * With a zero window, batch frames are received
+         * but never sent. */
+        Config &msg_batch(OpcodeType opcode, double window = 20e-6) {
+            _batch_enabled = true;
+            _batch_opcode = opcode;
+            _batch_window = window;
+            return *this;
+        }
+
         Config &burst_size(size_t x) {
             _burst_size = x;
             return *this;
@@ -190,6 +593,39 @@ class MsgNetwork: public ConnPool {
 
         Config &msg_magic(uint32_t x) {
             _msg_magic = x;
+            return *this;
+        }
+
+        /** The checksum algorithm for messages (all peers should use the same
+         * one). CHECKSUM_NONE is only allowed when TLS is enabled, as TLS
+         * already authenticates the bytes. */
+        Config &checksum_type(ChecksumType x) {
+            _checksum_type = x;
+            return *this;
+        }
+
+        /** The number of threads running message handlers. With 0 (the
+         * default), handlers run in the EventContext of the network.
+         * Otherwise they run concurrently in their own threads, so they
+         * should be thread-safe and registered before start(). */
+        Config &nhandler(size_t x) {
+            _nhandler = x;
+            return *this;
+        }
+
+        /** How messages are assigned to the handler threads. SHARD_BY_CONN
+         * keeps the message order of each connection, while SHARD_BY_OPCODE
+         * only keeps the order of messages with the same opcode from one
+         * connection. */
+        Config &handler_shard(HandlerShard x) {
+            _handler_shard = x;
+            return *this;
+        }
+
+        /** Pin the i-th handler thread to x[i % x.size()]. */
+        Config &handler_cpus(const std::vector<cpu_list_t> &x) {
+            _handler_cpus = x;
+            return *this;
         }
     };
 
@@ -199,36 +635,62 @@ class MsgNetwork: public ConnPool {
             ConnPool(ec, config),
             max_msg_size(config._max_msg_size),
             max_msg_queue_size(config._max_msg_queue_size),
+            max_stream_size(config._max_stream_size),
+            stream_frame_size(config._stream_frame_size ? config._stream_frame_size :
+                std::max(max_msg_size, stream_frame_header_size + 1) -
+                    stream_frame_header_size),
+            batch_enabled(config._batch_enabled),
+            batch_opcode(config._batch_opcode),
+            batch_window_ns(config._batch_enabled ?
+                uint64_t(config._batch_window * 1e9) : 0),
+            nhandler(config._nhandler),
+            handler_shard(config._handler_shard),
+            handler_rr(0),
+            checksum_type(config._checksum_type),
             msg_magic(config._msg_magic) {
-        incoming_msgs.set_capacity(max_msg_queue_size);
-        incoming_msgs.reg_handler(ec, [this, burst_size=config._burst_size](queue_t &q) {
-            std::pair<Msg, conn_t> item;
-            size_t cnt = 0;
-            while (q.try_dequeue(item) && this->system_state == 1)
-            {
-                auto &msg = item.first;
-                auto &conn = item.second;
-                auto it = handler_map.find(msg.get_opcode());
-                if (it == handler_map.end())
-                    SALTICIDAE_LOG_WARN("unknown opcode: %s",
-                                        get_hex(msg.get_opcode()).c_str());
-                else /* call the handler */
-                {
-                    SALTICIDAE_LOG_DEBUG("got message %s from %s",
-                            std::string(msg).c_str(),
-                            std::string(*conn).c_str());
+        if (checksum_type == CHECKSUM_NONE && !this->enable_tls)
+            throw SalticidaeError(SALTI_ERROR_CHECKSUM_WITHOUT_TLS);
+        auto nworker = this->get_nworker();
 #ifdef SALTICIDAE_MSG_STAT
-                    conn->nrecv++;
-                    conn->nrecvb += msg.get_length();
+        recv_stats = new PaddedStat<RecvStat>[nworker];
+        handler_stats = new PaddedStat<HandlerStat>[nhandler + 1];
 #endif
-                    it->second(msg, conn);
-                }
-                if (++cnt == burst_size) return true;
-            }
-            return false;
+#ifdef SALTICIDAE_MSG_TRACE
+        handler_traces = new PaddedStat<HandlerTrace>[nhandler + 1];
+#endif
+        incoming_msgs.set_capacity(max_msg_queue_size);
+        incoming_msgs.set_spin_time(this->queue_spin_time);
+        incoming_msgs.reg_handler(ec, [this, burst_size=config._burst_size,
+                                    batch=batch_t(), burst=burst_t()](queue_t &q) mutable {
+            return process_incoming(q, batch, burst, burst_size, 0);
         });
+        if (!nhandler) return;
+        handler_threads = new HandlerThread[nhandler];
+        for (size_t i = 0; i < nhandler; i++)
+        {
+            auto &t = handler_threads[i];
+            t.tcall = new ThreadCall(t.ec);
+            t.tcall->set_spin_time(this->queue_spin_time);
+            t.incoming_msgs = new queue_t[nworker];
+            for (size_t j = 0; j < nworker; j++)
+            {
+                auto &q = t.incoming_msgs[j];
+                /* most of the queues stay short */
+                q.set_capacity(max_msg_queue_size, true);
+                q.set_spin_time(this->queue_spin_time);
+                q.reg_handler(t.ec, [this, burst_size=config._burst_size,
+                                    batch=batch_t(), burst=burst_t(),
+                                    ctx=i + 1](queue_t &q) mutable {
+                    return process_incoming(q, batch, burst, burst_size, ctx);
+                });
+            }
+            if (!config._handler_cpus.empty())
+                t.cpus = config._handler_cpus[i % config._handler_cpus.size()];
+        }
     }
 
+    /** Register the handler of a message type (only to be called before
+     * start(), as the handlers are then read by the handler threads). */
     template<typename Func>
     typename std::enable_if<std::is_constructible<
         typename callback_traits<
@@ -245,17 +707,139 @@ class MsgNetwork: public ConnPool {
 
     template<typename Func>
     inline void set_handler(OpcodeType opcode, Func &&handler) {
-        handler_map[opcode] = std::forward<Func>(handler);
+        auto &h = handler_map[opcode];
+        if (!h.first) h.second = handler_map.size() - 1;
+        h.first = std::forward<Func>(handler);
+    }
+
+    /** Register a handler that takes each run of consecutive messages with
+     * the opcode drained from the queue in one round (at most burst_size of
+     * them, possibly from different connections, in order), instead of
+     * being called once per message. The messages and the connections are
+     * only valid during the call (only to be called before start()). */
+    template<typename Func>
+    void reg_burst_handler(OpcodeType opcode, Func &&handler) {
+        burst_handler_t h = std::forward<Func>(handler);
+        set_handler(opcode, [h](const Msg &msg, const conn_t &conn) {
+            const Msg *msgs[] = {&msg};
+            const conn_t *conns[] = {&conn};
+            h(msgs, conns, 1);
+        });
+        burst_handler_map[opcode] = std::move(h);
     }
 
+    /** Set the priority of the messages with the opcode (only to be called
+     * before start()). A message is queued behind those of higher priority
+     * to the same connection, but never split by them once it is being
+     * sent. */
+    void set_send_priority(OpcodeType opcode, SendPriority prio) {
+        if (prio == SEND_PRIO_NORMAL)
+            send_prio_map.erase(opcode);
+        else
+            send_prio_map[opcode] = prio;
+    }
+
+    SendPriority get_send_priority(OpcodeType opcode) const {
+        if (send_prio_map.empty()) return SEND_PRIO_NORMAL;
+        auto it = send_prio_map.find(opcode);
+        return it == send_prio_map.end() ? SEND_PRIO_NORMAL : it->second;
+    }
+
+    /** Reassemble the streamed messages with the opcode (see
+     * send_msg_stream()) in the workers, so its handler gets them whole as
+     * usual (only to be called before start()). */
+    void enable_stream_reassembly(OpcodeType opcode) {
+        stream_opcodes.insert(opcode);
+    }
+
+    /** Register a handler called with each frame of the streamed messages
+     * with the opcode, in order, so they are never held as a whole. */
+    template<typename Func>
+    void reg_stream_handler(OpcodeType opcode, Func &&handler) {
+        set_handler(opcode,
+            [handler=std::forward<Func>(handler)](const Msg &msg, const conn_t &conn) {
+            StreamChunk chunk;
+            if (!parse_stream_frame(msg.get_payload(), chunk))
+            {
+                SALTICIDAE_LOG_WARN("invalid stream frame from %s",
+                                    std::string(*conn).c_str());
+                return;
+            }
+            handler(std::move(chunk), conn);
+        });
+    }
+
+    template<typename MsgType>
+    inline bool send_msg(MsgType &&msg, const conn_t &conn);
+    /** Send the message with the priority instead of that of its opcode. */
     template<typename MsgType>
-    inline bool send_msg(const MsgType &msg, const conn_t &conn);
+    inline bool send_msg(MsgType &&msg, const conn_t &conn, SendPriority prio);
     inline bool _send_msg(const Msg &msg, const conn_t &conn);
+    inline bool _send_msg(Msg &&msg, const conn_t &conn);
+    inline bool _send_msg(const Msg &msg, const conn_t &conn, SendPriority prio);
+    inline bool _send_msg(Msg &&msg, const conn_t &conn, SendPriority prio);
+    /* send a message given its serialized header and shared payload */
+    inline bool _send_msg(const Msg &msg, bytearray_t &&header,
+                        const ArcObj<const bytearray_t> &payload, const conn_t &conn);
+    /** Send the message to each connection, serializing it once and
+     * sharing its payload. Return false if any of them could not take it
+     * (the others still do). */
+    template<typename MsgType>
+    inline bool multicast_msg(MsgType &&msg, const std::vector<conn_t> &conns);
+    inline bool _multicast_msg(Msg &&msg, const std::vector<conn_t> &conns);
+    /** Queue the message from the calling thread like send_msg(), but
+     * report a failure to the error callback under the returned id instead
+     * of returning it. */
     template<typename MsgType>
     inline int32_t send_msg_deferred(MsgType &&msg, const conn_t &conn);
     inline int32_t _send_msg_deferred(Msg &&msg, const conn_t &conn);
+    /** Send a message of any length as frames that fit max_msg_size. The
+     * frames are queued at once without copying the payload, with
+     * SEND_PRIO_LOW unless the opcode has its own priority, so other
+     * messages to the connection still go out in between. The receiver
+     * either reassembles them or passes each frame to its handler (see
+     * enable_stream_reassembly() and reg_stream_handler()). */
+    template<typename MsgType>
+    inline bool send_msg_stream(MsgType &&msg, const conn_t &conn);
+    inline bool _send_msg_stream(Msg &&msg, const conn_t &conn);
+
+#ifdef SALTICIDAE_MSG_STAT
+    /** Take a snapshot of the statistics (blocks until the dispatcher
+     * collects the connections). */
+    Stat get_stat();
+#endif
+#ifdef SALTICIDAE_MSG_TRACE
+    /** Take a snapshot of the latency traces of each registered opcode. */
+    std::vector<std::pair<OpcodeType, OpcodeTrace>> get_trace() const;
+#endif
 
-    void stop() { stop_workers(); }
+    void start() {
+        if (this->system_state) return;
+        /* the messages delivered before the handler threads run wait in
+         * their queues */
+        ConnPool::start();
+        /* the handler threads are spawned here, not in the constructor, so
+         * they never run while the handlers are being registered, and they
+         * see the running state */
+        for (size_t i = 0; i < nhandler; i++)
+        {
+            auto &t = handler_threads[i];
+            t.handle = std::thread([&t, i]() {
+                sigset_t mask;
+                sigfillset(&mask);
+                pthread_sigmask(SIG_BLOCK, &mask, NULL);
+                if (!set_thread_affinity(t.cpus))
+                    SALTICIDAE_LOG_WARN("failed to set the cpu affinity of handler %zu", i);
+                t.ec.dispatch();
+            });
+        }
+    }
+
+    void stop() {
+        /* handlers may still talk to the workers, so stop them first */
+        stop_handler_threads();
+        stop_workers();
+    }
     using ConnPool::listen;
     conn_t connect_sync(const NetAddr &addr) {
         return static_pointer_cast<Conn>(ConnPool::connect_sync(addr));
@@ -296,8 +880,9 @@ class ClientNetwork: public MsgNetwork<OpcodeType> {
 
     using MsgNet::send_msg;
     template<typename MsgType>
-    inline bool send_msg(const MsgType &msg, const NetAddr &addr);
+    inline bool send_msg(MsgType &&msg, const NetAddr &addr);
     inline bool _send_msg(const Msg &msg, const NetAddr &addr);
+    inline bool _send_msg(Msg &&msg, const NetAddr &addr);
     template<typename MsgType>
     inline int32_t send_msg_deferred(MsgType &&msg, const NetAddr &addr);
     inline int32_t _send_msg_deferred(Msg &&msg, const NetAddr &addr);
@@ -358,12 +943,23 @@ class PeerNetwork: public MsgNetwork<OpcodeType> {
         friend PeerNetwork;
         Peer *peer;
         /* initialized and destroyed by the worker */
-        TimerEvent ev_timeout;
-
-        void reset_timeout(double timeout);
+        TimerWheel::Timer ev_timeout;
+        /* pushed back by any thread, and only checked by the worker when
+         * ev_timeout expires */
+        std::atomic<uint64_t> timeout_deadline;
+        /* the senders by peer id writing to this connection (see ConnPin) */
+        std::atomic<size_t> nsender;
+        /* set by finish_handshake() once the connection is being replaced */
+        std::atomic<bool> handed_over;
+
+        void reset_timeout(double timeout) {
+            timeout_deadline.store(get_monotonic_ns() + uint64_t(timeout * 1e9),
+                                    std::memory_order_relaxed);
+        }
 
         public:
-        Conn(): MsgNet::Conn(), peer(nullptr) {}
+        Conn(): MsgNet::Conn(), peer(nullptr), timeout_deadline(0),
+            nsender(0), handed_over(false) {}
         NetAddr get_peer_addr() {
             auto ret = *(static_cast<NetAddr *>(
                 get_net()->disp_tcall->call([this](ThreadCall::Handle &h) {
@@ -408,7 +1004,7 @@ class PeerNetwork: public MsgNetwork<OpcodeType> {
         conn_t inbound_conn;
         conn_t outbound_conn;
 
-        TimerEvent ev_ping_timer;
+        TimerWheel::Timer ev_ping_timer;
         bool ping_timer_ok;
         bool pong_msg_ok;
         double ping_period;
@@ -424,8 +1020,8 @@ class PeerNetwork: public MsgNetwork<OpcodeType> {
             nonce(passive_nonce),
             id_hex(get_hex10(id)),
             retry_delay(0), ntry(0), cur_ntry(0),
-            ev_ping_timer(
-                TimerEvent(pn->disp_ec, std::bind(&Peer::ping_timer, this, _1))),
+            ev_ping_timer(*pn->disp_timer_wheel,
+                std::bind(&Peer::ping_timer, this, _1)),
             ping_period(pn->ping_period),
             state(DISCONNECTED) {}
 
@@ -434,7 +1030,7 @@ class PeerNetwork: public MsgNetwork<OpcodeType> {
 
         void reset_ping_timer();
         void send_ping();
-        void ping_timer(TimerEvent &);
+        void ping_timer(TimerWheel::Timer &);
         void clear_all_events() {
             if (ev_ping_timer)
                 ev_ping_timer.del();
@@ -459,13 +1055,34 @@ class PeerNetwork: public MsgNetwork<OpcodeType> {
 
     /* connections whose PeerId is unknown */
     std::unordered_map<NetAddr, conn_t> pending_peers;
-    /* registered peers */
+    /* registered peers (only accessed by the dispatcher) */
     std::unordered_map<PeerId, BoxObj<Peer>> known_peers;
-
-    using pinfo_slock_t = std::shared_lock<std::shared_timed_mutex>;
-    using pinfo_ulock_t = std::unique_lock<std::shared_timed_mutex>;
-
-    mutable std::shared_timed_mutex known_peers_lock;
+    /* the connection of each registered peer, looked up by the senders
+     * without locking or going through the dispatcher; a peer is added and
+     * removed by the caller of add_peer() and del_peer(), so lookups
+     * follow the order of these calls */
+    SnapshotMap<PeerId, conn_t> peer_conns;
+
+    /* the connection of a peer, which is not handed over to a new one by
+     * finish_handshake() until the pin is dropped, so a sender by peer id
+     * never writes to a connection that has already been drained */
+    class ConnPin {
+        conn_t conn;
+        bool pinned;
+        public:
+        /* without `wait`, the pin fails (is_pinned() is false) instead of
+         * waiting for a connection being replaced */
+        ConnPin(const PeerNetwork *pn, const PeerId &pid, bool wait = true);
+        ConnPin(const ConnPin &) = delete;
+        ConnPin(ConnPin &&other): conn(other.conn), pinned(other.pinned) {
+            other.pinned = false;
+        }
+        ~ConnPin() {
+            if (pinned) conn->nsender.fetch_sub(1, std::memory_order_release);
+        }
+        const conn_t &get() const { return conn; }
+        bool is_pinned() const { return pinned; }
+    };
 
     peer_callback_t peer_cb;
     unknown_peer_callback_t unknown_peer_cb;
@@ -515,14 +1132,15 @@ class PeerNetwork: public MsgNetwork<OpcodeType> {
     void finish_handshake(Peer *peer);
     void replace_pending_conn(const conn_t &conn);
     void start_active_conn(Peer *peer);
-    static void tcall_reset_timeout(ConnPool::Worker *worker,
-                                    const conn_t &conn, double timeout);
     inline conn_t _get_peer_conn(const PeerId &peer) const;
 
     protected:
     ConnPool::Conn *create_conn() override { return new Conn(); }
     void on_worker_setup(const ConnPool::conn_t &) override;
     void on_worker_teardown(const ConnPool::conn_t &) override;
+    void on_worker_detach(const ConnPool::conn_t &) override;
+    void on_worker_attach(const ConnPool::conn_t &) override;
+    void setup_timeout(const conn_t &conn);
     void on_dispatcher_setup(const ConnPool::conn_t &) override;
     void on_dispatcher_teardown(const ConnPool::conn_t &) override;
 
@@ -596,6 +1214,10 @@ class PeerNetwork: public MsgNetwork<OpcodeType> {
         }
         this->reg_handler(generic_bind(&PeerNetwork::ping_handler, this, _1, _2));
         this->reg_handler(generic_bind(&PeerNetwork::pong_handler, this, _1, _2));
+        /* the heartbeats do not wait behind bulk transfers, which could
+         * otherwise time out a busy connection */
+        this->set_send_priority(OPCODE_PING, SEND_PRIO_HIGH);
+        this->set_send_priority(OPCODE_PONG, SEND_PRIO_HIGH);
     }
 
     virtual ~PeerNetwork() { this->stop(); }
@@ -608,19 +1230,34 @@ class PeerNetwork: public MsgNetwork<OpcodeType> {
     int32_t set_peer_addr(const PeerId &peer, const NetAddr &addr);
     /* try to connect to the peer: once (ntry = 1), indefinitely (ntry = -1), give up retry (ntry = 0) */
     int32_t conn_peer(const PeerId &peer, int32_t ntry = -1, double retry_delay = 2);
-    /* check if a peer is registered */
+    /* check if a peer is registered (does not block) */
     bool has_peer(const PeerId &peer) const;
 
     const PeerId &get_peer_id() const { return id; }
     size_t get_npending() const;
+    /** The current connection to the peer. Unlike a send by peer id, a
+     * message written to it directly is lost if the connection is being
+     * replaced. */
     conn_t get_peer_conn(const PeerId &addr) const;
     using MsgNet::send_msg;
     template<typename MsgType>
-    inline bool send_msg(const MsgType &msg, const PeerId &peer);
+    inline bool send_msg(MsgType &&msg, const PeerId &peer);
+    template<typename MsgType>
+    inline bool send_msg(MsgType &&msg, const PeerId &peer, SendPriority prio);
     inline bool _send_msg(const Msg &msg, const PeerId &peer);
+    inline bool _send_msg(Msg &&msg, const PeerId &peer);
+    inline bool _send_msg(Msg &&msg, const PeerId &peer, SendPriority prio);
+    using MsgNet::send_msg_stream;
+    template<typename MsgType>
+    inline bool send_msg_stream(MsgType &&msg, const PeerId &peer);
+    inline bool _send_msg_stream(Msg &&msg, const PeerId &peer);
+    /* the deferred and multicast variants queue the messages from the
+     * calling thread as well, and report failures to the error callback */
     template<typename MsgType>
     inline int32_t send_msg_deferred(MsgType &&msg, const PeerId &peer);
     inline int32_t _send_msg_deferred(Msg &&msg, const PeerId &peer);
+    using MsgNet::multicast_msg;
+    using MsgNet::_multicast_msg;
     template<typename MsgType>
     inline int32_t multicast_msg(MsgType &&msg, const std::vector<PeerId> &peers);
     inline int32_t _multicast_msg(Msg &&msg, const std::vector<PeerId> &peers);
@@ -633,6 +1270,178 @@ class PeerNetwork: public MsgNetwork<OpcodeType> {
     void reg_peer_handler(Func &&cb) { peer_cb = std::forward<Func>(cb); }
 };
 
+/* this callback is run by the thread that runs the handlers */
+template<typename OpcodeType>
+bool MsgNetwork<OpcodeType>::process_incoming(
+        queue_t &q, batch_t &batch, burst_t &burst, size_t burst_size, size_t ctx) {
+#ifdef SALTICIDAE_MSG_STAT
+    auto &hstat = handler_stats[ctx];
+#endif
+    (void)ctx;
+    size_t cnt = 0;
+    /* keep draining, so messages enqueued while handling the previous
+     * batch are still handled in this round */
+    while (cnt < burst_size && this->system_state == 1)
+    {
+        /* leftovers from an interrupted round are dropped */
+        batch.clear();
+        auto n = q.try_dequeue_bulk(std::back_inserter(batch), burst_size - cnt);
+        if (!n) break;
+        cnt += n;
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            if (this->system_state != 1) break;
+            auto &msg = batch[i].msg;
+            auto &conn = batch[i].conn;
+            auto it = handler_map.find(msg.get_opcode());
+            if (it == handler_map.end())
+            {
+                SALTICIDAE_LOG_WARN("unknown opcode: %s",
+                                    get_hex(msg.get_opcode()).c_str());
+#ifdef SALTICIDAE_MSG_STAT
+                hstat.nunknown.add();
+#endif
+                continue;
+            }
+            /* the run of messages taken by the handler */
+            size_t nrun = 1;
+            const burst_handler_t *bh = nullptr;
+            if (!burst_handler_map.empty())
+            {
+                auto bit = burst_handler_map.find(msg.get_opcode());
+                if (bit != burst_handler_map.end())
+                {
+                    bh = &bit->second;
+                    while (i + nrun < batch.size() &&
+                            batch[i + nrun].msg.get_opcode() == msg.get_opcode())
+                        nrun++;
+                }
+            }
+            SALTICIDAE_LOG_DEBUG("got message %s from %s",
+                    std::string(msg).c_str(),
+                    std::string(*conn).c_str());
+#ifdef SALTICIDAE_MSG_STAT
+            for (size_t j = i; j < i + nrun; j++)
+            {
+                batch[j].conn->nrecv++;
+                batch[j].conn->nrecvb += batch[j].msg.get_length();
+            }
+#endif
+#if defined(SALTICIDAE_MSG_STAT) || defined(SALTICIDAE_MSG_TRACE)
+            auto t0 = get_monotonic_ns();
+#endif
+            /* call the handler */
+            if (bh)
+            {
+                burst.msgs.clear();
+                burst.conns.clear();
+                for (size_t j = i; j < i + nrun; j++)
+                {
+                    burst.msgs.push_back(&batch[j].msg);
+                    burst.conns.push_back(&batch[j].conn);
+                }
+                (*bh)(burst.msgs.data(), burst.conns.data(), nrun);
+            }
+            else
+                it->second.first(msg, conn);
+#if defined(SALTICIDAE_MSG_STAT) || defined(SALTICIDAE_MSG_TRACE)
+            auto t1 = get_monotonic_ns();
+            auto idx = std::min(it->second.second, stat_nopcode - 1);
+            /* the time of a run is split evenly among its messages */
+            uint64_t nsec = (t1 - t0) / nrun;
+            for (size_t j = i; j < i + nrun; j++)
+            {
+                auto &item = batch[j];
+#ifdef SALTICIDAE_MSG_TRACE
+                auto &trace = handler_traces[ctx].get(idx);
+                trace.parse_delay.add(item.enqueue_ts - item.recv_ts);
+                trace.queue_delay.add(t0 - item.enqueue_ts);
+                trace.handler_time.add(nsec);
+                trace.total.add(t0 + nsec - item.recv_ts);
+#endif
+#ifdef SALTICIDAE_MSG_STAT
+                auto &ostat = hstat.opcodes[idx];
+                hstat.nmsg.add();
+                hstat.latency.add(nsec);
+                ostat.nmsg.add();
+                ostat.nbytes.add(item.msg.get_length());
+                ostat.nsec.add(nsec);
+#endif
+            }
+#endif
+            i += nrun - 1;
+        }
+    }
+    batch.clear();
+    return cnt == burst_size;
+}
+
+#ifdef SALTICIDAE_MSG_STAT
+template<typename OpcodeType>
+typename MsgNetwork<OpcodeType>::Stat MsgNetwork<OpcodeType>::get_stat() {
+    Stat stat;
+    /* the slots are read without stopping their owners */
+    for (size_t i = 0; i < this->get_nworker(); i++)
+    {
+        stat.worker_io.push_back(this->get_worker_io_stat(i));
+        stat.io += stat.worker_io.back();
+        stat.worker_recv.push_back(recv_stats[i]);
+        stat.recv += stat.worker_recv.back();
+    }
+    for (size_t i = 0; i <= nhandler; i++)
+    {
+        stat.handler.push_back(handler_stats[i]);
+        stat.handler_total += stat.handler.back();
+    }
+    for (const auto &h: handler_map)
+        stat.opcodes.push_back(std::make_pair(h.first,
+            stat.handler_total.opcodes[std::min(h.second.second, stat_nopcode - 1)]));
+    if (this->system_state != 1) return stat;
+    /* the connections are owned by the dispatcher */
+    stat.conns = std::move(*(static_cast<std::vector<ConnStat> *>(
+        this->disp_tcall->call([this](ThreadCall::Handle &h) {
+            std::vector<ConnStat> conns;
+            this->for_each_conn([&conns](const ConnPool::conn_t &_conn) {
+                auto conn = static_pointer_cast<Conn>(_conn);
+                ConnStat cs;
+                cs.addr = conn->get_addr();
+                cs.mode = conn->get_mode();
+                cs.nsent = conn->get_nsent();
+                cs.nrecv = conn->get_nrecv();
+                cs.nsentb = conn->get_nsentb();
+                cs.nrecvb = conn->get_nrecvb();
+                cs.send_queue_len = conn->get_send_queue_len();
+                cs.recv_buff_size = conn->get_recv_buff_size();
+                cs.kernel_send_queue = conn->get_kernel_send_queue();
+                cs.kernel_recv_queue = conn->get_kernel_recv_queue();
+                conns.push_back(std::move(cs));
+            });
+            h.set_result(std::move(conns));
+        }).get())));
+    return stat;
+}
+#endif
+
+#ifdef SALTICIDAE_MSG_TRACE
+template<typename OpcodeType>
+std::vector<std::pair<OpcodeType, typename MsgNetwork<OpcodeType>::OpcodeTrace>>
+MsgNetwork<OpcodeType>::get_trace() const {
+    std::vector<std::pair<OpcodeType, OpcodeTrace>> res;
+    for (const auto &h: handler_map)
+    {
+        OpcodeTrace trace;
+        auto idx = std::min(h.second.second, stat_nopcode - 1);
+        for (size_t i = 0; i <= nhandler; i++)
+        {
+            auto p = handler_traces[i].opcodes[idx].load(std::memory_order_acquire);
+            if (p) trace += *p;
+        }
+        res.push_back(std::make_pair(h.first, std::move(trace)));
+    }
+    return res;
+}
+#endif
+
 /* this callback is run by a worker */
 template<typename OpcodeType>
 void MsgNetwork<OpcodeType>::on_read(const ConnPool::conn_t &_conn) {
@@ -644,11 +1453,27 @@ void MsgNetwork<OpcodeType>::on_read(const ConnPool::conn_t &_conn) {
     auto &msg_state = conn->msg_state;
     while (true)
     {
+        /* the rest of a batch frame goes before anything else */
+        auto &unbatched = conn->unbatched;
+        if (conn->unbatched_idx < unbatched.size())
+        {
+            msg = std::move(unbatched[conn->unbatched_idx++]);
+            if (conn->unbatched_idx == unbatched.size())
+            {
+                unbatched.clear();
+                conn->unbatched_idx = 0;
+            }
+            if (!deliver(conn)) return;
+            continue;
+        }
         if (msg_state == Conn::HEADER)
         {
-            if (recv_buffer.size() < Msg::header_size) break;
+            uint8_t header_scratch[Msg::header_size];
+            auto header = recv_buffer.peek(Msg::header_size, header_scratch);
+            if (!header) break;
             /* new header available */
-            msg = Msg(recv_buffer.pop(Msg::header_size));
+            msg = Msg(header);
+            recv_buffer.skip(Msg::header_size);
             if (msg.get_length() > max_msg_size)
             {
                 SALTICIDAE_LOG_WARN(
@@ -666,58 +1491,247 @@ void MsgNetwork<OpcodeType>::on_read(const ConnPool::conn_t &_conn) {
             msg.set_payload(recv_buffer.pop(len));
             msg_state = Conn::HEADER;
 #ifndef SALTICIDAE_NOCHECKSUM
-            if (!msg.verify_checksum())
+            if (!msg.verify_checksum(checksum_type))
             {
                 SALTICIDAE_LOG_WARN("checksums do not match, dropping the message");
+#ifdef SALTICIDAE_MSG_STAT
+                get_recv_stat(conn).nchecksum_fail.add();
+#endif
                 break;
             }
 #endif
-            if (!incoming_msgs.enqueue(std::make_pair(msg, conn), false))
+            if (batch_enabled && msg.get_opcode() == batch_opcode)
             {
-                conn->msg_sleep = true;
-                conn->ev_enqueue_poll.add(0);
-                return;
+                unbatch(conn, msg);
+                continue;
             }
+            if (!deliver(conn)) return;
         }
     }
     if (conn->ready_recv && recv_buffer.len() < conn->max_recv_buff_size)
     {
-        /* resume reading from socket */
-        conn->ev_socket.del();
-        conn->ev_socket.add(FdEvent::READ |
-                            (conn->ready_send ? 0: FdEvent::WRITE));
-        conn->recv_data_func(conn, conn->fd, FdEvent::READ);
+        /* resume reading from socket (not polled with io_uring) */
+        if (conn->ev_socket)
+        {
+            conn->ev_socket.del();
+            conn->ev_socket.add(FdEvent::READ |
+                                (conn->ready_send ? 0: FdEvent::WRITE));
+        }
+        /* a plain socket is left to the READ event, so a sender that keeps
+         * the buffer full does not nest the calls, while TLS may have
+         * decrypted bytes the event does not report */
+        if (conn->ev_socket && !conn->tls)
+            conn->ready_recv = false;
+        else
+            conn->recv_data_func(conn, conn->fd, FdEvent::READ);
     }
 }
 
+/* this function is run by a worker */
+template<typename OpcodeType>
+bool MsgNetwork<OpcodeType>::deliver(const conn_t &conn) {
+    auto &msg = conn->msg;
+    if (!stream_opcodes.empty() &&
+        stream_opcodes.count(msg.get_opcode()) &&
+        !reassemble_stream(conn, msg))
+        return true;
+#ifdef SALTICIDAE_MSG_STAT
+    size_t len = msg.get_length();
+#endif
+    auto &q = get_incoming_queue(conn, msg);
+    incoming_t item(std::move(msg), conn);
+#ifdef SALTICIDAE_MSG_TRACE
+    trace_enqueue(item, conn->recv_ts);
+#endif
+    if (!q.enqueue(std::move(item), false))
+    {
+        msg = std::move(item.msg);
+#ifdef SALTICIDAE_MSG_TRACE
+        conn->msg_recv_ts = item.recv_ts;
+#endif
+        conn->msg_sleep = true;
+        conn->ev_enqueue_poll.add(0);
+#ifdef SALTICIDAE_MSG_STAT
+        get_recv_stat(conn).nqueue_full.add();
+#endif
+        return false;
+    }
+#ifdef SALTICIDAE_MSG_STAT
+    auto &recv_stat = get_recv_stat(conn);
+    recv_stat.nmsg.add();
+    recv_stat.nbytes.add(len);
+#endif
+    return true;
+}
+
+/* this function is run by a worker */
+template<typename OpcodeType>
+void MsgNetwork<OpcodeType>::unbatch(const conn_t &conn, Msg &msg) {
+    /* every message is its opcode, its length and its payload, sharing the
+     * magic and the checksum of the frame */
+    DataStream s(msg.get_payload());
+    auto &unbatched = conn->unbatched;
+    while (s.size())
+    {
+        if (s.size() < batch_entry_header_size)
+            throw MsgNetworkError(SALTI_ERROR_CONN_BAD_BATCH);
+        OpcodeType opcode;
+        uint32_t len;
+        s >> opcode >> len;
+        len = letoh(len);
+        if (s.size() < len)
+            throw MsgNetworkError(SALTI_ERROR_CONN_BAD_BATCH);
+        auto data = s.get_data_inplace(len);
+        unbatched.emplace_back(msg.get_magic());
+        auto &m = unbatched.back();
+        m.set_opcode(opcode);
+        m.set_payload(bytearray_t(data, data + len));
+    }
+#ifdef SALTICIDAE_MSG_STAT
+    get_recv_stat(conn).nbatch.add();
+#endif
+}
+
+template<typename OpcodeType>
+bool MsgNetwork<OpcodeType>::parse_stream_frame(DataStream &&s, StreamChunk &chunk) {
+    if (s.size() < stream_frame_header_size) return false;
+    s >> chunk.stream_id >> chunk.total >> chunk.offset;
+    chunk.stream_id = letoh(chunk.stream_id);
+    chunk.total = letoh(chunk.total);
+    chunk.offset = letoh(chunk.offset);
+    if (chunk.offset > chunk.total ||
+        chunk.total - chunk.offset < s.size())
+        return false;
+    chunk.data = std::move(s);
+    return true;
+}
+
+/* this function is run by a worker */
+template<typename OpcodeType>
+bool MsgNetwork<OpcodeType>::reassemble_stream(const conn_t &conn, Msg &msg) {
+    StreamChunk chunk;
+    if (!parse_stream_frame(msg.get_payload(), chunk))
+        throw MsgNetworkError(SALTI_ERROR_CONN_BAD_STREAM);
+    auto &streams = conn->streams;
+    auto it = streams.find(chunk.stream_id);
+    if (it == streams.end())
+    {
+        if (chunk.offset)
+            throw MsgNetworkError(SALTI_ERROR_CONN_BAD_STREAM);
+        /* a message in one frame is not buffered again */
+        if (chunk.is_last())
+        {
+            msg.set_payload(std::move(chunk.data));
+            return true;
+        }
+        if (chunk.total > max_stream_size - conn->stream_bytes)
+        {
+            SALTICIDAE_LOG_WARN(
+                    "oversized stream from %s, terminating the connection",
+                    std::string(*conn).c_str());
+            throw MsgNetworkError(SALTI_ERROR_CONN_OVERSIZED_MSG);
+        }
+        it = streams.emplace(chunk.stream_id, typename Conn::stream_t()).first;
+        it->second.total = chunk.total;
+        it->second.data.reserve(chunk.total);
+        conn->stream_bytes += chunk.total;
+    }
+    auto &st = it->second;
+    if (chunk.total != st.total || chunk.offset != st.data.size())
+        throw MsgNetworkError(SALTI_ERROR_CONN_BAD_STREAM);
+    st.data.insert(st.data.end(), chunk.data.data(),
+                    chunk.data.data() + chunk.data.size());
+    if (st.data.size() < st.total) return false;
+    conn->stream_bytes -= st.total;
+    msg.set_payload(std::move(st.data));
+    streams.erase(it);
+    return true;
+}
+
+template<typename OpcodeType>
+template<typename MsgType>
+inline bool MsgNetwork<OpcodeType>::send_msg_stream(MsgType &&msg, const conn_t &conn) {
+    return _send_msg_stream(Msg(std::forward<MsgType>(msg), msg_magic), conn);
+}
+
+template<typename OpcodeType>
+inline bool MsgNetwork<OpcodeType>::_send_msg_stream(Msg &&msg, const conn_t &conn) {
+    /* every frame has its own header but references the same payload */
+    ArcObj<const bytearray_t> payload = new bytearray_t(msg.get_payload());
+    const uint64_t total = payload->size();
+    const uint32_t id = conn->stream_seq.fetch_add(1, std::memory_order_relaxed);
+    auto it = send_prio_map.find(msg.get_opcode());
+    auto prio = it == send_prio_map.end() ? SEND_PRIO_LOW : it->second;
+    std::vector<MPSCWriteBuffer::buffer_entry_t> frames;
+    frames.reserve(total / stream_frame_size + 1);
+    uint64_t off = 0;
+    do {
+        size_t len = std::min(total - off, (uint64_t)stream_frame_size);
+        DataStream prefix;
+        prefix << htole(id) << htole(total) << htole(off);
+        frames.emplace_back(
+            msg.serialize_header(bytearray_t(std::move(prefix)),
+                                payload->data() + off, len, checksum_type),
+            payload, off, len);
+        off += len;
+    } while (off < total);
+    SALTICIDAE_LOG_DEBUG("wrote stream %u (%zu frames) of %s to %s",
+                id, frames.size(),
+                get_hex(msg.get_opcode()).c_str(),
+                std::string(*conn).c_str());
+#ifdef SALTICIDAE_MSG_STAT
+    conn->nsent += frames.size();
+    conn->nsentb += total + frames.size() * stream_frame_header_size;
+#endif
+    return conn->write(std::move(frames), prio);
+}
+
 template<typename OpcodeType>
 template<typename MsgType>
 inline int32_t MsgNetwork<OpcodeType>::send_msg_deferred(MsgType &&msg, const conn_t &conn) {
-    return _send_msg_deferred(Msg(std::move(msg), msg_magic), conn);
+    return _send_msg_deferred(Msg(std::forward<MsgType>(msg), msg_magic), conn);
 }
 
 template<typename OpcodeType>
 inline int32_t MsgNetwork<OpcodeType>::_send_msg_deferred(Msg &&msg, const conn_t &conn) {
     auto id = this->gen_async_id();
-    this->disp_tcall->async_call(
-            [this, msg=std::move(msg), conn, id](ThreadCall::Handle &) {
-        try {
-            if (!_send_msg(msg, conn))
-                throw SalticidaeError(SALTI_ERROR_CONN_NOT_READY);
-        } catch (...) { this->recoverable_error(std::current_exception(), id); }
-    });
+    /* the send buffer takes writes from any thread, so the dispatcher is
+     * not involved */
+    try {
+        if (!_send_msg(std::move(msg), conn))
+            throw SalticidaeError(SALTI_ERROR_CONN_NOT_READY);
+    } catch (...) { this->recoverable_error(std::current_exception(), id); }
     return id;
 }
 
 template<typename OpcodeType>
 template<typename MsgType>
-inline bool MsgNetwork<OpcodeType>::send_msg(const MsgType &msg, const conn_t &conn) {
-    return _send_msg(Msg(msg, msg_magic), conn);
+inline bool MsgNetwork<OpcodeType>::send_msg(MsgType &&msg, const conn_t &conn) {
+    return _send_msg(Msg(std::forward<MsgType>(msg), msg_magic), conn);
+}
+
+template<typename OpcodeType>
+template<typename MsgType>
+inline bool MsgNetwork<OpcodeType>::send_msg(MsgType &&msg, const conn_t &conn, SendPriority prio) {
+    return _send_msg(Msg(std::forward<MsgType>(msg), msg_magic), conn, prio);
 }
 
 template<typename OpcodeType>
 inline bool MsgNetwork<OpcodeType>::_send_msg(const Msg &msg, const conn_t &conn) {
-    bytearray_t msg_data = msg.serialize();
+    return _send_msg(msg, conn, get_send_priority(msg.get_opcode()));
+}
+
+template<typename OpcodeType>
+inline bool MsgNetwork<OpcodeType>::_send_msg(Msg &&msg, const conn_t &conn) {
+    auto prio = get_send_priority(msg.get_opcode());
+    return _send_msg(std::move(msg), conn, prio);
+}
+
+template<typename OpcodeType>
+inline bool MsgNetwork<OpcodeType>::_send_msg(const Msg &msg, const conn_t &conn, SendPriority prio) {
+    if (batch_window_ns) return _send_msg_batched(msg, conn, prio);
+    /* the header goes into its own segment, the payload is copied once */
+    bytearray_t header = msg.serialize_header(checksum_type);
     SALTICIDAE_LOG_DEBUG("wrote message %s to %s",
                 std::string(msg).c_str(),
                 std::string(*conn).c_str());
@@ -725,40 +1739,190 @@ inline bool MsgNetwork<OpcodeType>::_send_msg(const Msg &msg, const conn_t &conn
     conn->nsent++;
     conn->nsentb += msg.get_length();
 #endif
-    return conn->write(std::move(msg_data));
+    return conn->write(std::move(header), bytearray_t(msg.get_raw_payload()), prio);
 }
 
-template<typename O, O _, O __>
-void PeerNetwork<O, _, __>::tcall_reset_timeout(ConnPool::Worker *worker,
-                                    const conn_t &conn, double timeout) {
-    worker->get_tcall()->async_call([worker, conn, t=timeout](ThreadCall::Handle &) {
-        try {
-            if (!conn->ev_timeout) return;
-            conn->ev_timeout.del();
-            conn->ev_timeout.add(t);
-            SALTICIDAE_LOG_DEBUG("reset connection timeout %.2f", t);
-        } catch (...) { worker->error_callback(std::current_exception()); }
-    });
+template<typename OpcodeType>
+inline bool MsgNetwork<OpcodeType>::_send_msg(Msg &&msg, const conn_t &conn, SendPriority prio) {
+    if (batch_window_ns) return _send_msg_batched(msg, conn, prio);
+    /* the header goes into its own segment, the payload is queued as-is */
+    bytearray_t header = msg.serialize_header(checksum_type);
+    SALTICIDAE_LOG_DEBUG("wrote message %s to %s",
+                std::string(msg).c_str(),
+                std::string(*conn).c_str());
+#ifdef SALTICIDAE_MSG_STAT
+    conn->nsent++;
+    conn->nsentb += msg.get_length();
+#endif
+    return conn->write(std::move(header), bytearray_t(msg.get_payload()), prio);
+}
+
+template<typename OpcodeType>
+inline bool MsgNetwork<OpcodeType>::_send_msg(const Msg &msg, bytearray_t &&header,
+                        const ArcObj<const bytearray_t> &payload, const conn_t &conn) {
+    SALTICIDAE_LOG_DEBUG("wrote message %s to %s",
+                std::string(msg).c_str(),
+                std::string(*conn).c_str());
+#ifdef SALTICIDAE_MSG_STAT
+    conn->nsent++;
+    conn->nsentb += msg.get_length();
+#endif
+    auto prio = get_send_priority(msg.get_opcode());
+    if (batch_window_ns)
+    {
+        /* the staged messages go first */
+        mutex_lg_t _(conn->batch_mlock);
+        if (!flush_batch(conn)) return false;
+        conn->batch_flush_ts = get_monotonic_ns();
+        return conn->write(std::move(header), payload, prio);
+    }
+    return conn->write(std::move(header), payload, prio);
+}
+
+template<typename OpcodeType>
+template<typename MsgType>
+inline bool MsgNetwork<OpcodeType>::multicast_msg(MsgType &&msg, const std::vector<conn_t> &conns) {
+    return _multicast_msg(Msg(std::forward<MsgType>(msg), msg_magic), conns);
+}
+
+template<typename OpcodeType>
+inline bool MsgNetwork<OpcodeType>::_multicast_msg(Msg &&msg, const std::vector<conn_t> &conns) {
+    /* serialize once: every connection queues its own copy of the header
+     * but references the same payload buffer */
+    auto header = msg.serialize_header(checksum_type);
+    ArcObj<const bytearray_t> payload = new bytearray_t(msg.get_payload());
+    bool succ = true;
+    for (auto &conn: conns)
+        succ &= _send_msg(msg, bytearray_t(header), payload, conn);
+    return succ;
+}
+
+template<typename OpcodeType>
+inline bool MsgNetwork<OpcodeType>::flush_batch(const conn_t &conn) {
+    if (!conn->batch_nmsg) return true;
+    Msg msg(msg_magic);
+    msg.set_opcode(batch_opcode);
+    msg.set_payload(std::move(conn->batch));
+    conn->batch = DataStream();
+    auto nmsg = conn->batch_nmsg;
+    conn->batch_nmsg = 0;
+    conn->batch_flush_ts = get_monotonic_ns();
+    bytearray_t header = msg.serialize_header(checksum_type);
+    SALTICIDAE_LOG_DEBUG("wrote a batch of %zu messages (%zu bytes) to %s",
+                nmsg, msg.get_length(),
+                std::string(*conn).c_str());
+    if (conn->write(std::move(header), bytearray_t(msg.get_raw_payload()),
+                    conn->batch_prio))
+        return true;
+    /* the messages were accepted by send_msg(), so they stay staged */
+    conn->batch = msg.get_payload();
+    conn->batch_nmsg = nmsg;
+    return false;
+}
+
+template<typename OpcodeType>
+inline void MsgNetwork<OpcodeType>::flush_or_drop_batch(const conn_t &conn) {
+    if (flush_batch(conn)) return;
+    SALTICIDAE_LOG_WARN("dropped a batch of %zu messages to %s",
+                conn->batch_nmsg, std::string(*conn).c_str());
+    conn->batch = DataStream();
+    conn->batch_nmsg = 0;
+    this->recoverable_error(std::make_exception_ptr(
+        SalticidaeError(SALTI_ERROR_CONN_NOT_READY)), -1);
+}
+
+template<typename OpcodeType>
+inline bool MsgNetwork<OpcodeType>::_send_msg_batched(const Msg &msg, const conn_t &conn, SendPriority prio) {
+    const auto &payload = msg.get_raw_payload();
+    const size_t len = batch_entry_header_size + payload.size();
+    const bool fits = len <= max_msg_size;
+#ifdef SALTICIDAE_MSG_STAT
+    conn->nsent++;
+    conn->nsentb += msg.get_length();
+#endif
+    mutex_lg_t _(conn->batch_mlock);
+    auto &batch = conn->batch;
+    /* nobody would wake up for a connection without a worker (e.g. the
+     * placeholder of a peer that is not connected yet) */
+    if (!conn->get_worker())
+    {
+        bytearray_t header = msg.serialize_header(checksum_type);
+        return conn->write(std::move(header), bytearray_t(payload), prio);
+    }
+    /* a message that cannot join the staged ones has to follow them */
+    if (conn->batch_nmsg &&
+        (!fits || prio != conn->batch_prio || batch.size() + len > max_msg_size) &&
+        !flush_batch(conn))
+        return false;
+    auto now = get_monotonic_ns();
+    if (!fits || (!conn->batch_nmsg && now - conn->batch_flush_ts >= batch_window_ns))
+    {
+        /* the first message after a quiet period is not delayed */
+        conn->batch_flush_ts = now;
+        bytearray_t header = msg.serialize_header(checksum_type);
+        SALTICIDAE_LOG_DEBUG("wrote message %s to %s",
+                    std::string(msg).c_str(),
+                    std::string(*conn).c_str());
+        return conn->write(std::move(header), bytearray_t(payload), prio);
+    }
+    batch.reserve(len);
+    batch << msg.get_opcode() << htole((uint32_t)payload.size()) << payload;
+    if (conn->batch_nmsg++) return true;
+    conn->batch_prio = prio;
+    /* the worker writes whatever is staged by the time it wakes up (see
+     * on_send_wakeup()), so a batch costs one wakeup instead of a timer */
+    conn->send_buffer.get_queue().notify();
+    return true;
 }
 
 template<typename O, O _, O __>
-void PeerNetwork<O, _, __>::on_worker_setup(const ConnPool::conn_t &_conn) {
-    MsgNet::on_worker_setup(_conn);
-    auto conn = static_pointer_cast<Conn>(_conn);
-    auto worker = conn->worker;
-    auto &ev_timeout = conn->ev_timeout;
-    assert(!ev_timeout);
-    ev_timeout = TimerEvent(worker->get_ec(), [=](TimerEvent &) {
+void PeerNetwork<O, _, __>::setup_timeout(const conn_t &conn) {
+    conn->reset_timeout(conn_timeout);
+    conn->ev_timeout = TimerWheel::Timer(conn->get_worker()->get_timer_wheel(),
+                                        [=](TimerWheel::Timer &t) {
         try {
+            /* the deadline was pushed back since the timer was added */
+            auto now = get_monotonic_ns();
+            auto deadline = conn->timeout_deadline.load(std::memory_order_relaxed);
+            if (deadline > now)
+            {
+                t.add((deadline - now) / 1e9);
+                return;
+            }
             SALTICIDAE_LOG_INFO("%s%s%s: peer ping-pong timeout",
                 tty_secondary_color,
                 id_hex.c_str(),
                 tty_reset_color);
             this->worker_terminate(conn);
-        } catch (...) { worker->error_callback(std::current_exception()); }
+        } catch (...) { conn->get_worker()->error_callback(std::current_exception()); }
     });
 }
 
+template<typename O, O _, O __>
+void PeerNetwork<O, _, __>::on_worker_setup(const ConnPool::conn_t &_conn) {
+    MsgNet::on_worker_setup(_conn);
+    auto conn = static_pointer_cast<Conn>(_conn);
+    assert(!conn->ev_timeout);
+    setup_timeout(conn);
+    conn->ev_timeout.add(conn_timeout);
+}
+
+template<typename O, O _, O __>
+void PeerNetwork<O, _, __>::on_worker_detach(const ConnPool::conn_t &_conn) {
+    auto conn = static_pointer_cast<Conn>(_conn);
+    conn->ev_timeout.clear();
+    MsgNet::on_worker_detach(_conn);
+}
+
+template<typename O, O _, O __>
+void PeerNetwork<O, _, __>::on_worker_attach(const ConnPool::conn_t &_conn) {
+    auto conn = static_pointer_cast<Conn>(_conn);
+    /* the remaining time is lost, so give the peer a full timeout */
+    setup_timeout(conn);
+    conn->ev_timeout.add(conn_timeout);
+    MsgNet::on_worker_attach(_conn);
+}
+
 template<typename O, O _, O __>
 void PeerNetwork<O, _, __>::on_worker_teardown(const ConnPool::conn_t &_conn) {
     auto conn = static_pointer_cast<Conn>(_conn);
@@ -778,20 +1942,16 @@ void PeerNetwork<O, _, __>::on_dispatcher_setup(const ConnPool::conn_t &_conn) {
             id_hex.c_str(),
             tty_reset_color,
             std::string(*conn).c_str());
-    tcall_reset_timeout(conn->worker, conn, conn_timeout);
+    conn->reset_timeout(conn_timeout);
     if (conn->get_mode() == Conn::ConnMode::ACTIVE)
     {
         auto pid = get_peer_id(conn, conn->get_addr());
         auto it = known_peers.find(pid);
         if (it == known_peers.end())
             throw PeerNetworkError(SALTI_ERROR_PEER_NOT_MATCH);
-        else
-        {
-            pinfo_slock_t _g(known_peers_lock);
-            send_msg(MsgPing(
-                listen_addr,
-                it->second->get_nonce()), conn);
-        }
+        send_msg(MsgPing(
+            listen_addr,
+            it->second->get_nonce()), conn);
     }
     else
         replace_pending_conn(conn);
@@ -860,12 +2020,12 @@ void PeerNetwork<O, _, __>::Peer::send_ping() {
     auto pn = chosen_conn->get_net();
     ping_timer_ok = false;
     pong_msg_ok = false;
-    tcall_reset_timeout(chosen_conn->worker, chosen_conn, pn->conn_timeout);
+    chosen_conn->reset_timeout(pn->conn_timeout);
     pn->send_msg(MsgPing(), chosen_conn);
 }
 
 template<typename O, O _, O __>
-void PeerNetwork<O, _, __>::Peer::ping_timer(TimerEvent &) {
+void PeerNetwork<O, _, __>::Peer::ping_timer(TimerWheel::Timer &) {
     ping_timer_ok = true;
     if (pong_msg_ok)
     {
@@ -896,14 +2056,27 @@ void PeerNetwork<O, _, __>::finish_handshake(Peer *p) {
     {
         /* there is some previously terminated connection */
         assert(p->conn->is_terminated());
+        /* the senders by peer id that have pinned the old connection finish
+         * writing to it, and the later ones wait until the new one is
+         * published, so what they wrote is drained and goes out first */
+        old_conn->handed_over.store(true);
+        while (old_conn->nsender.load(std::memory_order_acquire))
+            std::this_thread::yield();
+        /* messages may have been staged since the teardown */
+        this->flush_staged(old_conn);
         for (;;)
         {
-            bytearray_t buff_seg = old_conn->send_buffer.move_pop();
-            if (!buff_seg.size()) break;
+            auto buff_seg = old_conn->send_buffer.move_pop();
+            if (!buff_seg.length()) break;
+            /* resend the whole segment even if it was partially sent */
+            buff_seg.offset = 0;
             new_conn->write(std::move(buff_seg));
         }
         old_conn->peer = nullptr;
     }
+    /* the senders switch to the new connection (unless the peer has been
+     * deleted meanwhile) */
+    peer_conns.replace(p->id, old_conn, new_conn);
     old_conn = new_conn;
     new_conn->peer = p;
     this->user_tcall->async_call([this, conn=p->conn](ThreadCall::Handle &) {
@@ -949,10 +2122,28 @@ void PeerNetwork<O, _, __>::start_active_conn(Peer *p) {
 
 template<typename O, O _, O __>
 inline typename PeerNetwork<O, _, __>::conn_t PeerNetwork<O, _, __>::_get_peer_conn(const PeerId &pid) const {
-    auto it = known_peers.find(pid);
-    if (it == known_peers.end())
+    conn_t conn;
+    if (!peer_conns.find(pid, conn))
         throw PeerNetworkError(SALTI_ERROR_PEER_NOT_EXIST);
-    return it->second->conn;
+    return conn;
+}
+
+template<typename O, O _, O __>
+PeerNetwork<O, _, __>::ConnPin::ConnPin(const PeerNetwork *pn, const PeerId &pid, bool wait): pinned(false) {
+    for (;;)
+    {
+        conn = pn->_get_peer_conn(pid);
+        conn->nsender.fetch_add(1);
+        if (!conn->handed_over.load())
+        {
+            pinned = true;
+            break;
+        }
+        conn->nsender.fetch_sub(1, std::memory_order_release);
+        if (!wait) break;
+        /* wait for finish_handshake() to publish the new connection */
+        std::this_thread::yield();
+    }
 }
 /* end: functions invoked by the dispatcher */
 
@@ -967,7 +2158,6 @@ void PeerNetwork<O, _, __>::ping_handler(MsgPing &&msg, const conn_t &conn) {
                 if (conn->get_mode() == Conn::ConnMode::PASSIVE)
                 {
                     auto pid = get_peer_id(conn, msg.claimed_addr);
-                    pinfo_slock_t _g(known_peers_lock);
                     auto pit = known_peers.find(pid);
                     if (pit == known_peers.end())
                     {
@@ -1040,7 +2230,6 @@ void PeerNetwork<O, _, __>::pong_handler(MsgPong &&msg, const conn_t &conn) {
                 if (conn->get_mode() == Conn::ConnMode::ACTIVE)
                 {
                     auto pid = get_peer_id(conn, conn->get_addr());
-                    pinfo_slock_t _g(known_peers_lock);
                     auto pit = known_peers.find(pid);
                     if (pit == known_peers.end())
                     {
@@ -1124,15 +2313,22 @@ void PeerNetwork<O, _, __>::listen(NetAddr _listen_addr) {
 template<typename O, O _, O __>
 int32_t PeerNetwork<O, _, __>::add_peer(const PeerId &pid) {
     auto id = this->gen_async_id();
-    this->disp_tcall->async_call([this, pid, id](ThreadCall::Handle &) {
+    /* messages sent before the peer connects are queued by this
+     * placeholder, until finish_handshake() moves them */
+    conn_t conn{new Conn()};
+    conn->cpool = this;
+    conn->set_terminated();
+    if (!peer_conns.insert(pid, conn))
+    {
+        this->recoverable_error(std::make_exception_ptr(
+            PeerNetworkError(SALTI_ERROR_PEER_ALREADY_EXISTS)), id);
+        return id;
+    }
+    this->disp_tcall->async_call([this, pid, conn, id](ThreadCall::Handle &) {
         try {
-            pinfo_ulock_t _g(known_peers_lock);
             if (known_peers.count(pid))
                 throw PeerNetworkError(SALTI_ERROR_PEER_ALREADY_EXISTS);
             auto p = new Peer(pid, this);
-            conn_t conn{new Conn()};
-            conn->cpool = this;
-            conn->set_terminated();
             conn->peer = p;
             p->conn = conn;
             p->state = Peer::State::DISCONNECTED;
@@ -1149,7 +2345,6 @@ int32_t PeerNetwork<O, _, __>::conn_peer(const PeerId &pid, int32_t ntry, double
     auto id = this->gen_async_id();
     this->disp_tcall->async_call([this, pid, ntry, retry_delay, id](ThreadCall::Handle &) {
         try {
-            pinfo_slock_t _g(known_peers_lock);
             auto it = known_peers.find(pid);
             if (it == known_peers.end())
                 throw PeerNetworkError(SALTI_ERROR_PEER_NOT_EXIST);
@@ -1195,7 +2390,6 @@ int32_t PeerNetwork<O, _, __>::set_peer_addr(const PeerId &pid, const NetAddr &a
     auto id = this->gen_async_id();
     this->disp_tcall->async_call([this, pid, addr, id](ThreadCall::Handle &) {
         try {
-            pinfo_slock_t _g(known_peers_lock);
             auto it = known_peers.find(pid);
             if (it == known_peers.end())
                 throw PeerNetworkError(SALTI_ERROR_PEER_NOT_EXIST);
@@ -1213,9 +2407,14 @@ int32_t PeerNetwork<O, _, __>::set_peer_addr(const PeerId &pid, const NetAddr &a
 template<typename O, O _, O __>
 int32_t PeerNetwork<O, _, __>::del_peer(const PeerId &pid) {
     auto id = this->gen_async_id();
+    if (!peer_conns.erase(pid))
+    {
+        this->recoverable_error(std::make_exception_ptr(
+            PeerNetworkError(SALTI_ERROR_PEER_NOT_EXIST)), id);
+        return id;
+    }
     this->disp_tcall->async_call([this, pid, id](ThreadCall::Handle &) {
         try {
-            pinfo_ulock_t _g(known_peers_lock);
             auto it = known_peers.find(pid);
             if (it == known_peers.end())
                 throw PeerNetworkError(SALTI_ERROR_PEER_NOT_EXIST);
@@ -1237,25 +2436,12 @@ int32_t PeerNetwork<O, _, __>::del_peer(const PeerId &pid) {
 template<typename O, O _, O __>
 typename PeerNetwork<O, _, __>::conn_t
 PeerNetwork<O, _, __>::get_peer_conn(const PeerId &pid) const {
-    auto ret = *(static_cast<conn_t *>(
-            this->disp_tcall->call([this, pid](ThreadCall::Handle &h) {
-        conn_t conn;
-        pinfo_slock_t _g(known_peers_lock);
-        auto it = known_peers.find(pid);
-        if (it == known_peers.end())
-            throw PeerNetworkError(SALTI_ERROR_PEER_NOT_EXIST);
-        h.set_result(it->second->conn);
-    }).get()));
-    return ret;
+    return _get_peer_conn(pid);
 }
 
 template<typename O, O _, O __>
 bool PeerNetwork<O, _, __>::has_peer(const PeerId &pid) const {
-    return *(static_cast<bool *>(this->disp_tcall->call(
-                [this, pid](ThreadCall::Handle &h) {
-        pinfo_slock_t _g(known_peers_lock);
-        h.set_result(known_peers.count(pid));
-    }).get()));
+    return peer_conns.contains(pid);
 }
 
 template<typename O, O _, O __>
@@ -1269,53 +2455,102 @@ size_t PeerNetwork<O, _, __>::get_npending() const {
 template<typename O, O _, O __>
 template<typename MsgType>
 inline int32_t PeerNetwork<O, _, __>::send_msg_deferred(MsgType &&msg, const PeerId &pid) {
-    return _send_msg_deferred(Msg(std::move(msg), this->msg_magic), pid);
+    return _send_msg_deferred(Msg(std::forward<MsgType>(msg), this->msg_magic), pid);
 }
 
 template<typename O, O _, O __>
 inline int32_t PeerNetwork<O, _, __>::_send_msg_deferred(Msg &&msg, const PeerId &pid) {
     auto id = this->gen_async_id();
-    this->disp_tcall->async_call(
-            [this, msg=std::move(msg), pid, id](ThreadCall::Handle &) {
-        try {
-            if (!_send_msg(msg, pid))
-                throw PeerNetworkError(SALTI_ERROR_CONN_NOT_READY);
-        } catch (...) { this->recoverable_error(std::current_exception(), id); }
-    });
+    /* written on this thread, with the connection pinned by _send_msg() */
+    try {
+        if (!_send_msg(std::move(msg), pid))
+            throw PeerNetworkError(SALTI_ERROR_CONN_NOT_READY);
+    } catch (...) { this->recoverable_error(std::current_exception(), id); }
     return id;
 }
 
 template<typename O, O _, O __>
 template<typename MsgType>
-inline bool PeerNetwork<O, _, __>::send_msg(const MsgType &msg, const PeerId &pid) {
-    return _send_msg(Msg(msg, this->msg_magic), pid);
+inline bool PeerNetwork<O, _, __>::send_msg(MsgType &&msg, const PeerId &pid) {
+    return _send_msg(Msg(std::forward<MsgType>(msg), this->msg_magic), pid);
 }
 
 template<typename O, O _, O __>
 inline bool PeerNetwork<O, _, __>::_send_msg(const Msg &msg, const PeerId &pid) {
-    pinfo_slock_t _g(known_peers_lock);
-    return MsgNet::_send_msg(msg, _get_peer_conn(pid));
+    ConnPin pin(this, pid);
+    return MsgNet::_send_msg(msg, pin.get());
+}
+
+template<typename O, O _, O __>
+template<typename MsgType>
+inline bool PeerNetwork<O, _, __>::send_msg(MsgType &&msg, const PeerId &pid, SendPriority prio) {
+    return _send_msg(Msg(std::forward<MsgType>(msg), this->msg_magic), pid, prio);
+}
+
+template<typename O, O _, O __>
+inline bool PeerNetwork<O, _, __>::_send_msg(Msg &&msg, const PeerId &pid) {
+    ConnPin pin(this, pid);
+    return MsgNet::_send_msg(std::move(msg), pin.get());
+}
+
+template<typename O, O _, O __>
+inline bool PeerNetwork<O, _, __>::_send_msg(Msg &&msg, const PeerId &pid, SendPriority prio) {
+    ConnPin pin(this, pid);
+    return MsgNet::_send_msg(std::move(msg), pin.get(), prio);
+}
+
+template<typename O, O _, O __>
+template<typename MsgType>
+inline bool PeerNetwork<O, _, __>::send_msg_stream(MsgType &&msg, const PeerId &pid) {
+    return _send_msg_stream(Msg(std::forward<MsgType>(msg), this->msg_magic), pid);
+}
+
+template<typename O, O _, O __>
+inline bool PeerNetwork<O, _, __>::_send_msg_stream(Msg &&msg, const PeerId &pid) {
+    ConnPin pin(this, pid);
+    return MsgNet::_send_msg_stream(std::move(msg), pin.get());
 }
 
 template<typename O, O _, O __>
 template<typename MsgType>
 inline int32_t PeerNetwork<O, _, __>::multicast_msg(MsgType &&msg, const std::vector<PeerId> &pids) {
-    return _multicast_msg(Msg(std::move(msg), this->msg_magic), pids);
+    return _multicast_msg(Msg(std::forward<MsgType>(msg), this->msg_magic), pids);
 }
 
 template<typename O, O _, O __>
 inline int32_t PeerNetwork<O, _, __>::_multicast_msg(Msg &&msg, const std::vector<PeerId> &pids) {
     auto id = this->gen_async_id();
-    this->disp_tcall->async_call(
-                [this, msg=std::move(msg), pids, id](ThreadCall::Handle &) {
-        try {
-            pinfo_slock_t _g(known_peers_lock);
-            bool succ = true;
-            for (auto &pid: pids)
-                succ &= MsgNet::_send_msg(msg, _get_peer_conn(pid));
-            if (!succ) throw PeerNetworkError(SALTI_ERROR_CONN_NOT_READY);
-        } catch (...) { this->recoverable_error(std::current_exception(), id); }
-    });
+    try {
+        /* the connections stay pinned until the message is written to all
+         * of them (see ConnPin) */
+        std::vector<ConnPin> pins;
+        std::vector<typename MsgNet::conn_t> conns;
+        pins.reserve(pids.size());
+        conns.reserve(pids.size());
+        std::exception_ptr err;
+        for (;;)
+        {
+            bool pinned = true;
+            try {
+                for (auto &pid: pids)
+                {
+                    pins.emplace_back(this, pid, false);
+                    if (!(pinned = pins.back().is_pinned())) break;
+                    conns.push_back(pins.back().get());
+                }
+            } catch (...) { err = std::current_exception(); }
+            if (pinned) break;
+            /* holding the other pins while waiting could keep the handover
+             * (e.g. of a peer listed twice) from finishing */
+            pins.clear();
+            conns.clear();
+            std::this_thread::yield();
+        }
+        /* the peers before a missing one still get the message */
+        bool succ = MsgNet::_multicast_msg(std::move(msg), conns);
+        if (err) std::rethrow_exception(err);
+        if (!succ) throw PeerNetworkError(SALTI_ERROR_CONN_NOT_READY);
+    } catch (...) { this->recoverable_error(std::current_exception(), id); }
     return id;
 }
 
@@ -1342,16 +2577,16 @@ void ClientNetwork<OpcodeType>::on_dispatcher_teardown(const ConnPool::conn_t &_
 template<typename OpcodeType>
 template<typename MsgType>
 inline int32_t ClientNetwork<OpcodeType>::send_msg_deferred(MsgType &&msg, const NetAddr &addr) {
-    return _send_msg_deferred(Msg(std::move(msg), this->msg_magic), addr);
+    return _send_msg_deferred(Msg(std::forward<MsgType>(msg), this->msg_magic), addr);
 }
 
 template<typename OpcodeType>
 inline int32_t ClientNetwork<OpcodeType>::_send_msg_deferred(Msg &&msg, const NetAddr &addr) {
     auto id = this->gen_async_id();
     this->disp_tcall->async_call(
-            [this, msg=std::move(msg), addr, id](ThreadCall::Handle &) {
+            [this, msg=std::move(msg), addr, id](ThreadCall::Handle &) mutable {
         try {
-            _send_msg(msg, addr);
+            _send_msg(std::move(msg), addr);
         } catch (...) { this->recoverable_error(std::current_exception(), id); }
     });
     return id;
@@ -1359,8 +2594,8 @@ inline int32_t ClientNetwork<OpcodeType>::_send_msg_deferred(Msg &&msg, const Ne
 
 template<typename OpcodeType>
 template<typename MsgType>
-inline bool ClientNetwork<OpcodeType>::send_msg(const MsgType &msg, const NetAddr &addr) {
-    return _send_msg(Msg(msg, this->msg_magic), addr);
+inline bool ClientNetwork<OpcodeType>::send_msg(MsgType &&msg, const NetAddr &addr) {
+    return _send_msg(Msg(std::forward<MsgType>(msg), this->msg_magic), addr);
 }
 
 template<typename OpcodeType>
@@ -1371,6 +2606,14 @@ inline bool ClientNetwork<OpcodeType>::_send_msg(const Msg &msg, const NetAddr &
     return MsgNet::_send_msg(msg, it->second);
 }
 
+template<typename OpcodeType>
+inline bool ClientNetwork<OpcodeType>::_send_msg(Msg &&msg, const NetAddr &addr) {
+    auto it = addr2conn.find(addr);
+    if (it == addr2conn.end())
+        throw ClientNetworkError(SALTI_ERROR_CLIENT_NOT_EXIST);
+    return MsgNet::_send_msg(std::move(msg), it->second);
+}
+
 template<typename O, O OPCODE_PING, O _>
 const O PeerNetwork<O, OPCODE_PING, _>::MsgPing::opcode = OPCODE_PING;
 
@@ -1421,6 +2664,29 @@ typedef enum msgnetwork_conn_mode_t {
     CONN_MODE_PASSIVE,
 } msgnetwork_conn_mode_t;
 
+typedef enum msgnetwork_checksum_type_t {
+    CHECKSUM_TYPE_SHA1,
+    CHECKSUM_TYPE_CRC32C,
+    CHECKSUM_TYPE_NONE
+} msgnetwork_checksum_type_t;
+
+typedef enum msgnetwork_handler_shard_t {
+    HANDLER_SHARD_BY_CONN,
+    HANDLER_SHARD_BY_OPCODE
+} msgnetwork_handler_shard_t;
+
+typedef enum msgnetwork_worker_policy_t {
+    WORKER_POLICY_LEAST_CONN,
+    WORKER_POLICY_LEAST_BYTES,
+    WORKER_POLICY_HASH_ADDR
+} msgnetwork_worker_policy_t;
+
+typedef enum msgnetwork_send_priority_t {
+    SEND_PRIORITY_HIGH,
+    SEND_PRIORITY_NORMAL,
+    SEND_PRIORITY_LOW
+} msgnetwork_send_priority_t;
+
 typedef enum peernetwork_id_mode_t {
     ID_MODE_ADDR_BASED,
     ID_MODE_CERT_BASED
@@ -1438,22 +2704,58 @@ msgnetwork_config_t *msgnetwork_config_new();
 void msgnetwork_config_free(const msgnetwork_config_t *self);
 void msgnetwork_config_max_msg_size(msgnetwork_config_t *self, size_t size);
 void msgnetwork_config_max_msg_queue_size(msgnetwork_config_t *self, size_t size);
+void msgnetwork_config_max_stream_size(msgnetwork_config_t *self, size_t size);
+void msgnetwork_config_stream_frame_size(msgnetwork_config_t *self, size_t size);
+void msgnetwork_config_msg_batch(msgnetwork_config_t *self, _opcode_t opcode, double window);
 void msgnetwork_config_burst_size(msgnetwork_config_t *self, size_t burst_size);
 void msgnetwork_config_max_listen_backlog(msgnetwork_config_t *self, int backlog);
 void msgnetwork_config_conn_server_timeout(msgnetwork_config_t *self, double timeout);
+void msgnetwork_config_listen_per_worker(msgnetwork_config_t *self, bool enabled);
 void msgnetwork_config_recv_chunk_size(msgnetwork_config_t *self, size_t size);
+void msgnetwork_config_recv_chunk_size_min(msgnetwork_config_t *self, size_t size);
+void msgnetwork_config_recv_chunk_size_max(msgnetwork_config_t *self, size_t size);
+void msgnetwork_config_recv_exact(msgnetwork_config_t *self, bool enabled);
 void msgnetwork_config_nworker(msgnetwork_config_t *self, size_t nworker);
 void msgnetwork_config_max_recv_buff_size(msgnetwork_config_t *self, size_t size);
 void msgnetwork_config_max_send_buff_size(msgnetwork_config_t *self, size_t size);
+void msgnetwork_config_max_send_buff_bytes(msgnetwork_config_t *self, size_t size);
+void msgnetwork_config_send_buff_high_watermark(msgnetwork_config_t *self, size_t size);
+void msgnetwork_config_send_buff_low_watermark(msgnetwork_config_t *self, size_t size);
+void msgnetwork_config_send_burst_size(msgnetwork_config_t *self, size_t size);
+void msgnetwork_config_queue_spin_time(msgnetwork_config_t *self, double t);
+void msgnetwork_config_io_uring_entries(msgnetwork_config_t *self, size_t entries);
+void msgnetwork_config_checksum_type(msgnetwork_config_t *self, msgnetwork_checksum_type_t type);
+void msgnetwork_config_nhandler(msgnetwork_config_t *self, size_t nhandler);
+void msgnetwork_config_handler_shard(msgnetwork_config_t *self, msgnetwork_handler_shard_t shard);
+void msgnetwork_config_worker_policy(msgnetwork_config_t *self, msgnetwork_worker_policy_t policy);
+/* the worker (handler) functions pin the i-th thread to cpus[i % ncpu] */
+void msgnetwork_config_dispatcher_cpus(msgnetwork_config_t *self, const int *cpus, size_t ncpu);
+void msgnetwork_config_worker_cpus(msgnetwork_config_t *self, const int *cpus, size_t ncpu);
+void msgnetwork_config_user_cpus(msgnetwork_config_t *self, const int *cpus, size_t ncpu);
+void msgnetwork_config_handler_cpus(msgnetwork_config_t *self, const int *cpus, size_t ncpu);
+typedef size_t (*msgnetwork_worker_selector_t)(const msgnetwork_conn_t *, size_t nworker, void *userdata);
+void msgnetwork_config_worker_selector(msgnetwork_config_t *self, msgnetwork_worker_selector_t cb, void *userdata);
 void msgnetwork_config_enable_tls(msgnetwork_config_t *self, bool enabled);
 void msgnetwork_config_tls_key_file(msgnetwork_config_t *self, const char *pem_fname);
 void msgnetwork_config_tls_cert_file(msgnetwork_config_t *self, const char *pem_fname);
 void msgnetwork_config_tls_key_by_move(msgnetwork_config_t *self, pkey_t *key);
 void msgnetwork_config_tls_cert_by_move(msgnetwork_config_t *self, x509_t *cert);
+void msgnetwork_config_tls_session_cache_size(msgnetwork_config_t *self, size_t size);
+void msgnetwork_config_enable_ktls(msgnetwork_config_t *self, bool enabled);
+void msgnetwork_config_tls_io_budget(msgnetwork_config_t *self, size_t size);
 
 msgnetwork_t *msgnetwork_new(const eventcontext_t *ec, const msgnetwork_config_t *config, SalticidaeCError *err);
 void msgnetwork_free(const msgnetwork_t *self);
 bool msgnetwork_send_msg(msgnetwork_t *self, const msg_t *msg, const msgnetwork_conn_t *conn);
+bool msgnetwork_send_msg_with_priority(msgnetwork_t *self, const msg_t *msg, const msgnetwork_conn_t *conn, msgnetwork_send_priority_t prio);
+void msgnetwork_set_send_priority(msgnetwork_t *self, _opcode_t opcode, msgnetwork_send_priority_t prio);
+bool msgnetwork_send_msg_stream(msgnetwork_t *self, const msg_t *msg, const msgnetwork_conn_t *conn);
+/* queue the messages in order, return the number queued before the first
+ * failure (whose payload is consumed as well) */
+size_t msgnetwork_send_msgs_by_move(msgnetwork_t *self, msg_t * const *_moved_msgs, size_t nmsg, const msgnetwork_conn_t *conn);
+/* the payload is shared by all connections instead of copied */
+bool msgnetwork_multicast_msg_by_move(msgnetwork_t *self, msg_t *_moved_msg, const msgnetwork_conn_t * const *conns, size_t nconn);
+void msgnetwork_enable_stream_reassembly(msgnetwork_t *self, _opcode_t opcode);
 int32_t msgnetwork_send_msg_deferred_by_move(msgnetwork_t *self, msg_t *_moved_msg, const msgnetwork_conn_t *conn);
 msgnetwork_conn_t *msgnetwork_connect_sync(msgnetwork_t *self, const netaddr_t *addr, SalticidaeCError *err);
 int32_t msgnetwork_connect(msgnetwork_t *self, const netaddr_t *addr);
@@ -1463,13 +2765,27 @@ void msgnetwork_listen(msgnetwork_t *self, const netaddr_t *listen_addr, Saltici
 void msgnetwork_start(msgnetwork_t *self);
 void msgnetwork_stop(msgnetwork_t *self);
 void msgnetwork_terminate(msgnetwork_t *self, const msgnetwork_conn_t *conn);
+void msgnetwork_pin_worker(msgnetwork_t *self, const netaddr_t *addr, size_t worker, SalticidaeCError *err);
+void msgnetwork_unpin_worker(msgnetwork_t *self, const netaddr_t *addr);
+void msgnetwork_migrate(msgnetwork_t *self, const msgnetwork_conn_t *conn, size_t worker, SalticidaeCError *err);
+void msgnetwork_rebalance(msgnetwork_t *self);
 
 typedef void (*msgnetwork_msg_callback_t)(const msg_t *, const msgnetwork_conn_t *, void *userdata);
 void msgnetwork_reg_handler(msgnetwork_t *self, _opcode_t opcode, msgnetwork_msg_callback_t cb, void *userdata);
+/* called with a run of messages with the opcode at once, the arrays and what
+ * they point to are only valid during the call */
+typedef void (*msgnetwork_msg_burst_callback_t)(const msg_t * const *msgs, const msgnetwork_conn_t * const *conns, size_t nmsg, void *userdata);
+void msgnetwork_reg_burst_handler(msgnetwork_t *self, _opcode_t opcode, msgnetwork_msg_burst_callback_t cb, void *userdata);
+/* called with each frame of a streamed message, the data is only valid during the call */
+typedef void (*msgnetwork_stream_callback_t)(const msgnetwork_conn_t *, uint32_t stream_id, uint64_t total, uint64_t offset, const uint8_t *data, size_t len, void *userdata);
+void msgnetwork_reg_stream_handler(msgnetwork_t *self, _opcode_t opcode, msgnetwork_stream_callback_t cb, void *userdata);
 
 typedef bool (*msgnetwork_conn_callback_t)(const msgnetwork_conn_t *, bool connected, void *userdata);
 void msgnetwork_reg_conn_handler(msgnetwork_t *self, msgnetwork_conn_callback_t cb, void *userdata);
 
+typedef void (*msgnetwork_send_buff_callback_t)(const msgnetwork_conn_t *, bool congested, void *userdata);
+void msgnetwork_reg_send_buff_handler(msgnetwork_t *self, msgnetwork_send_buff_callback_t cb, void *userdata);
+
 
 typedef void (*msgnetwork_error_callback_t)(const SalticidaeCError *, bool fatal, int32_t async_id, void *userdata);
 void msgnetwork_reg_error_handler(msgnetwork_t *self, msgnetwork_error_callback_t cb, void *userdata);
@@ -1479,6 +2795,8 @@ msgnetwork_conn_mode_t msgnetwork_conn_get_mode(const msgnetwork_conn_t *conn);
 const netaddr_t *msgnetwork_conn_get_addr(const msgnetwork_conn_t *conn);
 const x509_t *msgnetwork_conn_get_peer_cert(const msgnetwork_conn_t *conn);
 bool msgnetwork_conn_is_terminated(const msgnetwork_conn_t *conn);
+size_t msgnetwork_conn_get_send_buff_bytes(const msgnetwork_conn_t *conn);
+bool msgnetwork_conn_is_send_congested(const msgnetwork_conn_t *conn);
 
 /* PeerNetwork */
 
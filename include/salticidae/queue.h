@@ -5,6 +5,12 @@
 #include <vector>
 #include <cassert>
 #include <thread>
+#include <iterator>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 namespace salticidae {
 
@@ -89,24 +95,59 @@ class FreeList {
 
 const size_t MPMCQ_SIZE = 4096;
 
-template<typename T>
+/* BlockSize is the number of elements per block, the queue grows and shrinks
+ * by blocks, so a small block size suits a queue that is usually short */
+template<typename T, size_t BlockSize = MPMCQ_SIZE>
 class MPMCQueue {
     protected:
     struct Block: public FreeList::Node {
         std::atomic<uint32_t> head;
         cacheline_pad _pad0;
         std::atomic<uint32_t> tail;
-        T elem[MPMCQ_SIZE];
-        std::atomic<bool> avail[MPMCQ_SIZE];
+        T elem[BlockSize];
+        std::atomic<bool> avail[BlockSize];
         std::atomic<Block *> next;
     };
 
     FreeList blks;
+    /* the number of blocks that could still be allocated on demand */
+    std::atomic<size_t> nspare;
 
     std::atomic<Block *> head;
     cacheline_pad _pad0;
     std::atomic<Block *> tail;
 
+    bool _take_spare() {
+        auto n = nspare.load(std::memory_order_relaxed);
+        while (n && !nspare.compare_exchange_weak(n, n - 1, std::memory_order_relaxed));
+        return n > 0;
+    }
+
+    /* link a new block after the full tail block t, return false if the queue
+     * is bounded and runs out of blocks */
+    bool _append_block(Block *t, bool unbounded) {
+        if (t->next.load(std::memory_order_relaxed) != nullptr) return true;
+        FreeList::Node * _nblk;
+        if (!blks.pop(_nblk))
+        {
+            if (!unbounded && !_take_spare()) return false;
+            _nblk = new Block();
+        }
+        auto nblk = static_cast<Block *>(_nblk);
+        nblk->head.store(0, std::memory_order_relaxed);
+        nblk->tail.store(0, std::memory_order_relaxed);
+        nblk->next.store(nullptr, std::memory_order_relaxed);
+        Block *tnext = nullptr;
+        if (!t->next.compare_exchange_weak(tnext, nblk, std::memory_order_acq_rel))
+            blks.push(nblk);
+        else
+        {
+            tail.store(nblk, std::memory_order_release);
+            nblk->freed.store(false, std::memory_order_release);
+        }
+        return true;
+    }
+
     template<typename U>
     bool _enqueue(U &&e, bool unbounded = true) {
         for (;;)
@@ -122,33 +163,11 @@ class MPMCQueue {
                 continue;
             }
             auto tt = t->tail.load(std::memory_order_relaxed);
-            if (tt >= MPMCQ_SIZE)
+            if (tt >= BlockSize)
             {
-                if (t->next.load(std::memory_order_relaxed) == nullptr)
-                {
-                    FreeList::Node * _nblk;
-                    if (!blks.pop(_nblk))
-                    {
-                        if (unbounded) _nblk = new Block();
-                        else {
-                            blks.release_ref(t);
-                            return false;
-                        }
-                    }
-                    auto nblk = static_cast<Block *>(_nblk);
-                    nblk->head.store(0, std::memory_order_relaxed);
-                    nblk->tail.store(0, std::memory_order_relaxed);
-                    nblk->next.store(nullptr, std::memory_order_relaxed);
-                    Block *tnext = nullptr;
-                    if (!t->next.compare_exchange_weak(tnext, nblk, std::memory_order_acq_rel))
-                        blks.push(nblk);
-                    else
-                    {
-                        tail.store(nblk, std::memory_order_release);
-                        nblk->freed.store(false, std::memory_order_release);
-                    }
-                }
+                bool ok = _append_block(t, unbounded);
                 blks.release_ref(t);
+                if (!ok) return false;
                 continue;
             }
             auto tt2 = tt;
@@ -164,11 +183,53 @@ class MPMCQueue {
         return true;
     }
 
+    /* claim up to n consecutive slots of the tail block with a single CAS,
+     * return the number of elements taken from first */
+    template<typename It>
+    size_t _enqueue_bulk(It &first, size_t n, bool unbounded) {
+        size_t m = 0;
+        for (;;)
+        {
+            auto t = tail.load(std::memory_order_acquire);
+            auto tcnt = t->refcnt.load(std::memory_order_relaxed);
+            if (!tcnt) continue;
+            if (!t->refcnt.compare_exchange_weak(tcnt, tcnt + 1, std::memory_order_relaxed))
+                continue;
+            if (t->freed.load(std::memory_order_relaxed))
+            {
+                blks.release_ref(t);
+                continue;
+            }
+            auto tt = t->tail.load(std::memory_order_relaxed);
+            if (tt >= BlockSize)
+            {
+                bool ok = _append_block(t, unbounded);
+                blks.release_ref(t);
+                if (!ok) return 0;
+                continue;
+            }
+            m = std::min(n, (size_t)(BlockSize - tt));
+            auto tt2 = tt;
+            if (t->tail.compare_exchange_weak(tt2, tt2 + m, std::memory_order_relaxed))
+            {
+                for (auto i = tt; i < tt + m; i++, ++first)
+                {
+                    new (&(t->elem[i])) T(*first);
+                    t->avail[i].store(true, std::memory_order_release);
+                }
+                blks.release_ref(t);
+                break;
+            }
+            blks.release_ref(t);
+        }
+        return m;
+    }
+
     public:
     MPMCQueue(const MPMCQueue &) = delete;
     MPMCQueue(MPMCQueue &&) = delete;
 
-    MPMCQueue(): head(new Block()), tail(head.load()) {
+    MPMCQueue(): nspare(0), head(new Block()), tail(head.load()) {
         auto h = head.load();
         h->head = h->tail = 0;
         memset(h->avail, 0, sizeof(h->avail));
@@ -184,19 +245,46 @@ class MPMCQueue {
         }
     }
 
-    void set_capacity(size_t capacity = 0) {
-        capacity = std::max(capacity / MPMCQ_SIZE, (size_t)1);
-        while (capacity--) blks.push(new Block());
+    /* reserve blocks for roughly capacity more elements, with lazy set, the
+     * blocks are only allocated when they are needed */
+    void set_capacity(size_t capacity = 0, bool lazy = false) {
+        capacity = std::max(capacity / BlockSize, (size_t)1);
+        if (lazy)
+            nspare.fetch_add(capacity, std::memory_order_relaxed);
+        else
+            while (capacity--) blks.push(new Block());
     }
 
     template<typename U>
     bool enqueue(U &&e, bool unbounded = true) {
-        return _enqueue(e, unbounded);
+        return _enqueue(std::forward<U>(e), unbounded);
     }
 
     template<typename U>
     bool try_enqueue(U &&e) {
-        return _enqueue(e, false);
+        return _enqueue(std::forward<U>(e), false);
+    }
+
+    /* enqueue the elements in [first, last), each element is constructed from
+     * *first, so pass std::make_move_iterator() to move them in; the slots are
+     * claimed per block rather than per element; return the number of
+     * enqueued elements, which is less than the total only when the queue
+     * is bounded and runs out of capacity */
+    template<typename It>
+    size_t enqueue_bulk(It first, It last, bool unbounded = true) {
+        size_t n = std::distance(first, last), cnt = 0;
+        while (cnt < n)
+        {
+            auto m = _enqueue_bulk(first, n - cnt, unbounded);
+            if (!m) break;
+            cnt += m;
+        }
+        return cnt;
+    }
+
+    template<typename It>
+    size_t try_enqueue_bulk(It first, It last) {
+        return enqueue_bulk(first, last, false);
     }
 
     bool try_dequeue(T &e) {
@@ -212,7 +300,7 @@ class MPMCQueue {
             auto tt = h->tail.load(std::memory_order_relaxed);
             if (hh >= tt)
             {
-                if (tt < MPMCQ_SIZE) { blks.release_ref(h); return false; }
+                if (tt < BlockSize) { blks.release_ref(h); return false; }
                 auto hnext = h->next.load(std::memory_order_acquire);
                 if (hnext == nullptr) { blks.release_ref(h); return false; }
                 auto h2 = h;
@@ -235,11 +323,56 @@ class MPMCQueue {
         }
         return true;
     }
+
+    /* dequeue up to max elements to out, consecutive available slots of the
+     * head block are claimed with a single CAS; return the number of
+     * dequeued elements */
+    template<typename OutputIt>
+    size_t try_dequeue_bulk(OutputIt out, size_t max) {
+        size_t cnt = 0;
+        while (cnt < max)
+        {
+            auto h = this->head.load(std::memory_order_acquire);
+            auto hcnt = h->refcnt.load(std::memory_order_relaxed);
+            if (!hcnt) continue;
+            if (!h->refcnt.compare_exchange_weak(hcnt, hcnt + 1, std::memory_order_relaxed))
+                continue;
+
+            auto hh = h->head.load(std::memory_order_relaxed);
+            auto tt = h->tail.load(std::memory_order_relaxed);
+            if (hh >= tt)
+            {
+                if (tt < BlockSize) { blks.release_ref(h); break; }
+                auto hnext = h->next.load(std::memory_order_acquire);
+                if (hnext == nullptr) { blks.release_ref(h); break; }
+                auto h2 = h;
+                if (this->head.compare_exchange_weak(h2, hnext, std::memory_order_acq_rel))
+                    this->blks.push(h);
+                blks.release_ref(h);
+                continue;
+            }
+            auto m = std::min(max - cnt, (size_t)(tt - hh));
+            auto hh2 = hh;
+            if (h->head.compare_exchange_weak(hh2, hh2 + m, std::memory_order_relaxed))
+            {
+                for (auto i = hh; i < hh + m; i++)
+                {
+                    while (!h->avail[i].load(std::memory_order_acquire))
+                        std::this_thread::yield();
+                    *out++ = std::move(h->elem[i]);
+                    h->avail[i].store(false, std::memory_order_relaxed);
+                }
+                cnt += m;
+            }
+            blks.release_ref(h);
+        }
+        return cnt;
+    }
 };
 
-template<typename T>
-struct MPSCQueue: public MPMCQueue<T> {
-    using MPMCQueue<T>::MPMCQueue;
+template<typename T, size_t BlockSize = MPMCQ_SIZE>
+struct MPSCQueue: public MPMCQueue<T, BlockSize> {
+    using MPMCQueue<T, BlockSize>::MPMCQueue;
     /* the same thread is calling the following functions */
 
     bool try_dequeue(T &e) {
@@ -250,7 +383,7 @@ struct MPSCQueue: public MPMCQueue<T> {
             auto tt = h->tail.load(std::memory_order_relaxed);
             if (hh >= tt)
             {
-                if (tt < MPMCQ_SIZE) return false;
+                if (tt < BlockSize) return false;
                 auto hnext = h->next.load(std::memory_order_relaxed);
                 if (hnext == nullptr) return false;
                 this->head.store(hnext, std::memory_order_relaxed);
@@ -267,6 +400,38 @@ struct MPSCQueue: public MPMCQueue<T> {
         return true;
     }
 
+    /* single-consumer version: the head index is advanced by one store */
+    template<typename OutputIt>
+    size_t try_dequeue_bulk(OutputIt out, size_t max) {
+        size_t cnt = 0;
+        while (cnt < max)
+        {
+            auto h = this->head.load(std::memory_order_relaxed);
+            auto hh = h->head.load(std::memory_order_relaxed);
+            auto tt = h->tail.load(std::memory_order_relaxed);
+            if (hh >= tt)
+            {
+                if (tt < BlockSize) break;
+                auto hnext = h->next.load(std::memory_order_relaxed);
+                if (hnext == nullptr) break;
+                this->head.store(hnext, std::memory_order_relaxed);
+                this->blks.push(h);
+                continue;
+            }
+            auto m = std::min(max - cnt, (size_t)(tt - hh));
+            h->head.store(hh + m, std::memory_order_relaxed);
+            for (auto i = hh; i < hh + m; i++)
+            {
+                while (!h->avail[i].load(std::memory_order_acquire))
+                    std::this_thread::yield();
+                *out++ = std::move(h->elem[i]);
+                h->avail[i].store(false, std::memory_order_relaxed);
+            }
+            cnt += m;
+        }
+        return cnt;
+    }
+
     template<typename U>
     bool rewind(U &&e) {
         auto h = this->head.load(std::memory_order_relaxed);
@@ -274,10 +439,10 @@ struct MPSCQueue: public MPMCQueue<T> {
         if (!hh)
         {
             FreeList::Node * _nblk;
-            if (!this->blks.pop(_nblk)) _nblk = new typename MPMCQueue<T>::Block();
-            auto nblk = static_cast<typename MPMCQueue<T>::Block *>(_nblk);
-            nblk->head.store(MPMCQ_SIZE, std::memory_order_relaxed);
-            nblk->tail.store(MPMCQ_SIZE, std::memory_order_relaxed);
+            if (!this->blks.pop(_nblk)) _nblk = new typename MPMCQueue<T, BlockSize>::Block();
+            auto nblk = static_cast<typename MPMCQueue<T, BlockSize>::Block *>(_nblk);
+            nblk->head.store(BlockSize, std::memory_order_relaxed);
+            nblk->tail.store(BlockSize, std::memory_order_relaxed);
             nblk->next.store(h, std::memory_order_relaxed);
             this->head.store(nblk, std::memory_order_relaxed);
         }
@@ -290,6 +455,118 @@ struct MPSCQueue: public MPMCQueue<T> {
     }
 };
 
+/** A hash map for lookups from many threads and rare updates. It is sharded
+ * by key, and each shard is an immutable snapshot replaced as a whole on
+ * update. A lookup never locks: it registers with the current epoch of the
+ * shard while reading the snapshot. A writer publishes the new snapshot,
+ * moves the shard to the other epoch and waits for the readers of the
+ * previous one before freeing the old snapshot. Writers only contend within
+ * a shard. */
+template<typename Key, typename Val, size_t NShard = 64>
+class SnapshotMap {
+    using map_t = std::unordered_map<Key, Val>;
+
+    struct Shard {
+        std::atomic<const map_t *> snap;
+        std::atomic<size_t> epoch;
+        /* the readers in each epoch */
+        std::atomic<size_t> nreader[2];
+        /* serializes the writers */
+        std::mutex wlock;
+        cacheline_pad _pad;
+        Shard(): snap(new map_t()), epoch(0) {
+            nreader[0].store(0, std::memory_order_relaxed);
+            nreader[1].store(0, std::memory_order_relaxed);
+        }
+        ~Shard() { delete snap.load(std::memory_order_relaxed); }
+    };
+    Shard shards[NShard];
+
+    Shard &get_shard(const Key &key) const {
+        return const_cast<Shard &>(shards[std::hash<Key>()(key) % NShard]);
+    }
+
+    /* holds the snapshot of a shard during a lookup */
+    class ReadGuard {
+        Shard &shard;
+        size_t e;
+        public:
+        ReadGuard(Shard &shard): shard(shard) {
+            for (;;)
+            {
+                e = shard.epoch.load();
+                shard.nreader[e].fetch_add(1);
+                /* a writer moving on meanwhile may not wait for us */
+                if (shard.epoch.load() == e) break;
+                shard.nreader[e].fetch_sub(1);
+            }
+        }
+        ~ReadGuard() { shard.nreader[e].fetch_sub(1, std::memory_order_release); }
+        const map_t &get() const { return *shard.snap.load(); }
+    };
+
+    /* apply func to a copy of the shard, which replaces the shard if func
+     * returns true */
+    template<typename Func>
+    bool update(const Key &key, Func &&func) {
+        auto &shard = get_shard(key);
+        std::lock_guard<std::mutex> _g(shard.wlock);
+        auto old = shard.snap.load(std::memory_order_relaxed);
+        std::unique_ptr<map_t> m(new map_t(*old));
+        if (!func(*m)) return false;
+        shard.snap.store(m.release());
+        /* only the readers of the current epoch may still see the old
+         * snapshot, the new readers go to the other one */
+        auto e = shard.epoch.load(std::memory_order_relaxed);
+        shard.epoch.store(e ^ 1);
+        while (shard.nreader[e].load(std::memory_order_acquire))
+            std::this_thread::yield();
+        delete old;
+        return true;
+    }
+
+    public:
+    SnapshotMap() = default;
+    SnapshotMap(const SnapshotMap &) = delete;
+
+    /** Copy the value of the key to val, return false if there is none. */
+    bool find(const Key &key, Val &val) const {
+        ReadGuard g(get_shard(key));
+        const auto &m = g.get();
+        auto it = m.find(key);
+        if (it == m.end()) return false;
+        val = it->second;
+        return true;
+    }
+
+    bool contains(const Key &key) const {
+        ReadGuard g(get_shard(key));
+        return g.get().count(key);
+    }
+
+    /** Return false if the key already exists. */
+    bool insert(const Key &key, const Val &val) {
+        return update(key, [&](map_t &m) {
+            return m.insert(std::make_pair(key, val)).second;
+        });
+    }
+
+    /** Return false if the key does not exist. */
+    bool erase(const Key &key) {
+        return update(key, [&](map_t &m) { return m.erase(key) > 0; });
+    }
+
+    /** Set the value of the key only if it is still old_val. */
+    bool replace(const Key &key, const Val &old_val, const Val &val) {
+        return update(key, [&](map_t &m) {
+            auto it = m.find(key);
+            if (it == m.end() || !(it->second == old_val)) return false;
+            it->second = val;
+            return true;
+        });
+    }
+};
+
 }
 
 #endif
@@ -0,0 +1,150 @@
+#ifndef _SALTICIDAE_STAT_H
+#define _SALTICIDAE_STAT_H
+
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+
+#include "salticidae/queue.h"
+
+namespace salticidae {
+
+/** Nanoseconds of a monotonic clock that is consistent across threads. */
+inline uint64_t get_monotonic_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** A counter updated by only one thread and read by others. An update is a
+ * relaxed load and store instead of a locked read-modify-write, so the owner
+ * pays no more than for a plain variable. A copy is a snapshot of the value. */
+class StatCounter {
+    std::atomic<uint64_t> v;
+
+    public:
+    StatCounter(): v(0) {}
+    StatCounter(const StatCounter &other): v(other.get()) {}
+    StatCounter &operator=(const StatCounter &other) {
+        set(other.get());
+        return *this;
+    }
+
+    /* only to be called by the owner */
+    void add(uint64_t x = 1) { v.store(get() + x, std::memory_order_relaxed); }
+    void set(uint64_t x) { v.store(x, std::memory_order_relaxed); }
+    void set_max(uint64_t x) { if (x > get()) set(x); }
+
+    uint64_t get() const { return v.load(std::memory_order_relaxed); }
+    operator uint64_t() const { return get(); }
+
+    /* only used to aggregate snapshots */
+    StatCounter &operator+=(const StatCounter &other) {
+        add(other.get());
+        return *this;
+    }
+};
+
+/** A log-linear histogram in the spirit of HdrHistogram, with the same
+ * single-writer rule as StatCounter. Values below 2^sub_bits are counted
+ * exactly, and every further power of two is split into 2^sub_bits
+ * buckets, so a reported value is off by at most 1/2^sub_bits. */
+class Histogram {
+    public:
+    static const size_t sub_bits = 3;
+    static const size_t nsub = 1 << sub_bits;
+    static const size_t nbucket = (64 - sub_bits + 1) * nsub;
+
+    private:
+    StatCounter counts[nbucket];
+    StatCounter total;
+    StatCounter sum;
+    StatCounter max;
+
+    static size_t get_bucket(uint64_t x) {
+        if (x < nsub) return x;
+        size_t shift = 63 - __builtin_clzll(x) - sub_bits;
+        return shift * nsub + (x >> shift);
+    }
+
+    /* the largest value that falls into bucket b */
+    static uint64_t get_bucket_max(size_t b) {
+        if (b < nsub) return b;
+        size_t shift = b / nsub - 1;
+        return (((uint64_t)(b - shift * nsub) + 1) << shift) - 1;
+    }
+
+    public:
+    void add(uint64_t x) {
+        counts[get_bucket(x)].add();
+        total.add();
+        sum.add(x);
+        max.set_max(x);
+    }
+
+    uint64_t get_count() const { return total; }
+    uint64_t get_sum() const { return sum; }
+    uint64_t get_max() const { return max; }
+    double get_mean() const { return total ? sum / (double)total : 0; }
+
+    /** The smallest recorded value (within the precision) that is no less
+     * than p percent of all values. */
+    uint64_t get_percentile(double p) const {
+        uint64_t n = total;
+        if (!n) return 0;
+        uint64_t rank = std::max((uint64_t)1, (uint64_t)(p / 100 * n + 0.5));
+        uint64_t acc = 0;
+        for (size_t b = 0; b < nbucket; b++)
+            if ((acc += counts[b]) >= rank)
+                return std::min(get_bucket_max(b), (uint64_t)max);
+        return max;
+    }
+
+    /* only used to aggregate snapshots */
+    Histogram &operator+=(const Histogram &other) {
+        for (size_t b = 0; b < nbucket; b++)
+            counts[b] += other.counts[b];
+        total += other.total;
+        sum += other.sum;
+        max.set_max(other.max);
+        return *this;
+    }
+};
+
+/** Pads a per-thread stat slot so the slots in an array do not share cache
+ * lines. */
+template<typename T>
+struct PaddedStat: public T {
+    cacheline_pad _pad;
+};
+
+/** I/O counters of a worker. */
+struct IOStat {
+    StatCounter nread;          /**< successful reads from sockets */
+    StatCounter nreadb;         /**< bytes read from sockets */
+    StatCounter nwrite;         /**< successful writes to sockets */
+    StatCounter nwriteb;        /**< bytes written to sockets */
+    StatCounter npartial_write; /**< writes cut short by a full kernel buffer */
+    StatCounter ntls_handshake; /**< completed TLS handshakes */
+    StatCounter ntls_resumed;   /**< TLS handshakes that resumed a session */
+    StatCounter ntls_ktls;      /**< TLS connections that send through kTLS */
+    Histogram tls_handshake_time; /**< from the connection setup to the end
+                                    of the TLS handshake (in ns) */
+
+    IOStat &operator+=(const IOStat &other) {
+        nread += other.nread;
+        nreadb += other.nreadb;
+        nwrite += other.nwrite;
+        nwriteb += other.nwriteb;
+        npartial_write += other.npartial_write;
+        ntls_handshake += other.ntls_handshake;
+        ntls_resumed += other.ntls_resumed;
+        ntls_ktls += other.ntls_ktls;
+        tls_handshake_time += other.tls_handshake_time;
+        return *this;
+    }
+};
+
+}
+
+#endif
@@ -35,6 +35,33 @@ namespace salticidae {
 template<size_t N, typename T> class Blob;
 using uint256_t = Blob<256, uint64_t>;
 
+template<typename T, typename = void>
+struct has_serialized_size: std::false_type {};
+
+template<typename T>
+struct has_serialized_size<T,
+    void_t<decltype(std::declval<const T &>().get_serialized_size())>>: std::true_type {};
+
+/** The number of bytes x takes once written to a DataStream, or 0 if that is
+ * not known without serializing it. A type tells its size by defining
+ * `size_t get_serialized_size() const`, so a large structured message can
+ * reserve() its stream once before writing the fields. */
+template<typename T>
+inline typename std::enable_if<std::is_integral<T>::value, size_t>::type
+get_serialized_size(const T &) { return sizeof(T); }
+
+template<typename T>
+inline typename std::enable_if<has_serialized_size<T>::value, size_t>::type
+get_serialized_size(const T &x) { return x.get_serialized_size(); }
+
+template<typename T>
+inline typename std::enable_if<!std::is_integral<T>::value &&
+                                !has_serialized_size<T>::value, size_t>::type
+get_serialized_size(const T &) { return 0; }
+
+inline size_t get_serialized_size(const bytearray_t &x) { return x.size(); }
+inline size_t get_serialized_size(const std::string &x) { return x.size(); }
+
 class DataStream {
     bytearray_t buffer;
     size_t offset;
@@ -90,6 +117,15 @@ class DataStream {
         return buffer.size() - offset;
     }
 
+    /** Make room for len more bytes, so writing them does not reallocate.
+     * The capacity still grows geometrically, so reserving before each of
+     * many small writes stays cheap. */
+    void reserve(size_t len) {
+        size_t cap = buffer.capacity();
+        size_t need = buffer.size() + len;
+        if (need > cap) buffer.reserve(std::max(need, cap * 2));
+    }
+
     template<typename T>
     typename std::enable_if<std::is_integral<T>::value, DataStream &>::type
     operator<<(T d) {
@@ -113,6 +149,26 @@ class DataStream {
         memmove(&*buffer.end() - len, begin, len);
     }
 
+    /** Append n integers (uint16_t, uint32_t or uint64_t) in little-endian
+     * byte order with one resize; on a little-endian host the conversion is
+     * a plain copy, otherwise a swap loop the compiler can vectorize. */
+    template<typename T>
+    typename std::enable_if<std::is_integral<T>::value>::type
+    put_le(const T *arr, size_t n) {
+        size_t len = n * sizeof(T);
+        buffer.resize(buffer.size() + len);
+        uint8_t *dst = buffer.data() + buffer.size() - len;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        memcpy(dst, arr, len);
+#else
+        for (size_t i = 0; i < n; i++, dst += sizeof(T))
+        {
+            T x = htole(arr[i]);
+            memcpy(dst, &x, sizeof(T));
+        }
+#endif
+    }
+
     const uint8_t *get_data_inplace(size_t len) {
         auto res = (uint8_t *)&*(buffer.begin() + offset);
         offset += len;
@@ -123,9 +179,27 @@ class DataStream {
         return res;
     }
 
+    /** Read n little-endian integers written by put_le(). */
+    template<typename T>
+    typename std::enable_if<std::is_integral<T>::value>::type
+    get_le(T *arr, size_t n) {
+        const uint8_t *src = get_data_inplace(n * sizeof(T));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        memcpy(arr, src, n * sizeof(T));
+#else
+        for (size_t i = 0; i < n; i++, src += sizeof(T))
+        {
+            T x;
+            memcpy(&x, src, sizeof(T));
+            arr[i] = letoh(x);
+        }
+#endif
+    }
+
     template<typename T>
     typename std::enable_if<!std::is_integral<T>::value, DataStream &>::type
     operator<<(const T &obj) {
+        reserve(get_serialized_size(obj));
         obj.serialize(*this);
         return *this;
     }
@@ -188,7 +262,12 @@ class DataStream {
     }
 
     operator bytearray_t () && {
-        return buffer;
+        if (offset)
+        {
+            buffer.erase(buffer.begin(), buffer.begin() + offset);
+            offset = 0;
+        }
+        return std::move(buffer);
     }
 
     operator std::string () const & {
@@ -284,26 +363,13 @@ class Blob: public Serializable {
 
     size_t cheap_hash() const { return *data; }
 
-    void serialize(DataStream &s) const override {
-        if (loaded)
-        {
-            for (const _impl_type *ptr = data; ptr < data + _len; ptr++)
-                s << htole(*ptr);
-        }
-        else
-        {
-            for (const _impl_type *ptr = data; ptr < data + _len; ptr++)
-                s << htole((_impl_type)0);
-        }
-    }
+    size_t get_serialized_size() const { return N / 8; }
+
+    /* data stays zeroed until a blob is loaded */
+    void serialize(DataStream &s) const override { s.put_le(data, _len); }
 
     void unserialize(DataStream &s) override {
-        for (_impl_type *ptr = data; ptr < data + _len; ptr++)
-        {
-            _impl_type x;
-            s >> x;
-            *ptr = letoh(x);
-        }
+        s.get_le(data, _len);
         loaded = true;
     }
 
@@ -326,7 +392,7 @@ class _Bits {
 
     public:
 
-    _Bits(): data(nullptr) {}
+    _Bits(): data(nullptr), nbits(0), ndata(0) {}
     _Bits(const bytearray_t &arr) {
         load(&*arr.begin(), arr.size());
     }
@@ -339,7 +405,7 @@ class _Bits {
     _Bits(const uint8_t *arr, uint32_t len) { load(arr, len); }
     _Bits(uint32_t nbits): nbits(nbits) {
         ndata = (nbits + bit_per_datum - 1) / bit_per_datum;
-        data = new _impl_type[ndata];
+        data = new _impl_type[ndata]();
     }
 
     ~_Bits() {}
@@ -363,16 +429,17 @@ class _Bits {
 
     size_t cheap_hash() const { return *data; }
 
+    size_t get_serialized_size() const {
+        return sizeof(nbits) + ndata * sizeof(_impl_type);
+    }
+
     void serialize(DataStream &s) const {
         s << htole(nbits);
         if (data)
-        {
-            for (const _impl_type *ptr = data.get(); ptr < data.get() + ndata; ptr++)
-                s << htole(*ptr);
-        }
+            s.put_le(data.get(), ndata);
         else
         {
-            for (const _impl_type *ptr = data.get(); ptr < data.get() + ndata; ptr++)
+            for (uint32_t i = 0; i < ndata; i++)
                 s << htole((_impl_type)0);
         }
     }
@@ -382,12 +449,7 @@ class _Bits {
         nbits = letoh(nbits);
         ndata = (nbits + bit_per_datum - 1) / bit_per_datum;
         data = new _impl_type[ndata];
-        for (_impl_type *ptr = data.get(); ptr < data.get() + ndata; ptr++)
-        {
-            _impl_type x;
-            s >> x;
-            *ptr = letoh(x);
-        }
+        s.get_le(data.get(), ndata);
     }
 
     operator bytearray_t () const & {
@@ -521,6 +583,7 @@ datastream_t *datastream_copy(const datastream_t *self);
 uint8_t *datastream_data(datastream_t *self);
 void datastream_clear(datastream_t *self);
 size_t datastream_size(const datastream_t *self);
+void datastream_reserve(datastream_t *self, size_t len);
 
 bool datastream_put_u8(datastream_t *self, uint8_t val);
 bool datastream_put_u16(datastream_t *self, uint16_t val);
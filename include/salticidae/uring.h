@@ -0,0 +1,115 @@
+#ifndef _SALTICIDAE_URING_H
+#define _SALTICIDAE_URING_H
+
+#include "salticidae/config.h"
+
+#ifdef SALTICIDAE_IO_URING
+#include <cstdint>
+#include <cstddef>
+#include <linux/io_uring.h>
+
+namespace salticidae {
+
+/** A minimal io_uring driven by raw system calls (no liburing), to be used
+ * by only one thread. Completions are signaled through an eventfd, so the
+ * ring can be watched by an event loop. Every submitted entry is expected
+ * to produce exactly one completion (no multishot requests). */
+class IOUring {
+    int ring_fd;
+    int efd;
+    void *sq_ptr;
+    size_t sq_len;
+    void *cq_ptr;
+    size_t cq_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    /** the tail including the entries not yet published to the kernel */
+    unsigned sq_local_tail;
+    /** prepared but not yet submitted */
+    unsigned nqueued;
+    /** prepared but not yet completed */
+    size_t ninflight;
+
+    void release();
+    void wait();
+
+    public:
+    /** Throws SALTI_ERROR_IO_URING if the kernel refuses to set it up. */
+    IOUring(unsigned entries);
+    ~IOUring() { release(); }
+    IOUring(const IOUring &) = delete;
+    IOUring(IOUring &&) = delete;
+
+    /** The eventfd readable upon new completions. */
+    int get_notify_fd() const { return efd; }
+    void reset_notify();
+
+    /** A cleared entry to be filled in, which may flush the queued ones if
+     * the ring is full. */
+    struct io_uring_sqe *get_sqe();
+    /** Submit all the queued entries with a single system call. */
+    void submit();
+
+    bool has_queued() const { return nqueued > 0; }
+    size_t get_ninflight() const { return ninflight; }
+
+    /** Call f(user_data, res) for each available completion (except those
+     * with a zero user_data), return the number of completions. */
+    template<typename Func>
+    size_t reap(Func &&f) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        size_t n = 0;
+        for (; head != tail; head++, n++)
+        {
+            const auto &cqe = cqes[head & cq_mask];
+            uint64_t data = cqe.user_data;
+            int res = cqe.res;
+            /* give the slot back before f() may queue new requests */
+            __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+            ninflight--;
+            if (data) f(data, res);
+        }
+        return n;
+    }
+
+    /** Cancel the request identified by user_data. */
+    void cancel(uint64_t user_data) {
+        auto sqe = get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = user_data;
+    }
+
+    /** Cancel all requests and wait for all of them to complete. */
+    template<typename Func>
+    void drain(Func &&f) {
+        if (!ninflight) return;
+        auto sqe = get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+        submit();
+        for (;;)
+        {
+            reap(f);
+            if (!ninflight) break;
+            wait();
+        }
+    }
+};
+
+}
+
+#endif
+
+#endif
@@ -63,6 +63,8 @@ const char *salticidae_strerror(int code);
 #include <vector>
 #include <unordered_map>
 #include <functional>
+#include <memory>
+#include <atomic>
 #include "salticidae/ref.h"
 
 namespace salticidae {
@@ -77,6 +79,14 @@ std::vector<std::string> trim_all(const std::vector<std::string> &ss);
 std::string vstringprintf(const char *fmt, va_list ap);
 std::string stringprintf(const char *fmt, ...);
 
+/** A set of CPU ids (empty means no restriction). */
+using cpu_list_t = std::vector<int>;
+/** Restrict the calling thread to the CPUs, return false if it is not
+ * supported or fails. */
+bool set_thread_affinity(const cpu_list_t &cpus);
+/** The CPUs of the NUMA node according to sysfs (empty if unknown). */
+cpu_list_t get_numa_node_cpus(int node);
+
 template<typename SerialType>
 inline std::string get_hex10(const SerialType &x) {
     return get_hex(x).substr(0, 10);
@@ -113,7 +123,12 @@ enum SalticidaeErrorCode {
     SALTI_ERROR_CONN_NOT_READY,
     SALTI_ERROR_NOT_AVAIL,
     SALTI_ERROR_UNKNOWN,
-    SALTI_ERROR_CONN_OVERSIZED_MSG
+    SALTI_ERROR_CONN_OVERSIZED_MSG,
+    SALTI_ERROR_CHECKSUM_WITHOUT_TLS,
+    SALTI_ERROR_WORKER_INVALID,
+    SALTI_ERROR_IO_URING,
+    SALTI_ERROR_CONN_BAD_STREAM,
+    SALTI_ERROR_CONN_BAD_BATCH
 };
 
 extern const char *SALTICIDAE_ERROR_STRINGS[];
@@ -138,6 +153,12 @@ class SalticidaeError: public std::exception {
             msg = SALTICIDAE_ERROR_STRINGS[code];
     }
 
+    /** For an OS error that is not an errno value (e.g. the EAI_* codes of
+     * getaddrinfo()), described by `oserr`. */
+    SalticidaeError(int code, int oscode, const char *oserr): code(code), oscode(oscode) {
+        msg = stringprintf("%s: %s", SALTICIDAE_ERROR_STRINGS[code], oserr);
+    }
+
     operator std::string() const { return msg; }
     const char *what() const throw() override { return msg.c_str(); }
     int get_code() const { return code; }
@@ -180,31 +201,57 @@ class Logger {
     const char *color_debug;
     const char *color_warning;
     const char *color_error;
+    /* defined in util.cpp */
+    struct ThreadState;
+    struct AsyncState;
     protected:
     int output;
     bool opened;
     const char *prefix;
+    const uint64_t id;
+    size_t rate_limit_burst;
+    uint64_t rate_limit_period_ns;
+    std::atomic<uint64_t> nsuppressed;
+    std::atomic<bool> async_enabled;
+    std::unique_ptr<AsyncState> async;
+
     void write(const char *tag, const char *color,
                 const char *fmt, va_list ap);
     void set_color();
+    ThreadState &get_thread_state();
+    std::string format_line(const struct timeval &tv,
+                            const char *tag, const char *color,
+                            const char *msg, size_t len, uint64_t nsuppressed);
 
     public:
-    Logger(const char *prefix, int fd = 2):
-        output(fd), opened(false), prefix(prefix) { set_color(); }
-    Logger(const char *prefix, const char *filename):
-        opened(true), prefix(prefix) {
-        if ((output = open(filename, O_CREAT | O_WRONLY)) == -1)
-            throw SalticidaeError("logger cannot open file %s", filename);
-        set_color();
-    }
-
-    ~Logger() { if (opened) close(output); }
+    Logger(const char *prefix, int fd = 2);
+    Logger(const char *prefix, const char *filename);
+    ~Logger();
 
     void info(const char *fmt, ...);
     void debug(const char *fmt, ...);
     void warning(const char *fmt, ...);
     void error(const char *fmt, ...);
     bool is_tty() { return isatty(output); }
+
+    /** Format the lines on the calling thread into a per-thread lock-free
+     * ring of `ring_size` lines, and write them out from a background
+     * thread every `flush_interval` seconds (or sooner when a ring is half
+     * full). A line that finds its ring full is dropped and counted rather
+     * than blocking the caller. */
+    void enable_async(size_t ring_size = 1024, double flush_interval = 0.01);
+    /** Write out the pending lines and go back to writing synchronously. A
+     * line logged concurrently with this call may be lost. */
+    void disable_async();
+    /** Let at most `burst` lines from the same call site (format string)
+     * through per `period` seconds on each thread; the rest are suppressed
+     * and counted on the next line from that site. A zero burst turns the
+     * limit off. Set it before other threads start logging. */
+    void set_rate_limit(size_t burst, double period = 1);
+    /** The number of lines dropped because a ring was full. */
+    uint64_t get_ndropped() const;
+    /** The number of lines suppressed by the rate limit. */
+    uint64_t get_nsuppressed() const { return nsuppressed.load(std::memory_order_relaxed); }
 };
 
 extern Logger logger;
@@ -26,6 +26,8 @@
 #include <cassert>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
 #include <netinet/tcp.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -58,6 +60,23 @@ ConnPool::Conn::operator std::string() const {
     return std::string(std::move(s));
 }
 
+#ifdef SALTICIDAE_MSG_STAT
+/* called by the dispatcher, which closes the fd, so the fd is still valid */
+size_t ConnPool::Conn::get_kernel_send_queue() const {
+#ifdef TIOCOUTQ
+    int n;
+    if (fd != -1 && ioctl(fd, TIOCOUTQ, &n) == 0) return n;
+#endif
+    return 0;
+}
+
+size_t ConnPool::Conn::get_kernel_recv_queue() const {
+    int n;
+    if (fd != -1 && ioctl(fd, FIONREAD, &n) == 0) return n;
+    return 0;
+}
+#endif
+
 /* the following functions are executed by exactly one worker per Conn object */
 
 void ConnPool::Conn::_send_data(const conn_t &conn, int fd, int events) {
@@ -66,37 +85,79 @@ void ConnPool::Conn::_send_data(const conn_t &conn, int fd, int events) {
         conn->cpool->worker_terminate(conn);
         return;
     }
-    ssize_t ret = conn->recv_chunk_size;
+    using buffer_entry_t = MPSCWriteBuffer::buffer_entry_t;
+    /* shared by all connections handled by the same worker */
+    static thread_local std::vector<buffer_entry_t> segs;
+    static thread_local std::vector<struct iovec> iov;
+    const size_t send_burst_size = conn->send_burst_size;
+    if (segs.size() < send_burst_size)
+    {
+        segs.resize(send_burst_size);
+        /* each segment takes at most two iovecs (header and data) */
+        iov.resize(send_burst_size << 1);
+    }
     for (;;)
     {
-        bytearray_t buff_seg = conn->send_buffer.move_pop();
-        ssize_t size = buff_seg.size();
-        if (!size) break;
-        ret = send(fd, buff_seg.data(), size, 0);
-        SALTICIDAE_LOG_DEBUG("socket(%d) sent %zd bytes", fd, ret);
-        size -= ret;
-        if (size > 0)
+        /* gather up to send_burst_size segments for one writev() */
+        size_t nseg = 0, niov = 0;
+        ssize_t size = 0;
+        for (; nseg < send_burst_size; nseg++)
         {
-            if (ret < 1) /* nothing is sent */
-            {
-                /* rewind the whole buff_seg */
-                conn->send_buffer.rewind(std::move(buff_seg));
-                if (ret < 0 && errno != EWOULDBLOCK)
-                {
-                    SALTICIDAE_LOG_INFO("send(%d) failure: %s", fd, strerror(errno));
-                    conn->cpool->worker_terminate(conn);
-                    return;
-                }
-            }
-            else
-                /* rewind the leftover */
-                conn->send_buffer.rewind(
-                    bytearray_t(buff_seg.begin() + ret, buff_seg.end()));
-            /* wait for the next write callback */
-            conn->ready_send = false;
+            auto &seg = segs[nseg];
+            seg = conn->send_buffer.move_pop();
+            if (!seg.length()) break;
+            niov += seg.get_iovec(&iov[niov]);
+            size += seg.length();
+        }
+        if (!nseg) break;
+        ssize_t ret = writev(fd, iov.data(), niov);
+        SALTICIDAE_LOG_DEBUG("socket(%d) sent %zd bytes (%zu segments)", fd, ret, nseg);
+        if (ret > 0)
+            conn->send_buff_bytes.fetch_sub(ret, std::memory_order_relaxed);
+#ifdef SALTICIDAE_MSG_STAT
+        auto &io_stat = conn->get_worker()->get_io_stat();
+        if (ret > 0)
+        {
+            io_stat.nwrite.add();
+            io_stat.nwriteb.add(ret);
+        }
+#endif
+        if (ret == size)
+        {
+            for (size_t i = 0; i < nseg; i++) segs[i] = buffer_entry_t();
+#ifdef SALTICIDAE_MSG_STAT
+            conn->nsendq.fetch_sub(nseg, std::memory_order_relaxed);
+#endif
+            continue;
+        }
+        /* find the first segment that is not completely sent */
+        size_t sent = ret < 0 ? 0 : ret;
+        size_t i = 0;
+        for (; sent >= segs[i].length(); i++)
+            sent -= segs[i].length();
+#ifdef SALTICIDAE_MSG_STAT
+        io_stat.npartial_write.add();
+        conn->nsendq.fetch_sub(i, std::memory_order_relaxed);
+#endif
+        /* rewind the unsent segments from the back (rewind pushes to the
+         * front), the partially sent one only advances its offset so the
+         * leftover is not copied */
+        segs[i].offset += sent;
+        for (size_t j = nseg; j-- > i;)
+            conn->send_buffer.rewind(std::move(segs[j]));
+        for (size_t j = 0; j <= i; j++) segs[j] = buffer_entry_t();
+        if (ret < 0 && errno != EWOULDBLOCK)
+        {
+            SALTICIDAE_LOG_INFO("send(%d) failure: %s", fd, strerror(errno));
+            conn->cpool->worker_terminate(conn);
             return;
         }
+        conn->cpool->update_send_buff(conn);
+        /* wait for the next write callback */
+        conn->ready_send = false;
+        return;
     }
+    conn->cpool->update_send_buff(conn);
     /* the send_buffer is empty though the kernel buffer is still available, so
      * temporarily mask the WRITE event and mark the `ready_send` flag */
     conn->ev_socket.del();
@@ -110,21 +171,31 @@ void ConnPool::Conn::_recv_data(const conn_t &conn, int fd, int events) {
         conn->cpool->worker_terminate(conn);
         return;
     }
-    const size_t recv_chunk_size = conn->recv_chunk_size;
-    ssize_t ret = recv_chunk_size;
-    while (ret == (ssize_t)recv_chunk_size)
+    bool full = false;
+    for (;;)
     {
         if (conn->recv_buffer.len() >= conn->max_recv_buff_size)
         {
-            /* recv_buffer is full, temporarily mask the READ event */
+            /* recv_buffer is full, temporarily mask the READ event, the
+             * buffered data is still parsed below */
             conn->ev_socket.del();
             conn->ev_socket.add(conn->ready_send ? 0 : FdEvent::WRITE);
-            conn->ready_recv = true;
-            return;
+            full = true;
+            break;
         }
-        bytearray_t buff_seg;
-        buff_seg.resize(recv_chunk_size);
-        ret = recv(fd, buff_seg.data(), recv_chunk_size, 0);
+        size_t size = conn->recv_chunk_size;
+        /* read all that is available if it fits (an empty socket still
+         * needs a recv() to tell EOF from a spurious wakeup) */
+        int avail = 0;
+        bool exact = false;
+        if (conn->recv_exact &&
+            ioctl(fd, FIONREAD, &avail) == 0 && avail > 0)
+        {
+            size = std::min((size_t)avail, conn->recv_chunk_max);
+            exact = size == (size_t)avail;
+        }
+        bytearray_t buff_seg = conn->get_worker()->get_chunk_pool().get(size);
+        ssize_t ret = recv(fd, buff_seg.data(), size, 0);
         SALTICIDAE_LOG_DEBUG("socket(%d) read %zd bytes", fd, ret);
         if (ret < 0)
         {
@@ -142,13 +213,31 @@ void ConnPool::Conn::_recv_data(const conn_t &conn, int fd, int events) {
         }
         buff_seg.resize(ret);
         conn->recv_buffer.push(std::move(buff_seg));
+#ifdef SALTICIDAE_MSG_STAT
+        auto &io_stat = conn->get_worker()->get_io_stat();
+        io_stat.nread.add();
+        io_stat.nreadb.add(ret);
+#endif
+        /* the socket is drained, no need to try until EAGAIN */
+        if (exact) break;
+        if (!avail) conn->adapt_recv_chunk_size(ret);
+        if ((size_t)ret < size) break;
     }
-    /* wait for the next read callback */
-    conn->ready_recv = false;
+    /* wait for the next read callback, or for on_read() to resume reading */
+    conn->ready_recv = full;
+#ifdef SALTICIDAE_MSG_TRACE
+    conn->recv_ts = get_monotonic_ns();
+#endif
     conn->cpool->on_read(conn);
+#ifdef SALTICIDAE_MSG_STAT
+    conn->recv_buff_size.set(conn->recv_buffer.size());
+#endif
 }
 
 
+/* the maximum plaintext size of a TLS record */
+static const size_t tls_coalesce_size = 16384;
+
 void ConnPool::Conn::_send_data_tls(const conn_t &conn, int fd, int events) {
     if (events & FdEvent::ERROR)
     {
@@ -157,16 +246,57 @@ void ConnPool::Conn::_send_data_tls(const conn_t &conn, int fd, int events) {
     }
     ssize_t ret = conn->recv_chunk_size;
     auto &tls = conn->tls;
+    size_t nbytes = 0;
     for (;;)
     {
-        bytearray_t buff_seg = conn->send_buffer.move_pop();
-        ssize_t size = buff_seg.size();
-        if (!size) break;
-        ret = tls->send(buff_seg.data(), size);
-        SALTICIDAE_LOG_DEBUG("ssl(%d) sent %zd bytes", fd, ret);
-        size -= ret;
-        if (size > 0)
+        if (conn->tls_io_budget && nbytes >= conn->tls_io_budget)
         {
+            /* yield with WRITE still polled (it is level-triggered), the
+             * rest is sent in the next loop iteration */
+            conn->cpool->update_send_buff(conn);
+            conn->ready_send = false;
+            return;
+        }
+        auto buff_seg = conn->send_buffer.move_pop();
+        if (!buff_seg.length()) break;
+        struct iovec iov[2];
+        /* SSL_write() is not vectored, send one piece at a time */
+        while (size_t niov = buff_seg.get_iovec(iov))
+        {
+            ssize_t size = iov[0].iov_len;
+            const void *ptr = iov[0].iov_base;
+            if (niov == 2 && iov[0].iov_len + iov[1].iov_len <= tls_coalesce_size)
+            {
+                /* a small message goes into a single TLS record (the retry may
+                 * use another buffer as long as the content is the same) */
+                static thread_local bytearray_t scratch;
+                scratch.resize(iov[0].iov_len + iov[1].iov_len);
+                memmove(scratch.data(), iov[0].iov_base, iov[0].iov_len);
+                memmove(scratch.data() + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+                size = scratch.size();
+                ptr = scratch.data();
+            }
+            ret = tls->send(ptr, size);
+            SALTICIDAE_LOG_DEBUG("ssl(%d) sent %zd bytes", fd, ret);
+            if (ret > 0)
+                conn->send_buff_bytes.fetch_sub(ret, std::memory_order_relaxed);
+#ifdef SALTICIDAE_MSG_STAT
+            auto &io_stat = conn->get_worker()->get_io_stat();
+            if (ret > 0)
+            {
+                io_stat.nwrite.add();
+                io_stat.nwriteb.add(ret);
+            }
+#endif
+            if (ret == size)
+            {
+                buff_seg.offset += ret;
+                nbytes += ret;
+                continue;
+            }
+#ifdef SALTICIDAE_MSG_STAT
+            io_stat.npartial_write.add();
+#endif
             if (ret < 1) /* nothing is sent */
             {
                 /* rewind the whole buff_seg */
@@ -179,14 +309,21 @@ void ConnPool::Conn::_send_data_tls(const conn_t &conn, int fd, int events) {
                 }
             }
             else
+            {
                 /* rewind the leftover */
-                conn->send_buffer.rewind(
-                    bytearray_t(buff_seg.begin() + ret, buff_seg.end()));
+                buff_seg.offset += ret;
+                conn->send_buffer.rewind(std::move(buff_seg));
+            }
+            conn->cpool->update_send_buff(conn);
             /* wait for the next write callback */
             conn->ready_send = false;
             return;
         }
+#ifdef SALTICIDAE_MSG_STAT
+        conn->nsendq.fetch_sub(1, std::memory_order_relaxed);
+#endif
     }
+    conn->cpool->update_send_buff(conn);
     conn->ev_socket.del();
     conn->ev_socket.add(conn->ready_recv ? 0 : FdEvent::READ);
     conn->ready_send = true;
@@ -198,21 +335,21 @@ void ConnPool::Conn::_recv_data_tls(const conn_t &conn, int fd, int events) {
         conn->cpool->worker_terminate(conn);
         return;
     }
-    const size_t recv_chunk_size = conn->recv_chunk_size;
-    ssize_t ret = recv_chunk_size;
     auto &tls = conn->tls;
-    while (ret == (ssize_t)recv_chunk_size)
+    bool full = false;
+    size_t nbytes = 0;
+    for (;;)
     {
         if (conn->recv_buffer.len() >= conn->max_recv_buff_size)
         {
             conn->ev_socket.del();
             conn->ev_socket.add(conn->ready_send ? 0 : FdEvent::WRITE);
-            conn->ready_recv = true;
-            return;
+            full = true;
+            break;
         }
-        bytearray_t buff_seg;
-        buff_seg.resize(recv_chunk_size);
-        ret = tls->recv(buff_seg.data(), recv_chunk_size);
+        const size_t size = conn->recv_chunk_size;
+        bytearray_t buff_seg = conn->get_worker()->get_chunk_pool().get(size);
+        ssize_t ret = tls->recv(buff_seg.data(), size);
         SALTICIDAE_LOG_DEBUG("ssl(%d) read %zd bytes", fd, ret);
         if (ret < 0)
         {
@@ -228,9 +365,28 @@ void ConnPool::Conn::_recv_data_tls(const conn_t &conn, int fd, int events) {
         }
         buff_seg.resize(ret);
         conn->recv_buffer.push(std::move(buff_seg));
+#ifdef SALTICIDAE_MSG_STAT
+        auto &io_stat = conn->get_worker()->get_io_stat();
+        io_stat.nread.add();
+        io_stat.nreadb.add(ret);
+#endif
+        conn->adapt_recv_chunk_size(ret);
+        if ((size_t)ret < size) break;
+        /* yield once over the budget, unless OpenSSL holds bytes that
+         * would not make the socket readable again */
+        nbytes += ret;
+        if (conn->tls_io_budget && nbytes >= conn->tls_io_budget &&
+            !tls->has_pending())
+            break;
     }
-    conn->ready_recv = false;
+    conn->ready_recv = full;
+#ifdef SALTICIDAE_MSG_TRACE
+    conn->recv_ts = get_monotonic_ns();
+#endif
     conn->cpool->on_read(conn);
+#ifdef SALTICIDAE_MSG_STAT
+    conn->recv_buff_size.set(conn->recv_buffer.size());
+#endif
 }
 
 void ConnPool::Conn::_send_data_tls_handshake(const conn_t &conn, int fd, int events) {
@@ -243,13 +399,29 @@ void ConnPool::Conn::_recv_data_tls_handshake(const conn_t &conn, int, int) {
     if (conn->tls->do_handshake(ret))
     {
         /* finishing TLS handshake */
-        conn->send_data_func = _send_data_tls;
+        auto &tls = conn->tls;
+        /* with kTLS, the records are sealed by the kernel, so the messages
+         * are written with writev() as on a plain socket; the receiving
+         * still goes through SSL_read(), which handles the non-data records
+         * (e.g., session tickets) and is decrypted by the kernel if kTLS
+         * also covers that direction */
+        conn->send_data_func = tls->is_ktls_send() ? _send_data : _send_data_tls;
         /* do not start receiving data immediately */
         conn->recv_data_func = _recv_data_dummy;
         conn->ev_socket.del();
         //conn->ev_socket.add(FdEvent::WRITE);
-        conn->peer_cert = new X509(conn->tls->get_peer_cert());
-        conn->worker->enable_send_buffer(conn, conn->fd);
+        conn->peer_cert = new X509(tls->get_peer_cert());
+#ifdef SALTICIDAE_MSG_STAT
+        auto &io_stat = conn->get_worker()->get_io_stat();
+        io_stat.ntls_handshake.add();
+        if (tls->is_resumed()) io_stat.ntls_resumed.add();
+        if (tls->is_ktls_send()) io_stat.ntls_ktls.add();
+        io_stat.tls_handshake_time.add(get_monotonic_ns() - conn->tls_start_ts);
+#endif
+        SALTICIDAE_LOG_DEBUG("tls handshake done (%s, ktls send %d recv %d)",
+                tls->is_resumed() ? "resumed" : "full",
+                tls->is_ktls_send(), tls->is_ktls_recv());
+        conn->get_worker()->enable_send_buffer(conn, conn->fd);
         auto cpool = conn->cpool;
         cpool->on_worker_setup(conn);
         cpool->disp_tcall->async_call([cpool, conn](ThreadCall::Handle &) {
@@ -272,8 +444,216 @@ void ConnPool::Conn::_recv_data_tls_handshake(const conn_t &conn, int, int) {
 
 void ConnPool::Conn::_recv_data_dummy(const conn_t &, int, int) {}
 
+#ifdef SALTICIDAE_IO_URING
+/* With io_uring, a read (or write) request is posted and the data is
+ * handled upon its completion, so each transfer takes no extra readiness
+ * notification, and the requests of all connections of a worker are
+ * submitted together once per loop iteration. The receive chunk is read
+ * into directly. At most one read and one write are in flight per
+ * connection, and each holds a reference to the connection until it
+ * completes. */
+
+void ConnPool::Conn::_recv_data_uring(const conn_t &conn, int fd, int) {
+    if (conn->uring_recv_op.conn) return;
+    if (conn->recv_buffer.len() >= conn->max_recv_buff_size)
+    {
+        /* recv_buffer is full, on_read() resumes reading once drained */
+        conn->ready_recv = true;
+        return;
+    }
+    conn->ready_recv = false;
+    auto worker = conn->get_worker();
+    auto &buff = conn->uring_recv_buff;
+    buff = worker->get_chunk_pool().get(conn->recv_chunk_size);
+    auto sqe = worker->get_uring()->get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)buff.data();
+    sqe->len = buff.size();
+    sqe->user_data = (uint64_t)&conn->uring_recv_op;
+    conn->uring_recv_op.conn = conn;
+    worker->schedule_uring_submit();
+}
+
+void ConnPool::Conn::_recv_done_uring(const conn_t &conn, int res) {
+    auto buff_seg = std::move(conn->uring_recv_buff);
+    if (conn->is_terminated() || res == -ECANCELED) return;
+    if (res <= 0)
+    {
+        /* connection err, or the remote closes the connection */
+        if (res < 0)
+            SALTICIDAE_LOG_INFO("recv(%d) failure: %s", conn->fd, strerror(-res));
+        conn->cpool->worker_terminate(conn);
+        return;
+    }
+    SALTICIDAE_LOG_DEBUG("socket(%d) read %d bytes", conn->fd, res);
+    conn->adapt_recv_chunk_size(res);
+    buff_seg.resize(res);
+    conn->recv_buffer.push(std::move(buff_seg));
+#ifdef SALTICIDAE_MSG_STAT
+    auto &io_stat = conn->get_worker()->get_io_stat();
+    io_stat.nread.add();
+    io_stat.nreadb.add(res);
+#endif
+#ifdef SALTICIDAE_MSG_TRACE
+    conn->recv_ts = get_monotonic_ns();
+#endif
+    /* the next read is in flight while the data is parsed */
+    _recv_data_uring(conn, conn->fd, FdEvent::READ);
+    conn->cpool->on_read(conn);
+#ifdef SALTICIDAE_MSG_STAT
+    conn->recv_buff_size.set(conn->recv_buffer.size());
+#endif
+}
+
+void ConnPool::Conn::_send_data_uring(const conn_t &conn, int fd, int) {
+    if (conn->uring_send_op.conn) return;
+    auto &segs = conn->uring_segs;
+    auto &iov = conn->uring_iov;
+    const size_t send_burst_size = conn->send_burst_size;
+    if (iov.size() < send_burst_size * 2)
+    {
+        segs.reserve(send_burst_size);
+        iov.resize(send_burst_size * 2);
+    }
+    size_t niov = 0;
+    while (segs.size() < send_burst_size)
+    {
+        auto seg = conn->send_buffer.move_pop();
+        if (!seg.length()) break;
+        niov += seg.get_iovec(&iov[niov]);
+        segs.push_back(std::move(seg));
+    }
+    if (segs.empty())
+    {
+        /* nothing to send, wait for the send_buffer to notify */
+        conn->ready_send = true;
+        return;
+    }
+    conn->ready_send = false;
+    auto worker = conn->get_worker();
+    auto sqe = worker->get_uring()->get_sqe();
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)iov.data();
+    sqe->len = niov;
+    sqe->user_data = (uint64_t)&conn->uring_send_op;
+    conn->uring_send_op.conn = conn;
+    worker->schedule_uring_submit();
+}
+
+void ConnPool::Conn::_send_done_uring(const conn_t &conn, int res) {
+    auto &segs = conn->uring_segs;
+    if (conn->is_terminated() || res == -ECANCELED)
+    {
+        segs.clear();
+        return;
+    }
+    if (res < 0)
+    {
+        SALTICIDAE_LOG_INFO("send(%d) failure: %s", conn->fd, strerror(-res));
+        segs.clear();
+        conn->cpool->worker_terminate(conn);
+        return;
+    }
+    SALTICIDAE_LOG_DEBUG("socket(%d) sent %d bytes (%zu segments)",
+                        conn->fd, res, segs.size());
+#ifdef SALTICIDAE_MSG_STAT
+    auto &io_stat = conn->get_worker()->get_io_stat();
+    io_stat.nwrite.add();
+    io_stat.nwriteb.add(res);
+#endif
+    conn->send_buff_bytes.fetch_sub(res, std::memory_order_relaxed);
+    conn->cpool->update_send_buff(conn);
+    size_t sent = res;
+    size_t i = 0;
+    for (; i < segs.size() && sent >= segs[i].length(); i++)
+        sent -= segs[i].length();
+#ifdef SALTICIDAE_MSG_STAT
+    if (i < segs.size()) io_stat.npartial_write.add();
+    conn->nsendq.fetch_sub(i, std::memory_order_relaxed);
+#endif
+    if (i < segs.size())
+    {
+        /* rewind the unsent segments (see _send_data) */
+        segs[i].offset += sent;
+        for (size_t j = segs.size(); j-- > i;)
+            conn->send_buffer.rewind(std::move(segs[j]));
+    }
+    segs.clear();
+    /* go on with the rest, if any */
+    _send_data_uring(conn, conn->fd, FdEvent::WRITE);
+}
+
+bool ConnPool::Worker::enable_uring(unsigned entries) {
+    try {
+        uring = new IOUring(entries);
+    } catch (SalticidaeError &e) {
+        SALTICIDAE_LOG_WARN("failed to set up io_uring: %s", e.what());
+        return false;
+    }
+    ev_uring = FdEvent(ec, uring->get_notify_fd(), [this](int, int) {
+        on_uring_ready();
+    });
+    ev_uring.add(FdEvent::READ);
+    ev_uring_submit = TimerEvent(ec, [this](TimerEvent &) {
+        uring_submit_pending = false;
+        try {
+            uring->submit();
+        } catch (...) { on_fatal_error(std::current_exception()); }
+    });
+    return true;
+}
+
+void ConnPool::Worker::on_uring_ready() {
+    uring->reset_notify();
+    uring->reap([](uint64_t data, int res) {
+        auto op = reinterpret_cast<Conn::uring_op_t *>(data);
+        /* the request no longer holds the connection (a moved-from
+         * conn_t is not null) */
+        auto conn = op->conn;
+        op->conn = conn_t();
+        try {
+            if (op->is_send)
+                Conn::_send_done_uring(conn, res);
+            else
+                Conn::_recv_done_uring(conn, res);
+        } catch (...) {
+            conn->cpool->recoverable_error(std::current_exception(), -1);
+            conn->cpool->worker_terminate(conn);
+        }
+    });
+    /* follow-up requests go out right away */
+    try {
+        uring->submit();
+    } catch (...) { on_fatal_error(std::current_exception()); }
+}
+
+void ConnPool::Worker::cancel_uring(const conn_t &conn) {
+    /* the completions (with -ECANCELED) release the connection */
+    bool cancelled = false;
+    for (auto op: {&conn->uring_recv_op, &conn->uring_send_op})
+        if (op->conn)
+        {
+            uring->cancel((uint64_t)op);
+            cancelled = true;
+        }
+    if (cancelled) schedule_uring_submit();
+}
+
+void ConnPool::Worker::drain_uring() {
+    if (!uring) return;
+    try {
+        uring->drain([](uint64_t data, int) {
+            auto op = reinterpret_cast<Conn::uring_op_t *>(data);
+            op->conn = conn_t();
+        });
+    } catch (...) { on_fatal_error(std::current_exception()); }
+}
+#endif
+
 void ConnPool::worker_terminate(const conn_t &conn) {
-    conn->worker->get_tcall()->async_call([this, conn](ThreadCall::Handle &) {
+    conn_async_call(conn, [this, conn](ThreadCall::Handle &) {
         if (!conn->set_terminated()) return;
         on_worker_teardown(conn);
         //conn->stop();
@@ -286,7 +666,7 @@ void ConnPool::worker_terminate(const conn_t &conn) {
 /****/
 
 void ConnPool::disp_terminate(const conn_t &conn) {
-    auto worker = conn->worker;
+    auto worker = conn->get_worker();
     if (worker)
         worker_terminate(conn);
     else
@@ -298,12 +678,27 @@ void ConnPool::disp_terminate(const conn_t &conn) {
         });
 }
 
+void ConnPool::init_conn(const conn_t &conn, int fd, Conn::ConnMode mode, const NetAddr &addr) {
+    conn->send_buffer.set_capacity(max_send_buff_size);
+    conn->recv_chunk_size = std::min(std::max(recv_chunk_size, recv_chunk_min), recv_chunk_max);
+    conn->recv_chunk_min = recv_chunk_min;
+    conn->recv_chunk_max = recv_chunk_max;
+    conn->recv_exact = recv_exact;
+    conn->max_recv_buff_size = max_recv_buff_size;
+    conn->send_burst_size = send_burst_size;
+    conn->tls_io_budget = tls_io_budget;
+    conn->fd = fd;
+    conn->cpool = this;
+    conn->mode = mode;
+    conn->addr = addr;
+}
+
 void ConnPool::accept_client(int fd, int) {
     int client_fd;
-    struct sockaddr client_addr;
+    struct sockaddr_storage client_addr;
     try {
-        socklen_t addr_size = sizeof(struct sockaddr_in);
-        if ((client_fd = accept(fd, &client_addr, &addr_size)) < 0)
+        socklen_t addr_size = sizeof(client_addr);
+        if ((client_fd = accept(fd, (struct sockaddr *)&client_addr, &addr_size)) < 0)
         {
             ev_listen.del();
             throw ConnPoolError(SALTI_ERROR_ACCEPT, errno);
@@ -316,32 +711,237 @@ void ConnPool::accept_client(int fd, int) {
             if (fcntl(client_fd, F_SETFL, O_NONBLOCK) == -1)
                 throw ConnPoolError(SALTI_ERROR_ACCEPT, errno);
 
-            NetAddr addr((struct sockaddr_in *)&client_addr);
+            NetAddr addr((struct sockaddr *)&client_addr);
             conn_t conn = create_conn();
-            conn->send_buffer.set_capacity(max_send_buff_size);
-            conn->recv_chunk_size = recv_chunk_size;
-            conn->max_recv_buff_size = max_recv_buff_size;
-            conn->fd = client_fd;
-            conn->cpool = this;
-            conn->mode = Conn::PASSIVE;
-            conn->addr = addr;
+            init_conn(conn, client_fd, Conn::PASSIVE, addr);
             add_conn(conn);
             SALTICIDAE_LOG_INFO("accepted %s", std::string(*conn).c_str());
-            auto &worker = select_worker();
-            conn->worker = &worker;
+            auto &worker = select_worker(conn);
+            conn->worker.store(&worker, std::memory_order_release);
             worker.feed(conn, client_fd);
         }
     } catch (...) { recoverable_error(std::current_exception(), -1); }
 }
 
+void ConnPool::worker_accept_client(Worker &worker, int fd) {
+    int client_fd;
+    struct sockaddr_storage client_addr;
+    try {
+        socklen_t addr_size = sizeof(client_addr);
+        if ((client_fd = accept(fd, (struct sockaddr *)&client_addr, &addr_size)) < 0)
+        {
+            /* another worker may win the race for the same connection */
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            worker.get_ev_listen().del();
+            throw ConnPoolError(SALTI_ERROR_ACCEPT, errno);
+        }
+        int one = 1;
+        if (setsockopt(client_fd, SOL_TCP, TCP_NODELAY, (const char *)&one, sizeof(one)) < 0 ||
+            fcntl(client_fd, F_SETFL, O_NONBLOCK) == -1)
+        {
+            close(client_fd);
+            throw ConnPoolError(SALTI_ERROR_ACCEPT, errno);
+        }
+        NetAddr addr((struct sockaddr *)&client_addr);
+        conn_t conn = create_conn();
+        init_conn(conn, client_fd, Conn::PASSIVE, addr);
+        conn->worker.store(&worker, std::memory_order_release);
+        /* queued before the setup, so the dispatcher knows the connection
+         * before any of its updates (and a possible termination) */
+        disp_tcall->async_call([this, conn](ThreadCall::Handle &) {
+            add_conn(conn);
+            SALTICIDAE_LOG_INFO("accepted %s", std::string(*conn).c_str());
+        });
+        worker.accept(conn, client_fd);
+    } catch (...) { recoverable_error(std::current_exception(), -1); }
+}
+
+/* Jump consistent hash (Lamping and Veach): only 1/n of the keys move when a
+ * bucket is added. */
+static size_t jump_hash(uint64_t key, size_t n) {
+    int64_t b = -1, j = 0;
+    while (j < (int64_t)n)
+    {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (b + 1) * (double(1LL << 31) / double((key >> 33) + 1));
+    }
+    return b;
+}
+
+static uint64_t mix64(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+size_t ConnPool::select_least_conn(const std::vector<size_t> &cands) const {
+    size_t idx = cands[0];
+    size_t best = workers[idx].get_nconn();
+    for (auto i: cands)
+    {
+        size_t t = workers[i].get_nconn();
+        if (t < best)
+        {
+            best = t;
+            idx = i;
+        }
+    }
+    return idx;
+}
+
+size_t ConnPool::select_least_bytes(const std::vector<size_t> &cands) {
+#ifdef SALTICIDAE_MSG_STAT
+    /* resample the traffic of each worker at most once a second */
+    auto now = get_monotonic_ns();
+    if (now - traffic_ts >= 1000000000)
+    {
+        for (size_t i = 0; i < nworker; i++)
+        {
+            const auto &s = workers[i].get_io_stat();
+            uint64_t t = s.nreadb + s.nwriteb;
+            traffic_recent[i] = t - traffic_base[i];
+            traffic_base[i] = t;
+        }
+        traffic_ts = now;
+    }
+    size_t idx = cands[0];
+    uint64_t total = 0, nconn = 0;
+    for (auto i: cands)
+    {
+        total += traffic_recent[i];
+        nconn += workers[i].get_nconn();
+        if (traffic_recent[i] < traffic_recent[idx] ||
+            (traffic_recent[i] == traffic_recent[idx] &&
+            workers[i].get_nconn() < workers[idx].get_nconn()))
+            idx = i;
+    }
+    /* assume the new connection brings the average traffic, so that the
+     * connections arriving before the next sample are spread */
+    traffic_recent[idx] += total / std::max(nconn, (uint64_t)1);
+    return idx;
+#else
+    return select_least_conn(cands);
+#endif
+}
+
+bool ConnPool::find_pinned_worker(const NetAddr &addr, size_t &idx) const {
+    if (pinned_addrs.empty()) return false;
+    auto it = pinned_addrs.find(addr);
+    if (it == pinned_addrs.end())
+        it = pinned_addrs.find(addr.get_host());
+    if (it == pinned_addrs.end()) return false;
+    idx = it->second;
+    return true;
+}
+
+ConnPool::Worker &ConnPool::select_worker(const conn_t &conn) {
+    const auto &addr = conn->addr;
+    size_t pinned;
+    if (find_pinned_worker(addr, pinned))
+        return workers[pinned];
+    if (worker_selector)
+        return workers[worker_selector(conn, nworker) % nworker];
+    /* the pinned workers are dedicated */
+    std::vector<size_t> cands;
+    cands.reserve(nworker);
+    for (size_t i = 0; i < nworker; i++)
+        if (!npinned[i]) cands.push_back(i);
+    if (cands.empty())
+        for (size_t i = 0; i < nworker; i++) cands.push_back(i);
+    switch (worker_policy)
+    {
+        case WORKER_HASH_ADDR:
+        {
+            /* the identity of a peer is unknown before the handshake, so
+             * hash its listening address for an active connection and only
+             * its IP for a passive one (whose port is ephemeral) */
+            uint64_t key = addr.is_ipv6() ? addr.get_host().get_hash() : addr.ip;
+            if (conn->mode == Conn::ACTIVE)
+                key = (key << 16) | addr.port;
+            return workers[cands[jump_hash(mix64(key), cands.size())]];
+        }
+        case WORKER_LEAST_BYTES:
+            return workers[select_least_bytes(cands)];
+        default:
+            return workers[select_least_conn(cands)];
+    }
+}
+
+void ConnPool::_migrate(const conn_t &conn, size_t idx) {
+    auto it = pool.find(conn->fd);
+    if (it == pool.end() || it->second != conn) return;
+    auto src = conn->get_worker();
+    auto dst = &workers[idx];
+    if (!src || src == dst || conn->migrating || conn->is_terminated()) return;
+    conn->migrating = true;
+    src->get_tcall()->async_call([this, conn, dst](ThreadCall::Handle &) {
+        /* only an established connection is moved, the setup (and the TLS
+         * handshake) always finishes on the worker it started */
+        bool movable = !conn->is_terminated() && conn->polling;
+#ifdef SALTICIDAE_IO_URING
+        /* its requests are in flight on the ring of this worker (see
+         * Config::io_uring_entries()) */
+        movable = movable && !conn->uring;
+#endif
+        if (movable)
+        {
+            try {
+                on_worker_detach(conn);
+                conn->get_worker()->unfeed();
+                /* the tasks still sent to this worker will be forwarded by
+                 * conn_async_call() */
+                conn->worker.store(dst, std::memory_order_release);
+                dst->adopt(conn);
+                return;
+            } catch (...) {
+                conn->get_worker()->error_callback(std::current_exception());
+            }
+        }
+        disp_tcall->async_call([conn](ThreadCall::Handle &) {
+            conn->migrating = false;
+        });
+    });
+}
+
+void ConnPool::_rebalance() {
+    std::vector<std::vector<conn_t>> owned(nworker);
+    for (const auto &p: pool)
+    {
+        auto &conn = p.second;
+        size_t pinned;
+        if (!conn->get_worker() || conn->migrating || conn->is_terminated() ||
+            find_pinned_worker(conn->addr, pinned))
+            continue;
+        owned[conn->get_worker()->get_id()].push_back(conn);
+    }
+    std::vector<size_t> cands;
+    for (size_t i = 0; i < nworker; i++)
+        if (!npinned[i]) cands.push_back(i);
+    if (cands.size() < 2) return;
+    auto by_size = [&owned](size_t a, size_t b) {
+        return owned[a].size() < owned[b].size();
+    };
+    for (;;)
+    {
+        auto min = *std::min_element(cands.begin(), cands.end(), by_size);
+        auto max = *std::max_element(cands.begin(), cands.end(), by_size);
+        if (owned[max].size() <= owned[min].size() + 1) break;
+        auto conn = std::move(owned[max].back());
+        owned[max].pop_back();
+        _migrate(conn, min);
+        owned[min].push_back(std::move(conn));
+    }
+}
+
 void ConnPool::conn_server(const conn_t &conn, int fd, int events) {
     try {
         if (send(fd, "", 0, 0) == 0)
         {
             conn->ev_connect.del();
             SALTICIDAE_LOG_INFO("connected to remote %s", std::string(*conn).c_str());
-            auto &worker = select_worker();
-            conn->worker = &worker;
+            auto &worker = select_worker(conn);
+            conn->worker.store(&worker, std::memory_order_release);
             worker.feed(conn, fd);
         }
         else
@@ -356,31 +956,87 @@ void ConnPool::conn_server(const conn_t &conn, int fd, int events) {
     }
 }
 
+int ConnPool::open_listen_socket(const NetAddr &listen_addr, bool reuse_port) {
+    int fd;
+    int one = 1, zero = 0;
+    int family = listen_addr.get_family();
+    if ((fd = socket(family, SOCK_STREAM, IPPROTO_TCP)) < 0)
+        throw ConnPoolError(SALTI_ERROR_LISTEN, errno);
+    try {
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&one, sizeof(one)) < 0 ||
+            setsockopt(fd, SOL_TCP, TCP_NODELAY, (const char *)&one, sizeof(one)) < 0)
+            throw ConnPoolError(SALTI_ERROR_LISTEN, errno);
+        /* an IPv6 listener also takes the IPv4 clients */
+        if (family == AF_INET6 &&
+            setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, (const char *)&zero, sizeof(zero)) < 0)
+            throw ConnPoolError(SALTI_ERROR_LISTEN, errno);
+        if (reuse_port)
+        {
+#ifdef SO_REUSEPORT
+            if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (const char *)&one, sizeof(one)) < 0)
+                throw ConnPoolError(SALTI_ERROR_LISTEN, errno);
+#else
+            throw ConnPoolError(SALTI_ERROR_NOT_AVAIL);
+#endif
+        }
+        if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
+            throw ConnPoolError(SALTI_ERROR_LISTEN, errno);
+
+        /* bind to the wildcard address of the family */
+        NetAddr any;
+        if (family == AF_INET6) any = NetAddr("::", 0);
+        any.port = listen_addr.port;
+        struct sockaddr_storage sockin;
+        socklen_t len = any.get_sockaddr(&sockin);
+
+        if (bind(fd, (struct sockaddr *)&sockin, len) < 0)
+            throw ConnPoolError(SALTI_ERROR_LISTEN, errno);
+        if (::listen(fd, max_listen_backlog) < 0)
+            throw ConnPoolError(SALTI_ERROR_LISTEN, errno);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    return fd;
+}
+
 void ConnPool::_listen(NetAddr listen_addr) {
-    int one = 1;
     if (listen_fd != -1)
     { /* reset the previous listen() */
         ev_listen.clear();
         close(listen_fd);
+        listen_fd = -1;
     }
-    if ((listen_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
-        throw ConnPoolError(SALTI_ERROR_LISTEN, errno);
-    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&one, sizeof(one)) < 0 ||
-        setsockopt(listen_fd, SOL_TCP, TCP_NODELAY, (const char *)&one, sizeof(one)) < 0)
-        throw ConnPoolError(SALTI_ERROR_LISTEN, errno);
-    if (fcntl(listen_fd, F_SETFL, O_NONBLOCK) == -1)
-        throw ConnPoolError(SALTI_ERROR_LISTEN, errno);
-
-    struct sockaddr_in sockin;
-    memset(&sockin, 0, sizeof(struct sockaddr_in));
-    sockin.sin_family = AF_INET;
-    sockin.sin_addr.s_addr = INADDR_ANY;
-    sockin.sin_port = listen_addr.port;
-
-    if (bind(listen_fd, (struct sockaddr *)&sockin, sizeof(sockin)) < 0)
-        throw ConnPoolError(SALTI_ERROR_LISTEN, errno);
-    if (::listen(listen_fd, max_listen_backlog) < 0)
-        throw ConnPoolError(SALTI_ERROR_LISTEN, errno);
+    for (size_t i = 0; i < nworker; i++)
+        workers[i].get_tcall()->async_call([this, i](ThreadCall::Handle &) {
+            workers[i].unlisten();
+        });
+    if (listen_per_worker)
+    {
+        /* all sockets are bound here, so an error reaches the caller */
+        std::vector<int> fds;
+        try {
+            for (size_t i = 0; i < nworker; i++)
+                fds.push_back(open_listen_socket(listen_addr, true));
+        } catch (...) {
+            for (auto fd: fds) close(fd);
+            throw;
+        }
+        for (size_t i = 0; i < nworker; i++)
+        {
+            int fd = fds[i];
+            workers[i].get_tcall()->async_call([this, i, fd](ThreadCall::Handle &) {
+                auto &worker = workers[i];
+                worker.listen(fd, [this, &worker](int fd, int) {
+                    worker_accept_client(worker, fd);
+                });
+            });
+        }
+        SALTICIDAE_LOG_INFO("listening to %u with %zu workers",
+                            ntohs(listen_addr.port), nworker);
+        return;
+    }
+    listen_fd = open_listen_socket(listen_addr, false);
     ev_listen = FdEvent(disp_ec, listen_fd,
                 std::bind(&ConnPool::accept_client, this, _1, _2));
     ev_listen.add(FdEvent::READ);
@@ -390,7 +1046,7 @@ void ConnPool::_listen(NetAddr listen_addr) {
 ConnPool::conn_t ConnPool::_connect(const NetAddr &addr) {
     int fd;
     int one = 1;
-    if ((fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+    if ((fd = socket(addr.get_family(), SOCK_STREAM, IPPROTO_TCP)) < 0)
         throw ConnPoolError(SALTI_ERROR_CONNECT, errno);
     if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&one, sizeof(one)) < 0 ||
         setsockopt(fd, SOL_TCP, TCP_NODELAY, (const char *)&one, sizeof(one)) < 0)
@@ -398,23 +1054,13 @@ ConnPool::conn_t ConnPool::_connect(const NetAddr &addr) {
     if (fcntl(fd, F_SETFL, O_NONBLOCK) == -1)
         throw ConnPoolError(SALTI_ERROR_CONNECT, errno);
     conn_t conn = create_conn();
-    conn->send_buffer.set_capacity(max_send_buff_size);
-    conn->recv_chunk_size = recv_chunk_size;
-    conn->max_recv_buff_size = max_recv_buff_size;
-    conn->fd = fd;
-    conn->cpool = this;
-    conn->mode = Conn::ACTIVE;
-    conn->addr = addr;
+    init_conn(conn, fd, Conn::ACTIVE, addr);
     add_conn(conn);
 
-    struct sockaddr_in sockin;
-    memset(&sockin, 0, sizeof(struct sockaddr_in));
-    sockin.sin_family = AF_INET;
-    sockin.sin_addr.s_addr = addr.ip;
-    sockin.sin_port = addr.port;
+    struct sockaddr_storage sockin;
+    socklen_t len = addr.get_sockaddr(&sockin);
 
-    if (::connect(fd, (struct sockaddr *)&sockin,
-                sizeof(struct sockaddr_in)) < 0 && errno != EINPROGRESS)
+    if (::connect(fd, (struct sockaddr *)&sockin, len) < 0 && errno != EINPROGRESS)
     {
         SALTICIDAE_LOG_INFO("cannot connect to %s", std::string(addr).c_str());
         disp_terminate(conn);
@@ -1,7 +1,85 @@
 #include "salticidae/config.h"
-#ifdef SALTICIDAE_CBINDINGS
 #include "salticidae/crypto.h"
 
+#include <cstring>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+namespace salticidae {
+
+/* Castagnoli polynomial (reflected) */
+static const uint32_t crc32c_poly = 0x82f63b78;
+
+static uint32_t _crc32c_sw(uint32_t crc, const uint8_t *data, size_t len) {
+    static const struct Table {
+        uint32_t t[256];
+        Table() {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                    c = c & 1 ? (c >> 1) ^ crc32c_poly : c >> 1;
+                t[i] = c;
+            }
+        }
+    } table;
+    for (; len; data++, len--)
+        crc = table.t[(crc ^ *data) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t _crc32c_hw(uint32_t crc, const uint8_t *data, size_t len) {
+    uint64_t c = crc;
+    for (; len >= 8; data += 8, len -= 8)
+    {
+        uint64_t v;
+        memmove(&v, data, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    crc = (uint32_t)c;
+    for (; len; data++, len--)
+        crc = _mm_crc32_u8(crc, *data);
+    return crc;
+}
+
+static const bool crc32c_hw_available = __builtin_cpu_supports("sse4.2");
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t _crc32c_hw(uint32_t crc, const uint8_t *data, size_t len) {
+    for (; len >= 8; data += 8, len -= 8)
+    {
+        uint64_t v;
+        memmove(&v, data, 8);
+        crc = __crc32cd(crc, v);
+    }
+    for (; len; data++, len--)
+        crc = __crc32cb(crc, *data);
+    return crc;
+}
+
+static const bool crc32c_hw_available = true;
+#endif
+
+uint32_t crc32c(uint32_t crc, const uint8_t *data, size_t len) {
+    crc = ~crc;
+#if defined(__x86_64__) || (defined(__aarch64__) && defined(__ARM_FEATURE_CRC32))
+    if (crc32c_hw_available)
+        return ~_crc32c_hw(crc, data, len);
+#endif
+    return ~_crc32c_sw(crc, data, len);
+}
+
+uint32_t crc32c_sw(uint32_t crc, const uint8_t *data, size_t len) {
+    return ~_crc32c_sw(~crc, data, len);
+}
+
+}
+
+#ifdef SALTICIDAE_CBINDINGS
 using namespace salticidae;
 
 extern "C" {
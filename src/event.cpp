@@ -97,6 +97,10 @@ void mpscqueue_set_capacity(mpscqueue_t *self, size_t cap) {
     self->set_capacity(cap);
 }
 
+void mpscqueue_set_spin_time(mpscqueue_t *self, double t) {
+    self->set_spin_time(t);
+}
+
 }
 
 #endif
@@ -14,6 +14,12 @@ datastream_t *msg_consume_payload(const msg_t *msg) {
     return new datastream_t(msg->get_payload());
 }
 
+const uint8_t *msg_get_payload_inplace(const msg_t *msg, size_t *len) {
+    const auto &payload = msg->get_raw_payload();
+    *len = payload.size();
+    return payload.data();
+}
+
 _opcode_t msg_get_opcode(const msg_t *self) { return self->get_opcode(); }
 
 uint32_t msg_get_magic(const msg_t *self) { return self->get_magic(); }
@@ -45,6 +45,8 @@ uint32_t netaddr_get_ip(const netaddr_t *self) { return self->ip; }
 
 uint16_t netaddr_get_port(const netaddr_t *self) { return self->port; }
 
+bool netaddr_is_ipv6(const netaddr_t *self) { return self->is_ipv6(); }
+
 netaddr_array_t *netaddr_array_new() { return new netaddr_array_t(); }
 netaddr_array_t *netaddr_array_new_from_addrs(const netaddr_t * const *addrs, size_t naddrs) {
     auto res = new netaddr_array_t();
@@ -31,6 +31,18 @@ void msgnetwork_config_max_msg_queue_size(msgnetwork_config_t *self, size_t size
     self->max_msg_queue_size(size);
 }
 
+void msgnetwork_config_max_stream_size(msgnetwork_config_t *self, size_t size) {
+    self->max_stream_size(size);
+}
+
+void msgnetwork_config_stream_frame_size(msgnetwork_config_t *self, size_t size) {
+    self->stream_frame_size(size);
+}
+
+void msgnetwork_config_msg_batch(msgnetwork_config_t *self, _opcode_t opcode, double window) {
+    self->msg_batch(opcode, window);
+}
+
 void msgnetwork_config_burst_size(msgnetwork_config_t *self, size_t burst_size) {
     self->burst_size(burst_size);
 }
@@ -43,10 +55,26 @@ void msgnetwork_config_conn_server_timeout(msgnetwork_config_t *self, double tim
     self->conn_server_timeout(timeout);
 }
 
+void msgnetwork_config_listen_per_worker(msgnetwork_config_t *self, bool enabled) {
+    self->listen_per_worker(enabled);
+}
+
 void msgnetwork_config_recv_chunk_size(msgnetwork_config_t *self, size_t size) {
     self->recv_chunk_size(size);
 }
 
+void msgnetwork_config_recv_chunk_size_min(msgnetwork_config_t *self, size_t size) {
+    self->recv_chunk_size_min(size);
+}
+
+void msgnetwork_config_recv_chunk_size_max(msgnetwork_config_t *self, size_t size) {
+    self->recv_chunk_size_max(size);
+}
+
+void msgnetwork_config_recv_exact(msgnetwork_config_t *self, bool enabled) {
+    self->recv_exact(enabled);
+}
+
 void msgnetwork_config_nworker(msgnetwork_config_t *self, size_t nworker) {
     self->nworker(nworker);
 }
@@ -59,6 +87,75 @@ void msgnetwork_config_max_send_buff_size(msgnetwork_config_t *self, size_t size
     self->max_send_buff_size(size);
 }
 
+void msgnetwork_config_max_send_buff_bytes(msgnetwork_config_t *self, size_t size) {
+    self->max_send_buff_bytes(size);
+}
+
+void msgnetwork_config_send_buff_high_watermark(msgnetwork_config_t *self, size_t size) {
+    self->send_buff_high_watermark(size);
+}
+
+void msgnetwork_config_send_buff_low_watermark(msgnetwork_config_t *self, size_t size) {
+    self->send_buff_low_watermark(size);
+}
+
+void msgnetwork_config_send_burst_size(msgnetwork_config_t *self, size_t size) {
+    self->send_burst_size(size);
+}
+
+void msgnetwork_config_queue_spin_time(msgnetwork_config_t *self, double t) {
+    self->queue_spin_time(t);
+}
+
+void msgnetwork_config_io_uring_entries(msgnetwork_config_t *self, size_t entries) {
+    self->io_uring_entries(entries);
+}
+
+void msgnetwork_config_checksum_type(msgnetwork_config_t *self, msgnetwork_checksum_type_t type) {
+    self->checksum_type(ChecksumType(type));
+}
+
+void msgnetwork_config_nhandler(msgnetwork_config_t *self, size_t nhandler) {
+    self->nhandler(nhandler);
+}
+
+void msgnetwork_config_handler_shard(msgnetwork_config_t *self, msgnetwork_handler_shard_t shard) {
+    self->handler_shard(msgnetwork_t::HandlerShard(shard));
+}
+
+void msgnetwork_config_worker_policy(msgnetwork_config_t *self, msgnetwork_worker_policy_t policy) {
+    self->worker_policy(ConnPool::WorkerPolicy(policy));
+}
+
+void msgnetwork_config_dispatcher_cpus(msgnetwork_config_t *self, const int *cpus, size_t ncpu) {
+    self->dispatcher_cpus(cpu_list_t(cpus, cpus + ncpu));
+}
+
+void msgnetwork_config_worker_cpus(msgnetwork_config_t *self, const int *cpus, size_t ncpu) {
+    std::vector<cpu_list_t> lists;
+    for (size_t i = 0; i < ncpu; i++) lists.push_back({cpus[i]});
+    self->worker_cpus(lists);
+}
+
+void msgnetwork_config_user_cpus(msgnetwork_config_t *self, const int *cpus, size_t ncpu) {
+    self->user_cpus(cpu_list_t(cpus, cpus + ncpu));
+}
+
+void msgnetwork_config_handler_cpus(msgnetwork_config_t *self, const int *cpus, size_t ncpu) {
+    std::vector<cpu_list_t> lists;
+    for (size_t i = 0; i < ncpu; i++) lists.push_back({cpus[i]});
+    self->handler_cpus(lists);
+}
+
+void msgnetwork_config_worker_selector(msgnetwork_config_t *self,
+                                        msgnetwork_worker_selector_t cb,
+                                        void *userdata) {
+    self->worker_selector([=](const ConnPool::conn_t &_conn, size_t nworker) {
+        auto conn = salticidae::static_pointer_cast<msgnetwork_t::Conn>(_conn);
+        return cb(&conn, nworker, userdata);
+    });
+}
+
 void msgnetwork_config_enable_tls(msgnetwork_config_t *self, bool enabled) {
     self->enable_tls(enabled);
 }
@@ -79,10 +176,60 @@ void msgnetwork_config_tls_cert_by_move(msgnetwork_config_t *self, x509_t *cert)
     self->tls_cert(new x509_t(std::move(*cert)));
 }
 
+void msgnetwork_config_tls_session_cache_size(msgnetwork_config_t *self, size_t size) {
+    self->tls_session_cache_size(size);
+}
+
+void msgnetwork_config_enable_ktls(msgnetwork_config_t *self, bool enabled) {
+    self->enable_ktls(enabled);
+}
+
+void msgnetwork_config_tls_io_budget(msgnetwork_config_t *self, size_t size) {
+    self->tls_io_budget(size);
+}
+
 bool msgnetwork_send_msg(msgnetwork_t *self, const msg_t *msg, const msgnetwork_conn_t *conn) {
     return self->_send_msg(*msg, *conn);
 }
 
+bool msgnetwork_send_msg_with_priority(msgnetwork_t *self, const msg_t *msg,
+                                    const msgnetwork_conn_t *conn,
+                                    msgnetwork_send_priority_t prio) {
+    return self->_send_msg(*msg, *conn, SendPriority(prio));
+}
+
+void msgnetwork_set_send_priority(msgnetwork_t *self, _opcode_t opcode,
+                                msgnetwork_send_priority_t prio) {
+    self->set_send_priority(opcode, SendPriority(prio));
+}
+
+bool msgnetwork_send_msg_stream(msgnetwork_t *self, const msg_t *msg,
+                                const msgnetwork_conn_t *conn) {
+    return self->_send_msg_stream(msg_t(*msg), *conn);
+}
+
+size_t msgnetwork_send_msgs_by_move(msgnetwork_t *self, msg_t * const *_moved_msgs,
+                                    size_t nmsg, const msgnetwork_conn_t *conn) {
+    size_t i = 0;
+    for (; i < nmsg; i++)
+        if (!self->_send_msg(std::move(*_moved_msgs[i]), *conn)) break;
+    return i;
+}
+
+bool msgnetwork_multicast_msg_by_move(msgnetwork_t *self, msg_t *_moved_msg,
+                                    const msgnetwork_conn_t * const *conns,
+                                    size_t nconn) {
+    std::vector<msgnetwork_conn_t> _conns;
+    _conns.reserve(nconn);
+    for (size_t i = 0; i < nconn; i++)
+        _conns.push_back(*conns[i]);
+    return self->_multicast_msg(std::move(*_moved_msg), _conns);
+}
+
+void msgnetwork_enable_stream_reassembly(msgnetwork_t *self, _opcode_t opcode) {
+    self->enable_stream_reassembly(opcode);
+}
+
 int32_t msgnetwork_send_msg_deferred_by_move(msgnetwork_t *self,
                                         msg_t *_moved_msg, const msgnetwork_conn_t *conn) {
     return self->_send_msg_deferred(std::move(*_moved_msg), *conn);
@@ -120,6 +267,24 @@ void msgnetwork_terminate(msgnetwork_t *self, const msgnetwork_conn_t *conn) {
     self->terminate(*conn);
 }
 
+void msgnetwork_pin_worker(msgnetwork_t *self, const netaddr_t *addr, size_t worker, SalticidaeCError *cerror) {
+    SALTICIDAE_CERROR_TRY(cerror)
+    self->pin_worker(*addr, worker);
+    SALTICIDAE_CERROR_CATCH(cerror)
+}
+
+void msgnetwork_unpin_worker(msgnetwork_t *self, const netaddr_t *addr) {
+    self->unpin_worker(*addr);
+}
+
+void msgnetwork_migrate(msgnetwork_t *self, const msgnetwork_conn_t *conn, size_t worker, SalticidaeCError *cerror) {
+    SALTICIDAE_CERROR_TRY(cerror)
+    self->migrate(*conn, worker);
+    SALTICIDAE_CERROR_CATCH(cerror)
+}
+
+void msgnetwork_rebalance(msgnetwork_t *self) { self->rebalance(); }
+
 void msgnetwork_reg_handler(msgnetwork_t *self,
                             _opcode_t opcode,
                             msgnetwork_msg_callback_t cb,
@@ -130,6 +295,28 @@ void msgnetwork_reg_handler(msgnetwork_t *self,
         });
 }
 
+void msgnetwork_reg_burst_handler(msgnetwork_t *self,
+                                _opcode_t opcode,
+                                msgnetwork_msg_burst_callback_t cb,
+                                void *userdata) {
+    self->reg_burst_handler(opcode,
+        [=](const msgnetwork_t::Msg *const *msgs,
+            const msgnetwork_conn_t *const *conns, size_t n) {
+            cb(msgs, conns, n, userdata);
+        });
+}
+
+void msgnetwork_reg_stream_handler(msgnetwork_t *self,
+                                _opcode_t opcode,
+                                msgnetwork_stream_callback_t cb,
+                                void *userdata) {
+    self->reg_stream_handler(opcode,
+        [=](msgnetwork_t::StreamChunk &&chunk, const msgnetwork_conn_t &conn) {
+            cb(&conn, chunk.stream_id, chunk.total, chunk.offset,
+                chunk.data.data(), chunk.data.size(), userdata);
+        });
+}
+
 void msgnetwork_reg_conn_handler(msgnetwork_t *self,
                                 msgnetwork_conn_callback_t cb,
                                 void *userdata) {
@@ -139,6 +326,15 @@ void msgnetwork_reg_conn_handler(msgnetwork_t *self,
     });
 }
 
+void msgnetwork_reg_send_buff_handler(msgnetwork_t *self,
+                                    msgnetwork_send_buff_callback_t cb,
+                                    void *userdata) {
+    self->reg_send_buff_handler([=](const ConnPool::conn_t &_conn, bool congested) {
+        auto conn = salticidae::static_pointer_cast<msgnetwork_t::Conn>(_conn);
+        cb(&conn, congested, userdata);
+    });
+}
+
 void msgnetwork_reg_error_handler(msgnetwork_t *self,
                                 msgnetwork_error_callback_t cb,
                                 void *userdata) {
@@ -175,6 +371,14 @@ bool msgnetwork_conn_is_terminated(const msgnetwork_conn_t *conn) {
     return (*conn)->is_terminated();
 }
 
+size_t msgnetwork_conn_get_send_buff_bytes(const msgnetwork_conn_t *conn) {
+    return (*conn)->get_send_buff_bytes();
+}
+
+bool msgnetwork_conn_is_send_congested(const msgnetwork_conn_t *conn) {
+    return (*conn)->is_send_congested();
+}
+
 // PeerNetwork
 
 void peerid_free(const peerid_t *self) { delete self; }
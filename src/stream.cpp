@@ -82,6 +82,8 @@ void datastream_clear(datastream_t *self) { self->clear(); }
 
 size_t datastream_size(const datastream_t *self) { return self->size(); }
 
+void datastream_reserve(datastream_t *self, size_t len) { self->reserve(len); }
+
 bool datastream_put_u8(datastream_t *self, uint8_t val) { try {*self << val; } catch (...) { return false; } return true; }
 bool datastream_put_u16(datastream_t *self, uint16_t val) { try {*self << val; } catch (...) { return false; } return true; }
 bool datastream_put_u32(datastream_t *self, uint32_t val) { try {*self << val; } catch (...) { return false; } return true; }
@@ -0,0 +1,171 @@
+#include "salticidae/uring.h"
+
+#ifdef SALTICIDAE_IO_URING
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+
+#include "salticidae/util.h"
+
+namespace salticidae {
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+                            unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, nullptr, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nargs) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+IOUring::IOUring(unsigned entries):
+        ring_fd(-1), efd(-1),
+        sq_ptr(MAP_FAILED), sq_len(0),
+        cq_ptr(MAP_FAILED), cq_len(0),
+        sqes((struct io_uring_sqe *)MAP_FAILED), sqes_len(0),
+        sq_local_tail(0), nqueued(0), ninflight(0) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    /* leave room for the completions of the requests queued meanwhile */
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = entries * 4;
+    if ((ring_fd = sys_io_uring_setup(entries, &p)) < 0)
+        throw SalticidaeError(SALTI_ERROR_IO_URING, errno);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (single_mmap) sq_len = cq_len = std::max(sq_len, cq_len);
+    sq_ptr = mmap(nullptr, sq_len, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED)
+    {
+        release();
+        throw SalticidaeError(SALTI_ERROR_IO_URING, errno);
+    }
+    if (single_mmap)
+        cq_ptr = sq_ptr;
+    else if ((cq_ptr = mmap(nullptr, cq_len, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+    {
+        release();
+        throw SalticidaeError(SALTI_ERROR_IO_URING, errno);
+    }
+    sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe *)mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        release();
+        throw SalticidaeError(SALTI_ERROR_IO_URING, errno);
+    }
+    auto sq = (uint8_t *)sq_ptr;
+    sq_head = (unsigned *)(sq + p.sq_off.head);
+    sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    sq_array = (unsigned *)(sq + p.sq_off.array);
+    sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    sq_entries = *(unsigned *)(sq + p.sq_off.ring_entries);
+    auto cq = (uint8_t *)cq_ptr;
+    cq_head = (unsigned *)(cq + p.cq_off.head);
+    cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    sq_local_tail = *sq_tail;
+    if ((efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+        sys_io_uring_register(ring_fd, IORING_REGISTER_EVENTFD, &efd, 1) < 0)
+    {
+        release();
+        throw SalticidaeError(SALTI_ERROR_IO_URING, errno);
+    }
+    /* drain() cancels with IORING_ASYNC_CANCEL_ANY (Linux 5.19), which an
+     * older kernel rejects with -EINVAL, leaving the requests in flight */
+    int res = 0;
+    try {
+        auto sqe = get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+        sqe->user_data = 1;
+        submit();
+        while (ninflight)
+        {
+            wait();
+            reap([&res](uint64_t, int _res) { res = _res; });
+        }
+    } catch (...) {
+        release();
+        throw;
+    }
+    if (res == -EINVAL)
+    {
+        release();
+        throw SalticidaeError(SALTI_ERROR_IO_URING, EOPNOTSUPP);
+    }
+    reset_notify();
+}
+
+void IOUring::release() {
+    if (sqes != MAP_FAILED) munmap(sqes, sqes_len);
+    if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_len);
+    if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_len);
+    sqes = (struct io_uring_sqe *)MAP_FAILED;
+    cq_ptr = sq_ptr = MAP_FAILED;
+    if (efd != -1) close(efd);
+    if (ring_fd != -1) close(ring_fd);
+    efd = ring_fd = -1;
+}
+
+void IOUring::reset_notify() {
+    uint64_t _;
+    if (read(efd, &_, sizeof(_))) {}
+}
+
+struct io_uring_sqe *IOUring::get_sqe() {
+    if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+        submit();
+    /* without SQPOLL, the kernel consumes the submitted entries right away */
+    while (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+    {
+        wait();
+        submit();
+    }
+    unsigned idx = sq_local_tail & sq_mask;
+    auto sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[idx] = idx;
+    sq_local_tail++;
+    nqueued++;
+    ninflight++;
+    return sqe;
+}
+
+void IOUring::submit() {
+    if (!nqueued) return;
+    __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+    int ret = sys_io_uring_enter(ring_fd, nqueued, 0, 0);
+    if (ret < 0)
+    {
+        /* the completion queue is backed up, try again later */
+        if (errno == EAGAIN || errno == EBUSY || errno == EINTR) return;
+        throw SalticidaeError(SALTI_ERROR_IO_URING, errno);
+    }
+    nqueued -= std::min((unsigned)ret, nqueued);
+}
+
+void IOUring::wait() {
+    if (sys_io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+        errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        throw SalticidaeError(SALTI_ERROR_IO_URING, errno);
+}
+
+}
+
+#endif
@@ -28,8 +28,19 @@
 #include <cstdio>
 #include <ctime>
 #include <cmath>
+#include <fstream>
+#include <algorithm>
+#include <climits>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <sched.h>
 
+#include "salticidae/type.h"
 #include "salticidae/util.h"
 
 namespace salticidae {
@@ -66,6 +77,11 @@ const char *SALTICIDAE_ERROR_STRINGS[] = {
     "operation not available",
     "unknown error",
     "oversized message",
+    "checksum can only be disabled with tls",
+    "invalid worker index",
+    "io_uring error",
+    "invalid stream frame",
+    "invalid batch frame",
 };
 
 const char *TTY_COLOR_RED = "\x1b[31m";
@@ -139,15 +155,123 @@ std::string stringprintf(const char *fmt, ...) {
     return ret;
 }
 
-const std::string get_current_datetime() {
+static std::string format_datetime(const struct timeval &tv) {
     /* credit: http://stackoverflow.com/a/41381479/544806 */
     char fmt[64], buf[64];
+    struct tm tm;
+    localtime_r(&tv.tv_sec, &tm);
+    strftime(fmt, sizeof fmt, "%Y-%m-%d %H:%M:%S.%%06u", &tm);
+    snprintf(buf, sizeof buf, fmt, (unsigned)tv.tv_usec);
+    return std::string(buf);
+}
+
+const std::string get_current_datetime() {
     struct timeval tv;
     gettimeofday(&tv, nullptr);
-    struct tm *tmp = localtime(&tv.tv_sec);
-    strftime(fmt, sizeof fmt, "%Y-%m-%d %H:%M:%S.%%06u", tmp);
-    snprintf(buf, sizeof buf, fmt, tv.tv_usec);
-    return std::string(buf);
+    return format_datetime(tv);
+}
+
+static uint64_t get_steady_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* a line formatted by the logging thread, most lines fit in place */
+struct LogRecord {
+    static const size_t inline_size = 256;
+    struct timeval tv;
+    const char *tag;
+    const char *color;
+    uint64_t nsuppressed;
+    size_t len;
+    char text[inline_size];
+    std::string long_text;
+};
+
+/* a single-producer single-consumer ring of lines from one thread */
+struct LogRing {
+    std::vector<LogRecord> slots;
+    const size_t mask;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    std::atomic<uint64_t> ndropped;
+
+    LogRing(size_t size): slots(size), mask(size - 1),
+        head(0), tail(0), ndropped(0) {}
+};
+
+struct Logger::ThreadState {
+    struct SiteState {
+        uint64_t window_start;
+        size_t nlines;
+        uint64_t nsuppressed;
+    };
+    /* keyed by the format string of the call site */
+    std::unordered_map<const char *, SiteState> sites;
+    std::shared_ptr<LogRing> ring;
+};
+
+struct Logger::AsyncState {
+    size_t ring_size;
+    uint64_t flush_interval_ns;
+    std::mutex mlock;
+    std::condition_variable cv;
+    bool stopped;
+    /* a ring stays here until its thread exits and it is drained */
+    std::vector<std::shared_ptr<LogRing>> rings;
+    /* the drops of the rings that are gone */
+    uint64_t ndropped_gone;
+    uint64_t ndropped_reported;
+    std::thread flusher;
+
+    AsyncState(): stopped(true), ndropped_gone(0), ndropped_reported(0) {}
+};
+
+static std::atomic<uint64_t> logger_id_counter(0);
+
+Logger::Logger(const char *prefix, int fd):
+        output(fd), opened(false), prefix(prefix),
+        id(logger_id_counter.fetch_add(1, std::memory_order_relaxed)),
+        rate_limit_burst(0), rate_limit_period_ns(0),
+        nsuppressed(0), async_enabled(false) {
+    set_color();
+}
+
+Logger::Logger(const char *prefix, const char *filename):
+        opened(true), prefix(prefix),
+        id(logger_id_counter.fetch_add(1, std::memory_order_relaxed)),
+        rate_limit_burst(0), rate_limit_period_ns(0),
+        nsuppressed(0), async_enabled(false) {
+    if ((output = open(filename, O_CREAT | O_WRONLY)) == -1)
+        throw SalticidaeError("logger cannot open file %s", filename);
+    set_color();
+}
+
+Logger::~Logger() {
+    disable_async();
+    if (opened) close(output);
+}
+
+Logger::ThreadState &Logger::get_thread_state() {
+    /* a thread may log to more than one logger, ids are never reused */
+    static thread_local std::vector<std::pair<uint64_t, std::unique_ptr<ThreadState>>> states;
+    for (auto &p: states)
+        if (p.first == id) return *p.second;
+    states.emplace_back(id, std::unique_ptr<ThreadState>(new ThreadState()));
+    return *states.back().second;
+}
+
+std::string Logger::format_line(const struct timeval &tv,
+                                const char *tag, const char *color,
+                                const char *msg, size_t len, uint64_t nsupp) {
+    std::string buff = color ? color : "";
+    buff += stringprintf("%s [%s %s] ", format_datetime(tv).c_str(), prefix, tag);
+    if (color) buff += TTY_COLOR_RESET;
+    buff.append(msg, len);
+    if (nsupp)
+        buff += stringprintf(" (%llu similar lines suppressed)", (unsigned long long)nsupp);
+    buff.push_back('\n');
+    return buff;
 }
 
 void Logger::set_color() {
@@ -166,12 +290,173 @@ void Logger::set_color() {
 
 void Logger::write(const char *tag, const char *color,
                     const char *fmt, va_list ap) {
-    std::string buff = color ? color : "";
-    buff += stringprintf("%s [%s %s] ", get_current_datetime().c_str(), prefix, tag);
-    if (color) buff += TTY_COLOR_RESET;
-    buff += vstringprintf(fmt, ap);
-    buff.push_back('\n');
-    ::write(output, &buff[0], buff.length());
+    bool is_async = async_enabled.load(std::memory_order_acquire);
+    ThreadState *ts = nullptr;
+    uint64_t nsupp = 0;
+    if (rate_limit_burst)
+    {
+        ts = &get_thread_state();
+        auto now = get_steady_ns();
+        auto &site = ts->sites[fmt];
+        if (!site.nlines || now - site.window_start >= rate_limit_period_ns)
+        {
+            site.window_start = now;
+            site.nlines = 0;
+        }
+        if (site.nlines >= rate_limit_burst)
+        {
+            site.nsuppressed++;
+            nsuppressed.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        site.nlines++;
+        nsupp = site.nsuppressed;
+        site.nsuppressed = 0;
+    }
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    if (!is_async)
+    {
+        auto msg = vstringprintf(fmt, ap);
+        auto buff = format_line(tv, tag, color, msg.data(), msg.length(), nsupp);
+        ::write(output, &buff[0], buff.length());
+        return;
+    }
+    if (!ts) ts = &get_thread_state();
+    if (!ts->ring)
+    {
+        ts->ring = std::make_shared<LogRing>(async->ring_size);
+        mutex_lg_t _(async->mlock);
+        async->rings.push_back(ts->ring);
+    }
+    auto &ring = *ts->ring;
+    auto h = ring.head.load(std::memory_order_relaxed);
+    auto t = ring.tail.load(std::memory_order_acquire);
+    if (h - t > ring.mask)
+    {
+        ring.ndropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    auto &r = ring.slots[h & ring.mask];
+    r.tv = tv;
+    r.tag = tag;
+    r.color = color;
+    r.nsuppressed = nsupp;
+    va_list ap2;
+    va_copy(ap2, ap);
+    int n = vsnprintf(r.text, LogRecord::inline_size, fmt, ap);
+    if (n < 0) n = 0;
+    r.len = n;
+    if ((size_t)n >= LogRecord::inline_size)
+        r.long_text = vstringprintf(fmt, ap2);
+    va_end(ap2);
+    ring.head.store(h + 1, std::memory_order_release);
+    /* wake up the flusher early once the ring is half full */
+    if (h - t == (ring.mask >> 1))
+        async->cv.notify_one();
+}
+
+void Logger::enable_async(size_t ring_size, double flush_interval) {
+    if (async_enabled.load(std::memory_order_relaxed)) return;
+    if (!async) async.reset(new AsyncState());
+    size_t size = 2;
+    while (size < ring_size) size <<= 1;
+    async->ring_size = size;
+    async->flush_interval_ns = flush_interval * 1e9;
+    async->stopped = false;
+    async->flusher = std::thread([this]() {
+        auto &as = *async;
+        std::vector<std::shared_ptr<LogRing>> rings;
+        std::vector<struct iovec> iov;
+        std::vector<std::string> lines;
+        bool stopped = false;
+        while (!stopped)
+        {
+            {
+                mutex_ul_t lk(as.mlock);
+                as.cv.wait_for(lk, std::chrono::nanoseconds(as.flush_interval_ns),
+                                [&as]() { return as.stopped; });
+                stopped = as.stopped;
+                /* forget the rings of the threads that are gone, once drained */
+                auto it = std::remove_if(as.rings.begin(), as.rings.end(),
+                    [&as](const std::shared_ptr<LogRing> &r) {
+                        if (r.use_count() > 1 ||
+                            r->head.load(std::memory_order_acquire) !=
+                            r->tail.load(std::memory_order_relaxed))
+                            return false;
+                        as.ndropped_gone += r->ndropped.load(std::memory_order_relaxed);
+                        return true;
+                    });
+                as.rings.erase(it, as.rings.end());
+                rings = as.rings;
+            }
+            for (auto &ring: rings)
+            {
+                auto t = ring->tail.load(std::memory_order_relaxed);
+                auto h = ring->head.load(std::memory_order_acquire);
+                for (; t != h; t++)
+                {
+                    auto &r = ring->slots[t & ring->mask];
+                    if (r.len < LogRecord::inline_size)
+                        lines.push_back(format_line(r.tv, r.tag, r.color, r.text, r.len, r.nsuppressed));
+                    else
+                    {
+                        lines.push_back(format_line(r.tv, r.tag, r.color,
+                                                    r.long_text.data(), r.long_text.length(),
+                                                    r.nsuppressed));
+                        std::string().swap(r.long_text);
+                    }
+                }
+                ring->tail.store(t, std::memory_order_release);
+            }
+            rings.clear();
+            uint64_t ndropped = get_ndropped();
+            if (ndropped != as.ndropped_reported)
+            {
+                struct timeval tv;
+                gettimeofday(&tv, nullptr);
+                auto msg = stringprintf("dropped %llu lines",
+                    (unsigned long long)(ndropped - as.ndropped_reported));
+                lines.push_back(format_line(tv, "warn", color_warning,
+                                            msg.data(), msg.length(), 0));
+                as.ndropped_reported = ndropped;
+            }
+            /* write the lines out in as few system calls as possible */
+            for (size_t i = 0; i < lines.size(); i += IOV_MAX)
+            {
+                iov.clear();
+                for (size_t j = i; j < std::min(lines.size(), i + IOV_MAX); j++)
+                    iov.push_back({(void *)lines[j].data(), lines[j].length()});
+                if (::writev(output, iov.data(), iov.size()) < 0) break;
+            }
+            lines.clear();
+        }
+    });
+    async_enabled.store(true, std::memory_order_release);
+}
+
+void Logger::disable_async() {
+    if (!async_enabled.exchange(false, std::memory_order_acq_rel)) return;
+    {
+        mutex_lg_t _(async->mlock);
+        async->stopped = true;
+    }
+    async->cv.notify_one();
+    async->flusher.join();
+}
+
+void Logger::set_rate_limit(size_t burst, double period) {
+    rate_limit_burst = burst;
+    rate_limit_period_ns = period * 1e9;
+}
+
+uint64_t Logger::get_ndropped() const {
+    if (!async) return 0;
+    mutex_lg_t _(async->mlock);
+    uint64_t res = async->ndropped_gone;
+    for (auto &r: async->rings)
+        res += r->ndropped.load(std::memory_order_relaxed);
+    return res;
 }
 
 void Logger::info(const char *fmt, ...) {
@@ -381,4 +666,38 @@ std::vector<std::string> trim_all(const std::vector<std::string> &ss) {
     return res;
 }
 
+bool set_thread_affinity(const cpu_list_t &cpus) {
+    if (cpus.empty()) return true;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu: cpus)
+        if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+cpu_list_t get_numa_node_cpus(int node) {
+    cpu_list_t res;
+    /* in the format of "0-7,16-23" */
+    std::ifstream f("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string line;
+    if (!std::getline(f, line)) return res;
+    for (const auto &range: split(trim(line), ","))
+    {
+        if (range.empty()) continue;
+        auto bounds = split(range, "-");
+        try {
+            int lo = std::stoi(bounds[0]);
+            int hi = bounds.size() > 1 ? std::stoi(bounds[1]) : lo;
+            for (int cpu = lo; cpu <= hi; cpu++) res.push_back(cpu);
+        } catch (std::logic_error &) {
+            return cpu_list_t();
+        }
+    }
+    return res;
+}
+
 }
@@ -0,0 +1,235 @@
+/**
+ * Copyright (c) 2018 Cornell University.
+ *
+ * Author: Ted Yin <tederminant@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Connection scale: a forked client process opens many connections to a
+ * ClientNetwork server, with a bounded number of connects pending at a time.
+ * The server reports how fast it accepts (and, with TLS, handshakes) them,
+ * and how much its resident memory grows per idle connection. When the run
+ * finishes, the result is printed to stdout as one JSON line. */
+
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "salticidae/msg.h"
+#include "salticidae/event.h"
+#include "salticidae/network.h"
+#include "salticidae/stat.h"
+
+using salticidae::NetAddr;
+using salticidae::MsgNetwork;
+using salticidae::ClientNetwork;
+using salticidae::ConnPool;
+using salticidae::EventContext;
+using salticidae::TimerEvent;
+using salticidae::Config;
+using salticidae::PKey;
+using salticidae::get_monotonic_ns;
+using opcode_t = uint8_t;
+
+using Net = MsgNetwork<opcode_t>;
+using Server = ClientNetwork<opcode_t>;
+
+static size_t get_rss() {
+    long pages = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f)
+    {
+        if (fscanf(f, "%*ld %ld", &pages) != 1) pages = 0;
+        fclose(f);
+    }
+    return pages * sysconf(_SC_PAGESIZE);
+}
+
+/* each connection takes a socket and the eventfd of its send queue */
+static void raise_nofile(size_t nclients) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) return;
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < nclients * 2 + 64)
+        SALTICIDAE_LOG_WARN("RLIMIT_NOFILE (%llu) is too low for %zu clients",
+                            (unsigned long long)rl.rlim_cur, nclients);
+}
+
+static ConnPool::Config make_config(bool use_tls, int nworker) {
+    ConnPool::Config cfg;
+    cfg.nworker(nworker).max_listen_backlog(1024);
+    if (use_tls)
+    {
+        auto tls_key = new PKey(PKey::create_privkey_rsa(2048));
+        auto tls_cert = new salticidae::X509(salticidae::X509::create_self_signed_from_pubkey(*tls_key));
+        cfg.enable_tls(true).tls_key(tls_key).tls_cert(tls_cert);
+    }
+    return cfg;
+}
+
+/* keep at most `concurrency` connects pending until `nclients` are up, then
+ * leave the connections idle until the parent kills us */
+static int run_clients(int ready_fd, const NetAddr &addr, size_t nclients,
+                        size_t concurrency, bool use_tls, int nworker) {
+    /* wait until the server is listening */
+    char c;
+    if (read(ready_fd, &c, 1) != 1) return 1;
+    close(ready_fd);
+    EventContext ec;
+    Net net(ec, Net::Config(make_config(use_tls, nworker)));
+    size_t nstarted = 0, nconnected = 0;
+    auto connect_next = [&]() {
+        nstarted++;
+        net.connect(addr);
+    };
+    net.reg_conn_handler([&](const ConnPool::conn_t &, bool connected) {
+        if (connected)
+            nconnected++;
+        else
+        {
+            /* failed to connect (e.g., backlog overflow), so try again */
+            nstarted--;
+        }
+        if (nstarted < nclients) connect_next();
+        return true;
+    });
+    net.reg_error_handler([](const std::exception_ptr, bool, int32_t) {});
+    net.start();
+    while (nstarted < std::min(concurrency, nclients)) connect_next();
+    salticidae::SigEvent ev_sigterm(ec, [&](int) { ec.stop(); });
+    ev_sigterm.add(SIGTERM);
+    ec.dispatch();
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    Config config;
+    auto opt_nclients = Config::OptValInt::create(10000);
+    auto opt_concurrency = Config::OptValInt::create(128);
+    auto opt_settle = Config::OptValDouble::create(1);
+    auto opt_timeout = Config::OptValDouble::create(120);
+    auto opt_nworker = Config::OptValInt::create(1);
+    auto opt_tls = Config::OptValFlag::create(false);
+    auto opt_help = Config::OptValFlag::create(false);
+    config.add_opt("nclients", opt_nclients, Config::SET_VAL, 'n', "number of client connections");
+    config.add_opt("concurrency", opt_concurrency, Config::SET_VAL, 'c', "number of pending connects");
+    config.add_opt("settle", opt_settle, Config::SET_VAL, -1, "seconds to stay idle before measuring memory");
+    config.add_opt("timeout", opt_timeout, Config::SET_VAL, -1, "give up after this many seconds");
+    config.add_opt("nworker", opt_nworker, Config::SET_VAL);
+    config.add_opt("tls", opt_tls, Config::SWITCH_ON, 't');
+    config.add_opt("help", opt_help, Config::SWITCH_ON, 'h', "show this help info");
+    config.parse(argc, argv);
+    if (opt_help->get())
+    {
+        config.print_help();
+        exit(0);
+    }
+    const size_t nclients = std::max(opt_nclients->get(), 1);
+    const bool use_tls = opt_tls->get();
+    raise_nofile(nclients);
+
+    NetAddr addr("127.0.0.1:12400");
+    /* fork before any thread is spawned, so the client process starts clean */
+    int ready[2];
+    if (pipe(ready) < 0)
+    {
+        perror("pipe");
+        return 1;
+    }
+    pid_t child = fork();
+    if (child < 0)
+    {
+        perror("fork");
+        return 1;
+    }
+    if (child == 0)
+    {
+        close(ready[1]);
+        _exit(run_clients(ready[0], addr, nclients, opt_concurrency->get(),
+                        use_tls, opt_nworker->get()));
+    }
+    close(ready[0]);
+
+    EventContext ec;
+    Server server(ec, Server::Config(make_config(use_tls, opt_nworker->get())));
+    size_t nconnected = 0, ndisconnected = 0;
+    uint64_t t_first = 0, t_last = 0;
+    size_t rss_base = 0, rss_idle = 0;
+    TimerEvent ev_settle(ec, [&](TimerEvent &) {
+        rss_idle = get_rss();
+        ec.stop();
+    });
+    server.reg_conn_handler([&](const ConnPool::conn_t &, bool connected) {
+        if (!connected)
+        {
+            ndisconnected++;
+            return true;
+        }
+        auto now = get_monotonic_ns();
+        if (!nconnected++) t_first = now;
+        if (nconnected == nclients)
+        {
+            t_last = now;
+            SALTICIDAE_LOG_INFO("all %zu clients connected", nclients);
+            ev_settle.add(opt_settle->get());
+        }
+        return true;
+    });
+    server.start();
+    server.listen(addr);
+    rss_base = get_rss();
+    if (write(ready[1], "", 1) != 1)
+    {
+        perror("write");
+        kill(child, SIGTERM);
+        waitpid(child, nullptr, 0);
+        return 1;
+    }
+    close(ready[1]);
+
+    TimerEvent ev_timeout(ec, [&](TimerEvent &) {
+        SALTICIDAE_LOG_WARN("timed out with %zu/%zu clients connected",
+                            nconnected, nclients);
+        ec.stop();
+    });
+    ev_timeout.add(opt_timeout->get());
+    salticidae::SigEvent ev_sigint(ec, [&](int) { ec.stop(); });
+    ev_sigint.add(SIGINT);
+    ec.dispatch();
+
+    kill(child, SIGTERM);
+    waitpid(child, nullptr, 0);
+    server.stop();
+
+    double elapsed = t_last > t_first ? (t_last - t_first) / 1e9 : 0;
+    size_t rss_delta = rss_idle > rss_base ? rss_idle - rss_base : 0;
+    printf("{\"bench\":\"conn_scale\",\"tls\":%d,\"nclients\":%zu,\"connected\":%zu,"
+            "\"disconnected\":%zu,\"accept_per_sec\":%.1f,"
+            "\"rss_base_bytes\":%zu,\"rss_idle_bytes\":%zu,\"bytes_per_conn\":%.1f}\n",
+            use_tls, nclients, nconnected, ndisconnected,
+            elapsed > 0 ? (nconnected - 1) / elapsed : 0,
+            rss_base, rss_idle,
+            rss_idle ? rss_delta / (double)nconnected : 0);
+    return t_last ? 0 : 1;
+}
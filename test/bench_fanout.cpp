@@ -0,0 +1,243 @@
+/**
+ * Copyright (c) 2018 Cornell University.
+ *
+ * Author: Ted Yin <tederminant@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Multicast fan-out: one PeerNetwork sender multicasts to N receivers, which
+ * all ack every message. A multicast completes when the last ack for it
+ * arrives; at most a fixed window of multicasts is outstanding. When the run
+ * finishes, the result is printed to stdout as one JSON line. */
+
+#include <cstdio>
+#include <string>
+#include <memory>
+#include <thread>
+#include <signal.h>
+
+/* disable SHA256 checksum */
+#define SALTICIDAE_NOCHECKSUM
+
+#include "salticidae/msg.h"
+#include "salticidae/event.h"
+#include "salticidae/network.h"
+#include "salticidae/stream.h"
+#include "salticidae/stat.h"
+
+using salticidae::NetAddr;
+using salticidae::DataStream;
+using salticidae::PeerNetwork;
+using salticidae::PeerId;
+using salticidae::ConnPool;
+using salticidae::EventContext;
+using salticidae::ThreadCall;
+using salticidae::Histogram;
+using salticidae::Config;
+using salticidae::PKey;
+using salticidae::htole;
+using salticidae::letoh;
+using salticidae::bytearray_t;
+using salticidae::get_monotonic_ns;
+using opcode_t = uint8_t;
+
+struct MsgData {
+    static const opcode_t opcode = 0x0;
+    DataStream serialized;
+    uint32_t seq;
+    MsgData(uint32_t seq, size_t size): seq(seq) {
+        serialized << htole(seq) << bytearray_t(size);
+    }
+    MsgData(DataStream &&s) {
+        s >> seq;
+        seq = letoh(seq);
+    }
+};
+
+struct MsgAck {
+    static const opcode_t opcode = 0x1;
+    DataStream serialized;
+    uint32_t seq;
+    MsgAck(uint32_t seq): seq(seq) { serialized << htole(seq); }
+    MsgAck(DataStream &&s) {
+        s >> seq;
+        seq = letoh(seq);
+    }
+};
+
+const opcode_t MsgData::opcode;
+const opcode_t MsgAck::opcode;
+
+using Net = PeerNetwork<opcode_t>;
+
+void masksigs() {
+	sigset_t mask;
+	sigemptyset(&mask);
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+}
+
+int main(int argc, char **argv) {
+    Config config;
+    auto opt_npeers = Config::OptValInt::create(16);
+    auto opt_size = Config::OptValInt::create(256);
+    auto opt_count = Config::OptValInt::create(10000);
+    auto opt_window = Config::OptValInt::create(64);
+    auto opt_nworker = Config::OptValInt::create(1);
+    auto opt_tls = Config::OptValFlag::create(false);
+    auto opt_help = Config::OptValFlag::create(false);
+    config.add_opt("npeers", opt_npeers, Config::SET_VAL, 'p', "number of receivers");
+    config.add_opt("size", opt_size, Config::SET_VAL, 's', "payload bytes per message");
+    config.add_opt("count", opt_count, Config::SET_VAL, 'n', "number of multicasts");
+    config.add_opt("window", opt_window, Config::SET_VAL, 'w', "number of outstanding multicasts");
+    config.add_opt("nworker", opt_nworker, Config::SET_VAL);
+    config.add_opt("tls", opt_tls, Config::SWITCH_ON, 't');
+    config.add_opt("help", opt_help, Config::SWITCH_ON, 'h', "show this help info");
+    config.parse(argc, argv);
+    if (opt_help->get())
+    {
+        config.print_help();
+        exit(0);
+    }
+    const size_t npeers = std::max(opt_npeers->get(), 1);
+    const size_t size = opt_size->get();
+    const size_t count = opt_count->get();
+    const size_t window = std::max(opt_window->get(), 1);
+    const bool use_tls = opt_tls->get();
+
+    auto make_config = [&]() {
+        ConnPool::Config cfg;
+        cfg.nworker(opt_nworker->get());
+        if (use_tls)
+        {
+            auto tls_key = new PKey(PKey::create_privkey_rsa(2048));
+            auto tls_cert = new salticidae::X509(salticidae::X509::create_self_signed_from_pubkey(*tls_key));
+            cfg.enable_tls(true).tls_key(tls_key).tls_cert(tls_cert);
+        }
+        Net::Config net_cfg(cfg);
+        net_cfg.max_msg_size(std::max(size + 64, (size_t)1024));
+        return net_cfg.id_mode(use_tls ? Net::CERT_BASED : Net::ADDR_BASED);
+    };
+    auto get_pid = [use_tls](Net &net, const NetAddr &addr) {
+        return use_tls ? PeerId(*net.get_cert()) : PeerId(addr);
+    };
+
+    /* all receivers share one event loop in a separate thread */
+    EventContext ec;
+    EventContext rec;
+    ThreadCall rtcall(rec);
+    NetAddr sender_addr("127.0.0.1:12300");
+    Net sender(ec, make_config());
+    std::vector<std::pair<NetAddr, std::unique_ptr<Net>>> receivers;
+    for (size_t i = 0; i < npeers; i++)
+    {
+        NetAddr addr("127.0.0.1:" + std::to_string(12301 + i));
+        receivers.emplace_back(addr, std::make_unique<Net>(rec, make_config()));
+        auto &net = *receivers.back().second;
+        net.reg_handler([&net](MsgData &&msg, const Net::conn_t &conn) {
+            net.send_msg(MsgAck(msg.seq), conn);
+        });
+        net.start();
+        net.listen(addr);
+    }
+    sender.start();
+    sender.listen(sender_addr);
+    auto sender_pid = get_pid(sender, sender_addr);
+    std::vector<PeerId> pids;
+    for (auto &r: receivers)
+    {
+        auto pid = get_pid(*r.second, r.first);
+        pids.push_back(pid);
+        sender.add_peer(pid);
+        sender.set_peer_addr(pid, r.first);
+        r.second->add_peer(sender_pid);
+        r.second->set_peer_addr(sender_pid, sender_addr);
+    }
+
+    Histogram completion;
+    std::vector<uint64_t> start_ts(count);
+    std::vector<uint32_t> nacks(count);
+    size_t nconnected = 0, nsent = 0, ncompleted = 0;
+    uint64_t t_begin = 0, t_end = 0;
+    auto send_next = [&]() {
+        start_ts[nsent] = get_monotonic_ns();
+        sender.multicast_msg(MsgData(nsent, size), pids);
+        nsent++;
+    };
+    sender.reg_peer_handler([&](const Net::conn_t &, bool connected) {
+        if (!connected)
+        {
+            if (ncompleted < count)
+            {
+                SALTICIDAE_LOG_WARN("a receiver disconnected before the run finished");
+                ec.stop();
+            }
+            return;
+        }
+        if (++nconnected != npeers) return;
+        SALTICIDAE_LOG_INFO("all %zu receivers connected", npeers);
+        t_begin = get_monotonic_ns();
+        while (nsent < std::min(window, count)) send_next();
+    });
+    sender.reg_handler([&](MsgAck &&msg, const Net::conn_t &) {
+        if (msg.seq >= count || ++nacks[msg.seq] != npeers) return;
+        auto now = get_monotonic_ns();
+        completion.add(now - start_ts[msg.seq]);
+        if (++ncompleted == count)
+        {
+            t_end = now;
+            ec.stop();
+            return;
+        }
+        if (nsent < count) send_next();
+    });
+
+    std::thread rthread([&]() {
+        masksigs();
+        rec.dispatch();
+    });
+    for (auto &pid: pids)
+        sender.conn_peer(pid);
+
+    salticidae::SigEvent ev_sigint(ec, [&](int) { ec.stop(); });
+    salticidae::SigEvent ev_sigterm(ec, [&](int) { ec.stop(); });
+    ev_sigint.add(SIGINT);
+    ev_sigterm.add(SIGTERM);
+    ec.dispatch();
+
+    sender.stop();
+    rtcall.async_call([&](ThreadCall::Handle &) { rec.stop(); });
+    rthread.join();
+    for (auto &r: receivers) r.second->stop();
+
+    double elapsed = t_end > t_begin ? (t_end - t_begin) / 1e9 : 0;
+    printf("{\"bench\":\"fanout\",\"tls\":%d,\"npeers\":%zu,\"size\":%zu,\"window\":%zu,"
+            "\"count\":%zu,\"multicast_per_sec\":%.1f,\"delivery_per_sec\":%.1f,"
+            "\"mean_ns\":%.0f,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}\n",
+            use_tls, npeers, size, window, ncompleted,
+            elapsed > 0 ? ncompleted / elapsed : 0,
+            elapsed > 0 ? ncompleted * npeers / elapsed : 0,
+            completion.get_mean(),
+            (unsigned long long)completion.get_percentile(50),
+            (unsigned long long)completion.get_percentile(99),
+            (unsigned long long)completion.get_percentile(99.9),
+            (unsigned long long)completion.get_max());
+    return t_end ? 0 : 1;
+}
@@ -0,0 +1,199 @@
+/**
+ * Copyright (c) 2018 Cornell University.
+ *
+ * Author: Ted Yin <tederminant@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Round-trip latency between two MsgNetwork instances: Alice keeps a fixed
+ * number of pings in flight and Bob echoes them back. When the run finishes,
+ * the result is printed to stdout as one JSON line. */
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <signal.h>
+
+/* disable SHA256 checksum */
+#define SALTICIDAE_NOCHECKSUM
+
+#include "salticidae/msg.h"
+#include "salticidae/event.h"
+#include "salticidae/network.h"
+#include "salticidae/stream.h"
+#include "salticidae/stat.h"
+
+using salticidae::NetAddr;
+using salticidae::DataStream;
+using salticidae::MsgNetwork;
+using salticidae::ConnPool;
+using salticidae::EventContext;
+using salticidae::ThreadCall;
+using salticidae::Histogram;
+using salticidae::Config;
+using salticidae::PKey;
+using salticidae::htole;
+using salticidae::letoh;
+using salticidae::bytearray_t;
+using salticidae::get_monotonic_ns;
+using opcode_t = uint8_t;
+
+struct MsgPing {
+    static const opcode_t opcode = 0x0;
+    DataStream serialized;
+    uint64_t ts;
+    MsgPing(uint64_t ts, size_t size): ts(ts) {
+        serialized << htole(ts) << bytearray_t(size);
+    }
+    MsgPing(DataStream &&s) {
+        s >> ts;
+        ts = letoh(ts);
+    }
+};
+
+const opcode_t MsgPing::opcode;
+
+using Net = MsgNetwork<opcode_t>;
+
+void masksigs() {
+	sigset_t mask;
+	sigemptyset(&mask);
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+}
+
+int main(int argc, char **argv) {
+    Config config;
+    auto opt_size = Config::OptValInt::create(256);
+    auto opt_count = Config::OptValInt::create(100000);
+    auto opt_warmup = Config::OptValInt::create(1000);
+    auto opt_inflight = Config::OptValInt::create(1);
+    auto opt_nworker = Config::OptValInt::create(1);
+    auto opt_tls = Config::OptValFlag::create(false);
+    auto opt_help = Config::OptValFlag::create(false);
+    config.add_opt("size", opt_size, Config::SET_VAL, 's', "payload bytes per ping");
+    config.add_opt("count", opt_count, Config::SET_VAL, 'n', "number of measured round trips");
+    config.add_opt("warmup", opt_warmup, Config::SET_VAL, 'w', "number of round trips to discard first");
+    config.add_opt("inflight", opt_inflight, Config::SET_VAL, 'i', "number of outstanding pings");
+    config.add_opt("nworker", opt_nworker, Config::SET_VAL);
+    config.add_opt("tls", opt_tls, Config::SWITCH_ON, 't');
+    config.add_opt("help", opt_help, Config::SWITCH_ON, 'h', "show this help info");
+    config.parse(argc, argv);
+    if (opt_help->get())
+    {
+        config.print_help();
+        exit(0);
+    }
+    const size_t size = opt_size->get();
+    const size_t count = opt_count->get();
+    const size_t warmup = opt_warmup->get();
+    const size_t inflight = std::max(opt_inflight->get(), 1);
+    const bool use_tls = opt_tls->get();
+
+    ConnPool::Config cfg;
+    cfg.nworker(opt_nworker->get());
+    if (use_tls)
+    {
+        auto tls_key = new PKey(PKey::create_privkey_rsa(2048));
+        auto tls_cert = new salticidae::X509(salticidae::X509::create_self_signed_from_pubkey(*tls_key));
+        cfg.enable_tls(true).tls_key(tls_key).tls_cert(tls_cert);
+    }
+    Net::Config net_cfg(cfg);
+    net_cfg.max_msg_size(std::max(size + 64, (size_t)1024));
+
+    NetAddr bob_addr("127.0.0.1:1236");
+    EventContext ec;
+    EventContext tec;
+    Net alice(ec, net_cfg);
+    Net bob(tec, net_cfg);
+    ThreadCall bob_tcall(tec);
+
+    bob.reg_handler([&bob, size](MsgPing &&msg, const Net::conn_t &conn) {
+        bob.send_msg(MsgPing(msg.ts, size), conn);
+    });
+
+    Histogram rtt;
+    size_t nsent = 0, nrecv = 0;
+    uint64_t t_begin = 0, t_end = 0;
+    alice.reg_conn_handler([&](const ConnPool::conn_t &conn, bool connected) {
+        if (connected)
+        {
+            auto _conn = salticidae::static_pointer_cast<Net::Conn>(conn);
+            for (; nsent < inflight; nsent++)
+                alice.send_msg(MsgPing(get_monotonic_ns(), size), _conn);
+        }
+        else if (nrecv < warmup + count)
+        {
+            SALTICIDAE_LOG_WARN("disconnected before the run finished");
+            ec.stop();
+        }
+        return true;
+    });
+    alice.reg_handler([&](MsgPing &&msg, const Net::conn_t &conn) {
+        auto now = get_monotonic_ns();
+        if (nrecv++ == warmup) t_begin = now;
+        if (nrecv > warmup) rtt.add(now - msg.ts);
+        if (nrecv == warmup + count)
+        {
+            t_end = now;
+            ec.stop();
+            return;
+        }
+        if (nsent < warmup + count)
+        {
+            nsent++;
+            alice.send_msg(MsgPing(get_monotonic_ns(), size), conn);
+        }
+    });
+
+    bob.start();
+    bob.listen(bob_addr);
+    std::thread bob_thread([&]() {
+        masksigs();
+        tec.dispatch();
+    });
+    alice.start();
+    alice.connect(bob_addr);
+
+    salticidae::SigEvent ev_sigint(ec, [&](int) { ec.stop(); });
+    salticidae::SigEvent ev_sigterm(ec, [&](int) { ec.stop(); });
+    ev_sigint.add(SIGINT);
+    ev_sigterm.add(SIGTERM);
+    ec.dispatch();
+
+    alice.stop();
+    bob_tcall.async_call([&](ThreadCall::Handle &) { tec.stop(); });
+    bob_thread.join();
+    bob.stop();
+
+    double elapsed = t_end > t_begin ? (t_end - t_begin) / 1e9 : 0;
+    printf("{\"bench\":\"latency\",\"tls\":%d,\"size\":%zu,\"inflight\":%zu,"
+            "\"count\":%llu,\"rtt_per_sec\":%.1f,\"mean_ns\":%.0f,"
+            "\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}\n",
+            use_tls, size, inflight,
+            (unsigned long long)rtt.get_count(),
+            elapsed > 0 ? rtt.get_count() / elapsed : 0,
+            rtt.get_mean(),
+            (unsigned long long)rtt.get_percentile(50),
+            (unsigned long long)rtt.get_percentile(99),
+            (unsigned long long)rtt.get_percentile(99.9),
+            (unsigned long long)rtt.get_max());
+    return t_end ? 0 : 1;
+}
@@ -0,0 +1,387 @@
+/**
+ * Copyright (c) 2018 Cornell University.
+ *
+ * Author: Ted Yin <tederminant@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/* Throughput and latency of the lock-free queues under contention, against a
+ * mutex-guarded baseline. Every comma-separated option value is swept, and
+ * each combination prints one JSON line to stdout. The dequeued elements are
+ * also checked (count, checksum, and per-producer FIFO order when there is a
+ * single consumer), so the bench doubles as a contention stress test. */
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <vector>
+
+#include "salticidae/util.h"
+#include "salticidae/queue.h"
+#include "salticidae/stat.h"
+
+using salticidae::Config;
+using salticidae::FreeList;
+using salticidae::Histogram;
+using salticidae::PaddedStat;
+using salticidae::get_monotonic_ns;
+
+/* the element carries its enqueue time, its origin and a payload that
+ * brings it to Size bytes */
+template<size_t Size>
+struct Elem {
+    uint64_t ts;
+    uint32_t producer;
+    uint32_t seq;
+    uint8_t payload[Size - 16];
+};
+
+template<typename T>
+class MutexDeque {
+    std::mutex m;
+    std::deque<T> q;
+
+    public:
+    bool enqueue(T &&e) {
+        std::lock_guard<std::mutex> _(m);
+        q.push_back(std::move(e));
+        return true;
+    }
+
+    bool try_dequeue(T &e) {
+        std::lock_guard<std::mutex> _(m);
+        if (q.empty()) return false;
+        e = std::move(q.front());
+        q.pop_front();
+        return true;
+    }
+};
+
+class MutexStack {
+    std::mutex m;
+    std::vector<FreeList::Node *> s;
+
+    public:
+    void push(FreeList::Node *u) {
+        std::lock_guard<std::mutex> _(m);
+        s.push_back(u);
+    }
+
+    bool pop(FreeList::Node *&r) {
+        std::lock_guard<std::mutex> _(m);
+        if (s.empty()) return false;
+        r = s.back();
+        s.pop_back();
+        return true;
+    }
+};
+
+struct RunConfig {
+    std::string queue;
+    size_t nproducers;
+    size_t nconsumers;
+    size_t elem_size;
+    size_t block_size;
+    size_t nops;
+    bool pin;
+};
+
+static void pin_thread(const RunConfig &rc, size_t idx) {
+    static const size_t ncpu = std::max(std::thread::hardware_concurrency(), 1u);
+    if (rc.pin) salticidae::set_thread_affinity({(int)(idx % ncpu)});
+}
+
+static void print_result(const RunConfig &rc, size_t elem_size, size_t nops,
+                        double elapsed, const Histogram &lat,
+                        uint64_t nempty, bool ok) {
+    printf("{\"bench\":\"queue\",\"queue\":\"%s\",\"nproducers\":%zu,"
+            "\"nconsumers\":%zu,\"elem_size\":%zu,\"block_size\":%zu,\"pin\":%d,"
+            "\"ops\":%zu,\"ops_per_sec\":%.1f,\"empty_polls\":%llu,"
+            "\"mean_ns\":%.0f,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,"
+            "\"max_ns\":%llu,\"ok\":%s}\n",
+            rc.queue.c_str(), rc.nproducers, rc.nconsumers, elem_size,
+            rc.block_size, rc.pin, nops,
+            elapsed > 0 ? nops / elapsed : 0,
+            (unsigned long long)nempty,
+            lat.get_mean(),
+            (unsigned long long)lat.get_percentile(50),
+            (unsigned long long)lat.get_percentile(99),
+            (unsigned long long)lat.get_percentile(99.9),
+            (unsigned long long)lat.get_max(),
+            ok ? "true" : "false");
+    fflush(stdout);
+}
+
+/* the latency of an element is the time between its enqueue and dequeue */
+template<typename Queue, typename T>
+static bool run_queue(const RunConfig &rc) {
+    Queue q;
+    const size_t nproducers = rc.nproducers;
+    const size_t nconsumers = rc.nconsumers;
+    const size_t nops = rc.nops;
+    struct ConsumerStat {
+        Histogram lat;
+        uint64_t nrecv = 0;
+        uint64_t sum = 0;
+        uint64_t nempty = 0;
+        bool ordered = true;
+    };
+    std::vector<PaddedStat<ConsumerStat>> stats(nconsumers);
+    std::atomic<bool> go(false), done(false);
+    std::vector<std::thread> producers, consumers;
+    for (size_t i = 0; i < nconsumers; i++)
+        consumers.emplace_back([&, i]() {
+            pin_thread(rc, nproducers + i);
+            auto &st = stats[i];
+            std::vector<int64_t> last_seq(nproducers, -1);
+            T e;
+            while (!go.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            for (;;)
+            {
+                if (!q.try_dequeue(e))
+                {
+                    if (done.load(std::memory_order_acquire) && !q.try_dequeue(e))
+                        break;
+                    st.nempty++;
+                    continue;
+                }
+                st.lat.add(get_monotonic_ns() - e.ts);
+                st.nrecv++;
+                st.sum += (uint64_t)e.producer * nops + e.seq;
+                if ((int64_t)e.seq <= last_seq[e.producer]) st.ordered = false;
+                last_seq[e.producer] = e.seq;
+            }
+        });
+    for (size_t i = 0; i < nproducers; i++)
+        producers.emplace_back([&, i]() {
+            pin_thread(rc, i);
+            T e;
+            e.producer = i;
+            while (!go.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            for (size_t j = 0; j < nops; j++)
+            {
+                e.seq = j;
+                e.ts = get_monotonic_ns();
+                while (!q.enqueue(std::move(e)))
+                    std::this_thread::yield();
+            }
+        });
+    auto t0 = get_monotonic_ns();
+    go.store(true, std::memory_order_release);
+    for (auto &t: producers) t.join();
+    done.store(true, std::memory_order_release);
+    for (auto &t: consumers) t.join();
+    double elapsed = (get_monotonic_ns() - t0) / 1e9;
+
+    const uint64_t total = nproducers * nops;
+    const uint64_t expected_sum = total * (total - 1) / 2;
+    Histogram lat;
+    uint64_t nrecv = 0, sum = 0, nempty = 0;
+    bool ordered = true;
+    for (auto &st: stats)
+    {
+        lat += st.lat;
+        nrecv += st.nrecv;
+        sum += st.sum;
+        nempty += st.nempty;
+        ordered &= st.ordered;
+    }
+    bool ok = nrecv == total && sum == expected_sum && (nconsumers > 1 || ordered);
+    if (!ok)
+        SALTICIDAE_LOG_ERROR("%s: got %llu/%llu elements, checksum %s, order %s",
+            rc.queue.c_str(), (unsigned long long)nrecv, (unsigned long long)total,
+            sum == expected_sum ? "ok" : "mismatch", ordered ? "ok" : "broken");
+    print_result(rc, sizeof(T), total, elapsed, lat, nempty, ok);
+    return ok;
+}
+
+/* every thread pops a node and pushes it back; a node popped by two threads
+ * at the same time is a failure, and the latency is that of a pop-push pair */
+template<typename Stack>
+static bool run_stack(const RunConfig &rc) {
+    struct Node: public FreeList::Node {
+        std::atomic<bool> held{false};
+    };
+    Stack s;
+    const size_t nthreads = rc.nproducers;
+    const size_t nops = rc.nops;
+    std::vector<Node> nodes(std::max(rc.block_size, (size_t)1));
+    for (auto &u: nodes) s.push(&u);
+    struct ThreadStat {
+        Histogram lat;
+        uint64_t nempty = 0;
+        bool ok = true;
+    };
+    std::vector<PaddedStat<ThreadStat>> stats(nthreads);
+    std::atomic<bool> go(false);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < nthreads; i++)
+        threads.emplace_back([&, i]() {
+            pin_thread(rc, i);
+            auto &st = stats[i];
+            while (!go.load(std::memory_order_acquire))
+                std::this_thread::yield();
+            for (size_t j = 0; j < nops; j++)
+            {
+                auto t = get_monotonic_ns();
+                FreeList::Node *_u;
+                while (!s.pop(_u))
+                {
+                    st.nempty++;
+                    std::this_thread::yield();
+                }
+                auto u = static_cast<Node *>(_u);
+                if (u->held.exchange(true, std::memory_order_acq_rel))
+                    st.ok = false;
+                u->held.store(false, std::memory_order_release);
+                s.push(u);
+                st.lat.add(get_monotonic_ns() - t);
+            }
+        });
+    auto t0 = get_monotonic_ns();
+    go.store(true, std::memory_order_release);
+    for (auto &t: threads) t.join();
+    double elapsed = (get_monotonic_ns() - t0) / 1e9;
+
+    Histogram lat;
+    uint64_t nempty = 0;
+    bool ok = true;
+    for (auto &st: stats)
+    {
+        lat += st.lat;
+        nempty += st.nempty;
+        ok &= st.ok;
+    }
+    /* all nodes must be back */
+    size_t nback = 0;
+    for (FreeList::Node *u; s.pop(u); ) nback++;
+    if (nback != nodes.size()) ok = false;
+    if (!ok)
+        SALTICIDAE_LOG_ERROR("%s: a node was popped twice or lost (%zu/%zu back)",
+            rc.queue.c_str(), nback, nodes.size());
+    print_result(rc, sizeof(Node), nthreads * nops, elapsed, lat, nempty, ok);
+    return ok;
+}
+
+template<size_t Size>
+static bool run_elem(const RunConfig &rc) {
+    using T = Elem<Size>;
+    if (rc.queue == "mutex")
+        return run_queue<MutexDeque<T>, T>(rc);
+    bool mpsc = rc.queue == "mpsc";
+    if (!mpsc && rc.queue != "mpmc")
+        throw std::invalid_argument("unknown queue: " + rc.queue);
+    switch (rc.block_size)
+    {
+        case 64:
+            return mpsc ? run_queue<salticidae::MPSCQueue<T, 64>, T>(rc) :
+                        run_queue<salticidae::MPMCQueue<T, 64>, T>(rc);
+        case 512:
+            return mpsc ? run_queue<salticidae::MPSCQueue<T, 512>, T>(rc) :
+                        run_queue<salticidae::MPMCQueue<T, 512>, T>(rc);
+        case 4096:
+            return mpsc ? run_queue<salticidae::MPSCQueue<T, 4096>, T>(rc) :
+                        run_queue<salticidae::MPMCQueue<T, 4096>, T>(rc);
+    }
+    throw std::invalid_argument("block size must be one of 64, 512, 4096");
+}
+
+static bool run(const RunConfig &rc) {
+    if (rc.queue == "freelist")
+        return run_stack<FreeList>(rc);
+    if (rc.queue == "mutex-stack")
+        return run_stack<MutexStack>(rc);
+    switch (rc.elem_size)
+    {
+        case 16: return run_elem<16>(rc);
+        case 64: return run_elem<64>(rc);
+        case 256: return run_elem<256>(rc);
+    }
+    throw std::invalid_argument("element size must be one of 16, 64, 256");
+}
+
+static std::vector<size_t> parse_sizes(const std::string &s) {
+    std::vector<size_t> res;
+    for (const auto &x: salticidae::split(s, ","))
+        res.push_back(std::stoul(x));
+    return res;
+}
+
+int main(int argc, char **argv) {
+    Config config;
+    auto opt_queue = Config::OptValStr::create("mpmc,mpsc,mutex");
+    auto opt_nproducers = Config::OptValStr::create("1,4");
+    auto opt_nconsumers = Config::OptValStr::create("1");
+    auto opt_elem_size = Config::OptValStr::create("64");
+    auto opt_block_size = Config::OptValStr::create("4096");
+    auto opt_nops = Config::OptValInt::create(200000);
+    auto opt_pin = Config::OptValFlag::create(false);
+    auto opt_help = Config::OptValFlag::create(false);
+    config.add_opt("queue", opt_queue, Config::SET_VAL, 'q',
+        "mpmc, mpsc, mutex (deque baseline), freelist or mutex-stack (free list baseline)");
+    config.add_opt("nproducers", opt_nproducers, Config::SET_VAL, 'p',
+        "number of producers (of threads for the free lists)");
+    config.add_opt("nconsumers", opt_nconsumers, Config::SET_VAL, 'c',
+        "number of consumers (always 1 for mpsc)");
+    config.add_opt("elem-size", opt_elem_size, Config::SET_VAL, 'e', "16, 64 or 256 bytes");
+    config.add_opt("block-size", opt_block_size, Config::SET_VAL, 'b',
+        "elements per queue block: 64, 512 or 4096 (nodes in the free lists)");
+    config.add_opt("nops", opt_nops, Config::SET_VAL, 'n', "operations per producer");
+    config.add_opt("pin", opt_pin, Config::SWITCH_ON, -1, "pin each thread to a core");
+    config.add_opt("help", opt_help, Config::SWITCH_ON, 'h', "show this help info");
+    config.parse(argc, argv);
+    if (opt_help->get())
+    {
+        config.print_help();
+        exit(0);
+    }
+    RunConfig rc;
+    rc.nops = opt_nops->get();
+    rc.pin = opt_pin->get();
+    bool ok = true;
+    for (const auto &queue: salticidae::split(opt_queue->get(), ","))
+    {
+        rc.queue = queue;
+        bool is_stack = queue == "freelist" || queue == "mutex-stack";
+        /* the parameters that do not apply to a kind of queue are not swept */
+        auto elem_sizes = is_stack ? std::vector<size_t>{0} : parse_sizes(opt_elem_size->get());
+        auto block_sizes = queue == "mutex" ? std::vector<size_t>{0} : parse_sizes(opt_block_size->get());
+        for (auto np: parse_sizes(opt_nproducers->get()))
+            for (auto nc: parse_sizes(opt_nconsumers->get()))
+            {
+                if ((queue == "mpsc" || is_stack) && nc != 1) continue;
+                for (auto es: elem_sizes)
+                    for (auto bs: block_sizes)
+                    {
+                        rc.nproducers = std::max(np, (size_t)1);
+                        rc.nconsumers = std::max(nc, (size_t)1);
+                        rc.elem_size = es;
+                        rc.block_size = bs;
+                        ok &= run(rc);
+                    }
+            }
+    }
+    return ok ? 0 : 1;
+}
@@ -24,8 +24,10 @@
 
 #include "salticidae/msg.h"
 #include "salticidae/network.h"
+#include "test_check.h"
 
 using salticidae::uint256_t;
+using salticidae::bytearray_t;
 using salticidae::DataStream;
 using salticidae::get_hash;
 using salticidae::get_hex;
@@ -63,9 +65,61 @@ struct MsgTest {
 
 const opcode_t MsgTest::opcode;
 
-int main() {
-    salticidae::MsgBase<opcode_t> msg(MsgTest(10), 0x0);
+void test_crc32c() {
+    const char *s = "123456789";
+    auto data = reinterpret_cast<const uint8_t *>(s);
+    /* the check value of CRC-32C */
+    check(salticidae::crc32c(0, data, 9) == 0xe3069283, "crc32c known answer");
+    check(salticidae::crc32c_sw(0, data, 9) == 0xe3069283, "crc32c (table) known answer");
+    /* both paths agree for any length and split */
+    bool same = true;
+    std::vector<uint8_t> buff(1000);
+    for (auto &b: buff) b = rand();
+    for (size_t len = 0; len < buff.size(); len += 7)
+    {
+        size_t half = len / 3;
+        auto crc = salticidae::crc32c(0, buff.data(), len);
+        same &= crc == salticidae::crc32c_sw(0, buff.data(), len);
+        same &= crc == salticidae::crc32c(
+            salticidae::crc32c_sw(0, buff.data(), half), buff.data() + half, len - half);
+    }
+    check(same, "crc32c hardware and table paths agree");
+}
+
+void test_sha1_wire_format() {
+    using msg_t = salticidae::MsgBase<opcode_t>;
+    msg_t msg(MsgTest(10), 0x0);
+    auto bytes = msg.serialize(salticidae::CHECKSUM_SHA1);
     printf("%s\n", std::string(msg).c_str());
+    /* magic, opcode, length, then the first 4 bytes of the SHA1 of the
+     * payload (as before the checksum types were added) */
+    check(get_hex(bytearray_t(bytes.begin(), bytes.begin() + msg_t::header_size)) ==
+            "00000000" "00" "44010000"
+#ifndef SALTICIDAE_NOCHECKSUM
+            "58ddacf5"
+#endif
+            , "sha1 header bytes");
+    auto &payload = msg.get_raw_payload();
+    check(bytearray_t(bytes.begin() + msg_t::header_size, bytes.end()) == payload,
+            "payload bytes");
+#ifndef SALTICIDAE_NOCHECKSUM
+    /* the checksum is the last field of the header */
+    const size_t checksum_pos = msg_t::header_size - sizeof(uint32_t);
+    salticidae::SHA1 sha1;
+    sha1.update(payload);
+    auto digest = sha1.digest();
+    check(bytearray_t(bytes.begin() + checksum_pos, bytes.begin() + msg_t::header_size) ==
+            bytearray_t(digest.begin(), digest.begin() + 4), "sha1 checksum");
+    /* a parsed header verifies against the same payload */
+    msg_t parsed(bytes.data());
+    parsed.set_payload(bytearray_t(payload));
+    check(parsed.verify_checksum(salticidae::CHECKSUM_SHA1), "sha1 verify");
+#endif
     MsgTest parse(msg.get_payload());
-    return 0;
+}
+
+int main() {
+    test_crc32c();
+    test_sha1_wire_format();
+    return failed ? 1 : 0;
 }
@@ -0,0 +1,216 @@
+/**
+ * Copyright (c) 2018 Cornell University.
+ *
+ * Author: Ted Yin <tederminant@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "salticidae/msg.h"
+#include "salticidae/event.h"
+#include "salticidae/network.h"
+#include "test_check.h"
+
+using salticidae::NetAddr;
+using salticidae::DataStream;
+using salticidae::MsgNetwork;
+using salticidae::ConnPool;
+using salticidae::EventContext;
+using salticidae::TimerEvent;
+using salticidae::SalticidaeError;
+using salticidae::htole;
+using salticidae::letoh;
+using opcode_t = uint8_t;
+using MsgNetworkByteOp = MsgNetwork<opcode_t>;
+
+const opcode_t batch_opcode = 0xfe;
+
+/* a sequence number followed by len bytes derived from it */
+struct MsgSeq {
+    static const opcode_t opcode = 0x7;
+    DataStream serialized;
+    uint32_t seq;
+    bool intact;
+    MsgSeq(uint32_t seq, size_t len): seq(seq), intact(true) {
+        serialized << htole(seq);
+        for (size_t i = 0; i < len; i++)
+            serialized << (uint8_t)(seq + i);
+    }
+    MsgSeq(DataStream &&s): intact(true) {
+        s >> seq;
+        seq = letoh(seq);
+        size_t len = s.size();
+        auto p = s.get_data_inplace(len);
+        for (size_t i = 0; i < len; i++)
+            if (p[i] != (uint8_t)(seq + i)) intact = false;
+    }
+};
+
+const opcode_t MsgSeq::opcode;
+
+/* a batch frame put together by hand */
+struct MsgRawBatch {
+    static const opcode_t opcode = batch_opcode;
+    DataStream serialized;
+    MsgRawBatch(DataStream &&s): serialized(std::move(s)) {}
+};
+
+const opcode_t MsgRawBatch::opcode;
+
+void add_entry(DataStream &s, opcode_t opcode, DataStream &&payload) {
+    s << opcode << htole((uint32_t)payload.size());
+    s.put_data(payload.data(), payload.data() + payload.size());
+}
+
+MsgNetworkByteOp::Config make_config(double window) {
+    MsgNetworkByteOp::Config config;
+    config.max_msg_size(65536).max_send_buff_size(0);
+    config.msg_batch(batch_opcode, window);
+    return config;
+}
+
+/* send one hand-made batch frame and return the error code that terminated
+ * the connection, or -1 if the frame was taken */
+int send_raw_batch(DataStream &&frame, uint16_t port,
+                    std::vector<uint32_t> &received) {
+    EventContext ec;
+    /* the zero window leaves the frame as it is */
+    MsgNetworkByteOp alice(ec, make_config(0)), bob(ec, make_config(0));
+    int code = -1;
+    bob.reg_handler([&](MsgSeq &&msg, const MsgNetworkByteOp::conn_t &) {
+        received.push_back(msg.intact ? msg.seq : 0xffffffff);
+    });
+    bob.reg_error_handler([&](const std::exception_ptr err, bool, int32_t) {
+        try {
+            std::rethrow_exception(err);
+        } catch (SalticidaeError &e) { code = e.get_code(); }
+    });
+    bob.reg_conn_handler([&](const ConnPool::conn_t &, bool connected) {
+        if (!connected) ec.stop();
+        return true;
+    });
+    alice.start();
+    bob.start();
+    NetAddr addr("127.0.0.1:" + std::to_string(port));
+    bob.listen(addr);
+    auto conn = alice.connect_sync(addr);
+    alice.send_msg(MsgRawBatch(std::move(frame)), conn);
+    /* a frame that is taken is followed by a marker */
+    alice.send_msg(MsgSeq(1000, 0), conn);
+    TimerEvent done(ec, [&](TimerEvent &t) {
+        if (!received.empty() && received.back() == 1000) ec.stop();
+        else t.add(0.01);
+    });
+    done.add(0.01);
+    TimerEvent timeout(ec, [&](TimerEvent &) { ec.stop(); });
+    timeout.add(5);
+    ec.dispatch();
+    /* the error is reported through the user's event context */
+    if (code == -1 && received.empty())
+    {
+        TimerEvent drain(ec, [&](TimerEvent &) { ec.stop(); });
+        drain.add(0.1);
+        ec.dispatch();
+    }
+    bob.stop();
+    alice.stop();
+    return code;
+}
+
+void test_unbatch() {
+    DataStream frame;
+    add_entry(frame, MsgSeq::opcode, MsgSeq(0, 3).serialized);
+    add_entry(frame, MsgSeq::opcode, MsgSeq(1, 0).serialized);
+    add_entry(frame, MsgSeq::opcode, MsgSeq(2, 300).serialized);
+    std::vector<uint32_t> received;
+    int code = send_raw_batch(std::move(frame), 23460, received);
+    check(code == -1, "well-formed batch accepted");
+    check(received == std::vector<uint32_t>({0, 1, 2, 1000}),
+            "batched messages delivered in order, before the next one");
+}
+
+void test_bad_batch(DataStream &&frame, uint16_t port, const char *what) {
+    std::vector<uint32_t> received;
+    int code = send_raw_batch(std::move(frame), port, received);
+    check(code == salticidae::SALTI_ERROR_CONN_BAD_BATCH && received.empty(), what);
+}
+
+void test_malformed() {
+    /* shorter than the opcode and the length of an entry */
+    DataStream truncated_header;
+    add_entry(truncated_header, MsgSeq::opcode, MsgSeq(0, 3).serialized);
+    truncated_header << MsgSeq::opcode << (uint8_t)1;
+    test_bad_batch(std::move(truncated_header), 23461,
+                    "truncated entry header rejected");
+    /* the length runs past the end of the frame */
+    DataStream overrun;
+    overrun << MsgSeq::opcode << htole((uint32_t)100);
+    auto payload = MsgSeq(0, 3).serialized;
+    overrun.put_data(payload.data(), payload.data() + payload.size());
+    test_bad_batch(std::move(overrun), 23462, "overrunning entry rejected");
+}
+
+/* the sender batches mixed sizes (some too large for a batch) while the
+ * receiver checks the order and the content */
+void test_order(size_t total) {
+    EventContext ec;
+    MsgNetworkByteOp alice(ec, make_config(20e-6)), bob(ec, make_config(20e-6));
+    uint32_t expected = 0;
+    size_t nbad = 0;
+    bob.reg_handler([&](MsgSeq &&msg, const MsgNetworkByteOp::conn_t &) {
+        if (msg.seq != expected || !msg.intact) nbad++;
+        expected = msg.seq + 1;
+        if (expected == total) ec.stop();
+    });
+    alice.start();
+    bob.start();
+    NetAddr addr("127.0.0.1:23463");
+    bob.listen(addr);
+    auto conn = alice.connect_sync(addr);
+    std::thread sender([&]() {
+        for (uint32_t i = 0; i < total; i++)
+        {
+            size_t len = i % 1000 ? (i % 5) * 20 : 65000;
+            while (!alice.send_msg(MsgSeq(i, len), conn))
+                std::this_thread::yield();
+            /* let the window expire now and then */
+            if (i % 100000 == 50000)
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    });
+    ec.dispatch();
+    sender.join();
+    printf("received %u of %zu messages\n", expected, total);
+    check(expected == total && !nbad, "batched messages in order and intact");
+    bob.stop();
+    alice.stop();
+}
+
+int main(int argc, char **argv) {
+    size_t total = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    test_unbatch();
+    test_malformed();
+    test_order(total);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,140 @@
+/**
+ * Copyright (c) 2018 Cornell University.
+ *
+ * Author: Ted Yin <tederminant@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "salticidae/netaddr.h"
+#include "salticidae/stream.h"
+#include "test_check.h"
+
+using salticidae::NetAddr;
+using salticidae::DataStream;
+using salticidae::SalticidaeError;
+
+std::string serialize_hex(const NetAddr &addr) {
+    DataStream s;
+    s << addr;
+    return s.get_hex();
+}
+
+NetAddr unserialize_hex(const std::string &hex) {
+    DataStream s(salticidae::from_hex(hex));
+    NetAddr addr;
+    s >> addr;
+    return addr;
+}
+
+void test_wire_format() {
+    /* an IPv4 address is serialized as before IPv6 was supported */
+    NetAddr v4("127.0.0.1:1234");
+    check(serialize_hex(v4) == "7f00000104d2", "ipv4 wire format");
+    check(v4.get_serialized_size() == 6, "ipv4 serialized size");
+    /* an IPv6 one is marked by the tag in place of the IPv4 address */
+    NetAddr v6("[::1]:4321");
+    check(serialize_hex(v6) == "ffffffff" "10e1"
+                                "00000000000000000000000000000001",
+            "ipv6 wire format");
+    check(v6.get_serialized_size() == 22, "ipv6 serialized size");
+}
+
+void test_parse() {
+    NetAddr a("[fe80::1:2]:80");
+    check(a.is_ipv6() && ntohs(a.port) == 80 && a.ip == 0 &&
+            std::string(a) == "<NetAddr [fe80::1:2]:80>", "bracketed ipv6");
+    NetAddr b("10.0.0.1:5");
+    check(!b.is_ipv6() && std::string(b) == "<NetAddr 10.0.0.1:5>", "ipv4");
+    check(a.get_family() == AF_INET6 && b.get_family() == AF_INET, "address family");
+    check(NetAddr("[fe80::1:2]:80").get_host() == NetAddr("[fe80::1:2]:0"), "ipv6 host");
+    int code = -1;
+    try {
+        NetAddr("1.2.3.4:70000");
+    } catch (SalticidaeError &e) { code = e.get_code(); }
+    check(code == salticidae::SALTI_ERROR_NETADDR_INVALID, "port out of range");
+    /* a name that getaddrinfo() rejects without a lookup */
+    code = -1;
+    std::string err;
+    try {
+        NetAddr(":80");
+    } catch (SalticidaeError &e) {
+        code = e.get_code();
+        err = e.what();
+        printf("%s\n", e.what());
+    }
+    check(code == salticidae::SALTI_ERROR_NETADDR_INVALID &&
+            err.find(gai_strerror(EAI_NONAME)) != std::string::npos,
+            "getaddrinfo error reported");
+}
+
+void test_v4_mapped() {
+    NetAddr mapped("[::ffff:10.0.0.1]:5");
+    NetAddr v4("10.0.0.1:5");
+    check(!mapped.is_ipv6() && mapped == v4 && mapped.get_hash() == v4.get_hash(),
+            "ipv4-mapped address folded to ipv4");
+    check(serialize_hex(mapped) == serialize_hex(v4), "ipv4-mapped wire format");
+    /* also when received tagged from a peer */
+    NetAddr tagged = unserialize_hex("ffffffff" "0005"
+                                    "00000000000000000000ffff0a000001");
+    check(tagged == v4, "tagged ipv4-mapped address folded to ipv4");
+    struct sockaddr_in6 sin6;
+    memset(&sin6, 0, sizeof(sin6));
+    sin6.sin6_family = AF_INET6;
+    sin6.sin6_port = htons(5);
+    inet_pton(AF_INET6, "::ffff:10.0.0.1", &sin6.sin6_addr);
+    check(NetAddr((const struct sockaddr *)&sin6) == v4,
+            "ipv4-mapped socket address folded to ipv4");
+}
+
+void test_round_trip() {
+    bool same = true;
+    for (auto str: {"127.0.0.1:1234", "0.0.0.0:0", "[::1]:4321", "[::]:1",
+                    "[fe80::1:2]:80", "[2001:db8::ff00:42:8329]:65535"})
+    {
+        NetAddr a(str);
+        DataStream s;
+        s << a;
+        NetAddr b;
+        s >> b;
+        struct sockaddr_storage ss;
+        a.get_sockaddr(&ss);
+        NetAddr c((const struct sockaddr *)&ss);
+        if (a != b || a.get_hash() != b.get_hash() || a != c || s.size())
+        {
+            printf("%s does not round trip\n", str);
+            same = false;
+        }
+    }
+    check(same, "serialization and socket address round trip");
+    check(NetAddr("[::1]:1") != NetAddr("[::2]:1") &&
+            NetAddr("[::1]:1") != NetAddr("0.0.0.0:1"), "ipv6 addresses differ");
+}
+
+int main() {
+    test_wire_format();
+    test_parse();
+    test_v4_mapped();
+    test_round_trip();
+    return failed ? 1 : 0;
+}
@@ -90,6 +90,7 @@ const uint8_t MsgAck::opcode;
 using MyNet = salticidae::PeerNetwork<uint8_t>;
 
 bool use_tls;
+bool use_stream;
 std::unordered_set<uint256_t> valid_certs;
 std::vector<NetAddr> addrs;
 
@@ -116,7 +117,10 @@ void install_proto(AppContext &app, const size_t &recv_chunk_size) {
     auto send_rand = [&](int size, const MyNet::conn_t &conn, TestContext &tc) {
         MsgRand msg(tc.view, size);
         tc.hash = msg.hash;
-        net.send_msg(std::move(msg), conn);
+        if (use_stream)
+            net.send_msg_stream(std::move(msg), conn);
+        else
+            net.send_msg(std::move(msg), conn);
     };
     net.reg_conn_handler([](const ConnPool::conn_t &conn, bool connected) {
         if (connected && use_tls)
@@ -144,6 +148,8 @@ void install_proto(AppContext &app, const size_t &recv_chunk_size) {
                 fatal ? "fatal" : "recoverable", async_id, err.what());
         }
     });
+    if (use_stream)
+        net.enable_stream_reassembly(MsgRand::opcode);
     net.reg_handler([&](MsgRand &&msg, const MyNet::conn_t &conn) {
         uint256_t hash = salticidae::get_hash(msg.bytes);
         net.send_msg(MsgAck(msg.view, hash), conn);
@@ -202,18 +208,26 @@ int main(int argc, char **argv) {
     auto opt_no_msg = Config::OptValFlag::create(false);
     auto opt_npeers = Config::OptValInt::create(5);
     auto opt_recv_chunk_size = Config::OptValInt::create(4096);
+    auto opt_recv_chunk_max = Config::OptValInt::create(0);
+    auto opt_recv_exact = Config::OptValFlag::create(false);
     auto opt_nworker = Config::OptValInt::create(2);
     auto opt_conn_timeout = Config::OptValDouble::create(5);
     auto opt_ping_peroid = Config::OptValDouble::create(2);
     auto opt_tls = Config::OptValFlag::create(false);
+    auto opt_io_uring = Config::OptValInt::create(0);
+    auto opt_stream = Config::OptValFlag::create(false);
     auto opt_help = Config::OptValFlag::create(false);
     config.add_opt("no-msg", opt_no_msg, Config::SWITCH_ON);
     config.add_opt("npeers", opt_npeers, Config::SET_VAL);
     config.add_opt("seg-buff-size", opt_recv_chunk_size, Config::SET_VAL);
+    config.add_opt("seg-buff-max", opt_recv_chunk_max, Config::SET_VAL);
+    config.add_opt("recv-exact", opt_recv_exact, Config::SWITCH_ON);
     config.add_opt("nworker", opt_nworker, Config::SET_VAL);
     config.add_opt("conn-timeout", opt_conn_timeout, Config::SET_VAL);
     config.add_opt("ping-period", opt_ping_peroid, Config::SET_VAL);
     config.add_opt("tls", opt_tls, Config::SWITCH_ON, 't');
+    config.add_opt("io-uring", opt_io_uring, Config::SET_VAL);
+    config.add_opt("stream", opt_stream, Config::SWITCH_ON, 's', "send the random messages as streams of small frames");
     config.add_opt("help", opt_help, Config::SWITCH_ON, 'h', "show this help info");
     config.parse(argc, argv);
     if (opt_help->get())
@@ -227,6 +241,7 @@ int main(int argc, char **argv) {
     std::vector<AppContext> apps;
     std::vector<std::thread> threads;
     use_tls = opt_tls->get();
+    use_stream = opt_stream->get();
     apps.resize(addrs.size());
     for (size_t i = 0; i < apps.size(); i++)
     {
@@ -245,10 +260,14 @@ int main(int argc, char **argv) {
         else cfg.enable_tls(false);
         a.net = new MyNet(a.ec, MyNet::Config(cfg
                     .nworker(opt_nworker->get())
-                    .recv_chunk_size(recv_chunk_size))
+                    .recv_chunk_size(recv_chunk_size)
+                    .recv_chunk_size_min(recv_chunk_size)
+                    .recv_chunk_size_max(opt_recv_chunk_max->get())
+                    .recv_exact(opt_recv_exact->get())
+                    .io_uring_entries(opt_io_uring->get()))
                         .conn_timeout(opt_conn_timeout->get())
                         .ping_period(opt_ping_peroid->get())
-                        .max_msg_size(65536));
+                        .max_msg_size(use_stream ? 1024 : 65536));
         a.tcall = new ThreadCall(a.ec);
         if (!opt_no_msg->get())
             install_proto(a, recv_chunk_size);
@@ -0,0 +1,187 @@
+/**
+ * Copyright (c) 2018 Cornell University.
+ *
+ * Author: Ted Yin <tederminant@gmail.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "salticidae/event.h"
+#include "test_check.h"
+
+using salticidae::EventContext;
+using salticidae::TimerEvent;
+using salticidae::TimerWheel;
+
+const uint64_t tick_ns = 1000000;
+
+/* the clock of the wheels under test, moved forward by the test */
+uint64_t fake_ns = 0;
+uint64_t fake_clock() { return fake_ns; }
+
+/* move the fake clock forward by [1, max_step] ticks at a time, until no
+ * timer is pending */
+void run(const EventContext &ec, TimerWheel &wheel, uint64_t max_step) {
+    std::mt19937_64 rng(1);
+    std::uniform_int_distribution<uint64_t> step(1, max_step);
+    TimerEvent ev_step(ec, [&](TimerEvent &t) {
+        if (!wheel.get_npending())
+        {
+            ec.stop();
+            return;
+        }
+        fake_ns += step(rng) * tick_ns;
+        t.add(0.001);
+    });
+    ev_step.add(0);
+    ec.dispatch();
+}
+
+/* timers are added with delays up to the range of all levels, and some of
+ * them are deleted or pushed back */
+void test_levels() {
+    EventContext ec;
+    TimerWheel wheel(ec, tick_ns / 1e9, fake_clock);
+    const size_t ntimer = 4000;
+    std::vector<TimerWheel::Timer> timers(ntimer);
+    std::vector<uint64_t> due(ntimer), fired(ntimer, 0);
+    std::vector<size_t> order;
+    size_t nearly = 0, ntwice = 0;
+    std::mt19937_64 rng(2);
+    for (size_t i = 0; i < ntimer; i++)
+    {
+        timers[i] = TimerWheel::Timer(wheel, [&, i](TimerWheel::Timer &) {
+            if (fired[i]) ntwice++;
+            fired[i] = fake_ns;
+            if (fake_ns < due[i]) nearly++;
+            order.push_back(i);
+        });
+        /* spread evenly over the levels (8 bits of ticks each), and due no
+         * sooner than the next tick (where a timer with no delay goes) */
+        uint64_t delay = 1 + rng() % ((uint64_t)1 << (rng() % 26));
+        due[i] = fake_ns + delay * tick_ns;
+        timers[i].add(delay * tick_ns / 1e9);
+    }
+    size_t nlevel3 = 0;
+    for (size_t i = 0; i < ntimer; i++)
+        if (due[i] - fake_ns >= ((uint64_t)1 << 24) * tick_ns) nlevel3++;
+    for (size_t i = 0; i < ntimer; i += 4) timers[i].del();
+    for (size_t i = 1; i < ntimer; i += 4)
+    {
+        due[i] += 1000 * tick_ns;
+        timers[i].add((due[i] - fake_ns) / 1e9);
+    }
+    run(ec, wheel, (uint64_t)1 << 16);
+    size_t nfired = 0, ndeleted_fired = 0;
+    for (size_t i = 0; i < ntimer; i++)
+    {
+        if (i % 4 == 0) ndeleted_fired += fired[i] != 0;
+        else nfired += fired[i] != 0;
+    }
+    printf("%zu timers beyond level 2, %zu fired\n", nlevel3, nfired);
+    check(nlevel3 > 0, "timers on the last level");
+    check(nfired == ntimer - ntimer / 4 && !ntwice, "every timer fires once");
+    check(!ndeleted_fired, "deleted timers do not fire");
+    check(!nearly, "no timer fires early");
+    bool sorted = std::is_sorted(order.begin(), order.end(),
+                                [&](size_t a, size_t b) { return due[a] < due[b]; });
+    check(sorted, "timers fire in the order of their deadlines");
+}
+
+/* the timers fire late but never early with the real clock */
+void test_real_clock() {
+    EventContext ec;
+    TimerWheel wheel(ec, 0.001);
+    const size_t ntimer = 1000;
+    std::vector<TimerWheel::Timer> timers(ntimer);
+    std::vector<uint64_t> due(ntimer);
+    size_t nfired = 0, nearly = 0;
+    uint64_t max_late = 0;
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<double> delay(0, 0.3);
+    for (size_t i = 0; i < ntimer; i++)
+    {
+        timers[i] = TimerWheel::Timer(wheel, [&, i](TimerWheel::Timer &) {
+            auto now = TimerWheel::steady_ns();
+            if (now < due[i]) nearly++;
+            else max_late = std::max(max_late, now - due[i]);
+            if (++nfired == ntimer) ec.stop();
+        });
+        auto d = delay(rng);
+        due[i] = TimerWheel::steady_ns() + (uint64_t)(d * 1e9);
+        timers[i].add(d);
+    }
+    TimerEvent ev_timeout(ec, [&](TimerEvent &) { ec.stop(); });
+    ev_timeout.add(10);
+    ec.dispatch();
+    printf("at most %.3f ms late\n", max_late / 1e6);
+    check(nfired == ntimer, "every timer fires (real clock)");
+    check(!nearly, "no timer fires early (real clock)");
+}
+
+/* a callback may re-add, delete or clear its own timer */
+void test_callback() {
+    EventContext ec;
+    TimerWheel wheel(ec, tick_ns / 1e9, fake_clock);
+    /* re-added with no delay: once per tick, not again within the tick */
+    size_t nimmediate = 0;
+    TimerWheel::Timer immediate(wheel, [&](TimerWheel::Timer &t) {
+        if (++nimmediate < 10) t.add(0);
+    });
+    /* re-added with a delay long enough to go to the upper levels */
+    std::vector<uint64_t> fired;
+    const double interval = (1 << 17) * tick_ns / 1e9;
+    TimerWheel::Timer periodic(wheel, [&](TimerWheel::Timer &t) {
+        fired.push_back(fake_ns);
+        if (fired.size() < 5) t.add(interval);
+    });
+    /* deleted, then cleared from its own callback */
+    size_t ncleared = 0;
+    TimerWheel::Timer cleared(wheel, [&](TimerWheel::Timer &t) {
+        ncleared++;
+        t.del();
+        t.clear();
+    });
+    auto start = fake_ns;
+    immediate.add(0);
+    periodic.add(interval);
+    cleared.add(0.01);
+    run(ec, wheel, 1 << 10);
+    check(nimmediate == 10, "re-added with no delay");
+    bool spaced = fired.size() == 5;
+    for (size_t i = 0; spaced && i < fired.size(); i++)
+        spaced = fired[i] - (i ? fired[i - 1] : start) >= (uint64_t)(interval * 1e9);
+    check(spaced, "re-added with a delay");
+    check(ncleared == 1 && !cleared, "cleared from its callback");
+    check(!wheel.get_npending(), "nothing left pending");
+}
+
+int main() {
+    fake_ns = TimerWheel::steady_ns();
+    test_levels();
+    test_callback();
+    test_real_clock();
+    return failed ? 1 : 0;
+}